@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bundle.hpp"
+
+namespace {
+
+	const unsigned char *mapping = nullptr;
+	size_t mappingSize = 0;
+	const BundleEntry *entries = nullptr;
+	uint32_t entryCount = 0;
+
+	bool valid(const BundleHeader &header, size_t fileSize) {
+		if (memcmp(header.magic, BundleMagic, sizeof(BundleMagic)) != 0 || header.version != BundleVersion)
+			return false;
+		if (sizeof(BundleHeader) + size_t(header.entryCount) * sizeof(BundleEntry) > fileSize)
+			return false;
+
+		auto *records = (const BundleEntry *) (mapping + sizeof(BundleHeader));
+		for (uint32_t i = 0; i < header.entryCount; i++) {
+			const BundleEntry &entry = records[i];
+			if (entry.name[sizeof(entry.name) - 1] != '\0' || entry.offset > fileSize ||
+			    entry.size > fileSize - entry.offset)
+				return false;
+		}
+		return true;
+	}
+}
+
+bool bundleOpen(const char *path) {
+	bundleClose();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(BundleHeader)) {
+		close(fd);
+		return false;
+	}
+	void *file = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps the file alive
+	if (file == MAP_FAILED)
+		return false;
+
+	mapping = (const unsigned char *) file;
+	mappingSize = (size_t) info.st_size;
+
+	auto *header = (const BundleHeader *) mapping;
+	if (!valid(*header, mappingSize)) {
+		fprintf(stderr, "%s is not a version %u asset bundle, using the loose files\n", path, BundleVersion);
+		bundleClose();
+		return false;
+	}
+	entries = (const BundleEntry *) (mapping + sizeof(BundleHeader));
+	entryCount = header->entryCount;
+
+	printf("%u assets mapped from %s\n", entryCount, path);
+	return true;
+}
+
+void bundleClose() {
+	if (mapping != nullptr)
+		munmap((void *) mapping, mappingSize);
+	mapping = nullptr;
+	mappingSize = 0;
+	entries = nullptr;
+	entryCount = 0;
+}
+
+bool bundleActive() {
+	return mapping != nullptr;
+}
+
+bool bundleFind(const char *name, BundleView &view) {
+	// A handful of entries, a linear scan over one page of directory is all it takes
+	for (uint32_t i = 0; i < entryCount; i++) {
+		if (strcmp(entries[i].name, name) == 0) {
+			view.data = mapping + entries[i].offset;
+			view.size = (size_t) entries[i].size;
+			view.kind = entries[i].kind;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool bundleFindMesh(const char *name, uint32_t &vertexCount, const float *&positions, const float *&uvs,
+                    const float *&normals) {
+	BundleView view;
+	if (!bundleFind(name, view) || view.kind != BUNDLE_MESH || view.size < sizeof(BundleMesh))
+		return false;
+
+	auto *mesh = (const BundleMesh *) view.data;
+	size_t floatsPerVertex = (mesh->flags & BUNDLE_MESH_UVS) ? 8 : 6;
+	if (sizeof(BundleMesh) + size_t(mesh->vertexCount) * floatsPerVertex * sizeof(float) > view.size)
+		return false;
+
+	vertexCount = mesh->vertexCount;
+	positions = (const float *) (mesh + 1);
+	uvs = (mesh->flags & BUNDLE_MESH_UVS) ? positions + 3 * size_t(vertexCount) : nullptr;
+	normals = positions + (floatsPerVertex - 3) * size_t(vertexCount);
+	return true;
+}
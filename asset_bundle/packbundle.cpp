@@ -0,0 +1,158 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/bundle.hpp"
+#include "common/objparser.hpp"
+
+/*
+ * Packs the files a demo loads at startup into one asset bundle, see common/bundle.hpp
+ *
+ *	packbundle assets.bundle skull.obj StandardShading.vertexshader StandardShading.fragmentshader uvmap.DDS
+ *	packbundle --list assets.bundle
+ *
+ * Run it from the directory the demo runs in, entries are named by the paths given here.
+ * OBJ files are parsed here once and stored as triangle soups, everything else is copied.
+ */
+
+bool readFile(const char *path, std::string &out) {
+    std::ifstream stream(path, std::ios::in | std::ios::binary);
+    if (!stream.is_open())
+        return false;
+    std::stringstream sstr;
+    sstr << stream.rdbuf();
+    out = sstr.str();
+    return true;
+}
+
+bool endsWith(const std::string &text, const char *suffix) {
+    size_t length = strlen(suffix);
+    return text.size() >= length && strcasecmp(text.c_str() + text.size() - length, suffix) == 0;
+}
+
+/**
+ * @brief Flattens an OBJ file into a BundleMesh blob: every face corner gets its own vertex
+ * Same parser as the demos' loadOBJ, so a bundled mesh matches the loose file exactly.
+ */
+bool packOBJ(const std::string &text, std::string &blob) {
+    ObjMesh parsed;
+    if (!objParse(text.data(), text.size(), parsed))
+        return false;
+
+    BundleMesh mesh{(uint32_t) parsed.vertexCount(), parsed.uvs.empty() ? 0u : BUNDLE_MESH_UVS};
+    blob.assign((const char *) &mesh, sizeof(mesh));
+    blob.append((const char *) parsed.positions.data(), parsed.positions.size() * sizeof(float));
+    blob.append((const char *) parsed.uvs.data(), parsed.uvs.size() * sizeof(float));
+    blob.append((const char *) parsed.normals.data(), parsed.normals.size() * sizeof(float));
+
+    printf("  %u vertices%s\n", mesh.vertexCount, (mesh.flags & BUNDLE_MESH_UVS) ? " with UVs" : "");
+    return true;
+}
+
+size_t alignUp(size_t offset) {
+    return (offset + BundleAlignment - 1) / BundleAlignment * BundleAlignment;
+}
+
+int pack(const char *bundlePath, int fileCount, char **files) {
+    std::vector<BundleEntry> entries((size_t) fileCount);
+    std::vector<std::string> blobs((size_t) fileCount);
+
+    size_t offset = alignUp(sizeof(BundleHeader) + entries.size() * sizeof(BundleEntry));
+    for (int i = 0; i < fileCount; i++) {
+        BundleEntry &entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+
+        if (strlen(files[i]) >= sizeof(entry.name)) {
+            fprintf(stderr, "%s : names are limited to %zu characters\n", files[i], sizeof(entry.name) - 1);
+            return EXIT_FAILURE;
+        }
+        strcpy(entry.name, files[i]);
+
+        std::string contents;
+        if (!readFile(files[i], contents)) {
+            fprintf(stderr, "Could not read %s\n", files[i]);
+            return EXIT_FAILURE;
+        }
+
+        printf("%s\n", files[i]);
+        if (endsWith(files[i], ".obj")) {
+            entry.kind = BUNDLE_MESH;
+            if (!packOBJ(contents, blobs[i]))
+                return EXIT_FAILURE;
+        } else {
+            entry.kind = BUNDLE_RAW;
+            blobs[i].swap(contents);
+        }
+
+        entry.offset = offset;
+        entry.size = blobs[i].size();
+        offset = alignUp(offset + blobs[i].size());
+    }
+
+    FILE *file = fopen(bundlePath, "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Could not write %s\n", bundlePath);
+        return EXIT_FAILURE;
+    }
+
+    BundleHeader header{};
+    memcpy(header.magic, BundleMagic, sizeof(BundleMagic));
+    header.version = BundleVersion;
+    header.entryCount = (uint32_t) entries.size();
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(entries.data(), sizeof(BundleEntry), entries.size(), file);
+
+    // Zero padding up to each entry's page
+    std::vector<char> padding(BundleAlignment, 0);
+    for (size_t i = 0; i < entries.size(); i++) {
+        fwrite(padding.data(), 1, entries[i].offset - (size_t) ftell(file), file);
+        fwrite(blobs[i].data(), 1, blobs[i].size(), file);
+    }
+    bool written = ferror(file) == 0;
+    long size = ftell(file);
+    fclose(file);
+    if (!written) {
+        fprintf(stderr, "Could not write %s\n", bundlePath);
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu assets, %ld bytes written to %s\n", entries.size(), size, bundlePath);
+    return EXIT_SUCCESS;
+}
+
+int list(const char *bundlePath) {
+    if (!bundleOpen(bundlePath)) {
+        fprintf(stderr, "Could not open %s\n", bundlePath);
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream stream(bundlePath, std::ios::binary);
+    BundleHeader header{};
+    stream.read((char *) &header, sizeof(header));
+    for (uint32_t i = 0; i < header.entryCount; i++) {
+        BundleEntry entry{};
+        stream.read((char *) &entry, sizeof(entry));
+
+        BundleView view{};
+        bundleFind(entry.name, view);
+        printf("%-48s %10zu bytes at %8llu%s\n", entry.name, view.size, (unsigned long long) entry.offset,
+               view.kind == BUNDLE_MESH ? ", mesh" : "");
+    }
+    bundleClose();
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "--list") == 0)
+        return list(argv[2]);
+
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s BUNDLE FILE...\n       %s --list BUNDLE\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    return pack(argv[1], argc - 2, argv + 2);
+}
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "meshnormals.hpp"
+
+namespace {
+
+	// Below this many triangles a single thread is quicker than starting the others
+	const size_t MinChunkTriangles = 32 * 1024;
+
+	const double Pi = 3.14159265358979323846;
+
+	// Per vertex sums in fixed point. The largest contribution a triangle can make maps to 2^40,
+	// which leaves room for 2^23 of them on a vertex before a sum overflows.
+	struct FixedSums {
+		std::unique_ptr<std::atomic<long long>[]> values;
+		double scale;
+
+		FixedSums(size_t count, double largest) : values(new std::atomic<long long>[count]),
+		                                          scale(largest > 0 ? 1099511627776.0 / largest : 0) {
+			for (size_t i = 0; i < count; i++)
+				values[i].store(0, std::memory_order_relaxed);
+		}
+
+		void add(size_t index, double value) {
+			values[index].fetch_add(std::llround(value * scale), std::memory_order_relaxed);
+		}
+
+		double get(size_t index) const {
+			return scale > 0 ? (double) values[index].load(std::memory_order_relaxed) / scale : 0;
+		}
+	};
+
+	// work(first, last) over [0, count), one range per thread
+	template<typename Work>
+	void forEachRange(size_t count, Work work) {
+		size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+		size_t rangeCount = std::max<size_t>(1, std::min(threadCount, count / MinChunkTriangles));
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < rangeCount; i++)
+			threads.emplace_back(work, count * i / rangeCount, count * (i + 1) / rangeCount);
+		work((size_t) 0, count / rangeCount);
+		for (std::thread &thread : threads)
+			thread.join();
+	}
+
+	inline void subtract(const float *a, const float *b, double *out) {
+		for (int c = 0; c < 3; c++)
+			out[c] = (double) a[c] - b[c];
+	}
+
+	inline void cross(const double *a, const double *b, double *out) {
+		out[0] = a[1] * b[2] - a[2] * b[1];
+		out[1] = a[2] * b[0] - a[0] * b[2];
+		out[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	inline double dot(const double *a, const double *b) {
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+
+	inline bool normalize(double *v) {
+		double length = std::sqrt(dot(v, v));
+		if (length == 0)
+			return false;
+		for (int c = 0; c < 3; c++)
+			v[c] /= length;
+		return true;
+	}
+
+	// v minus its component along the unit vector n, normalized
+	inline bool orthogonalize(double *v, const double *n) {
+		double along = dot(v, n);
+		for (int c = 0; c < 3; c++)
+			v[c] -= along * n[c];
+		return normalize(v);
+	}
+
+	// Squared diagonal of the bounding box, no face normal component gets larger
+	double squaredDiagonal(const float *positions, size_t vertexCount) {
+		if (vertexCount == 0)
+			return 0;
+		float low[3], high[3];
+		for (int c = 0; c < 3; c++)
+			low[c] = high[c] = positions[c];
+		for (size_t i = 1; i < vertexCount; i++) {
+			for (int c = 0; c < 3; c++) {
+				low[c] = std::min(low[c], positions[3 * i + c]);
+				high[c] = std::max(high[c], positions[3 * i + c]);
+			}
+		}
+		double diagonal[3];
+		subtract(high, low, diagonal);
+		return dot(diagonal, diagonal);
+	}
+}
+
+void meshSmoothNormals(const float *positions, size_t vertexCount, const unsigned int *indices, size_t indexCount,
+                       float *normals) {
+	FixedSums sums(3 * vertexCount, squaredDiagonal(positions, vertexCount));
+
+	// The cross product is twice the area times the unit normal, the weighting comes for free
+	forEachRange(indexCount / 3, [&](size_t first, size_t last) {
+		for (size_t t = first; t < last; t++) {
+			const unsigned int *corner = indices + 3 * t;
+			double edge1[3], edge2[3], faceNormal[3];
+			subtract(positions + 3 * corner[1], positions + 3 * corner[0], edge1);
+			subtract(positions + 3 * corner[2], positions + 3 * corner[0], edge2);
+			cross(edge1, edge2, faceNormal);
+			for (int i = 0; i < 3; i++)
+				for (int c = 0; c < 3; c++)
+					sums.add(3 * corner[i] + c, faceNormal[c]);
+		}
+	});
+
+	forEachRange(vertexCount, [&](size_t first, size_t last) {
+		for (size_t v = first; v < last; v++) {
+			double normal[3] = {sums.get(3 * v), sums.get(3 * v + 1), sums.get(3 * v + 2)};
+			normalize(normal);
+			for (int c = 0; c < 3; c++)
+				normals[3 * v + c] = (float) normal[c];
+		}
+	});
+}
+
+void meshTangents(const float *positions, const float *uvs, const float *normals, size_t vertexCount,
+                  const unsigned int *indices, size_t indexCount, float *tangents) {
+	// Unit vectors weighted by an angle, at most pi a component
+	FixedSums tangentSums(3 * vertexCount, Pi), bitangentSums(3 * vertexCount, Pi);
+
+	forEachRange(indexCount / 3, [&](size_t first, size_t last) {
+		for (size_t t = first; t < last; t++) {
+			const unsigned int *corner = indices + 3 * t;
+			const float *uv[3] = {uvs + 2 * corner[0], uvs + 2 * corner[1], uvs + 2 * corner[2]};
+			double du1 = (double) uv[1][0] - uv[0][0], dv1 = (double) uv[1][1] - uv[0][1];
+			double du2 = (double) uv[2][0] - uv[0][0], dv2 = (double) uv[2][1] - uv[0][1];
+
+			// Twice the signed UV area, negative where the mapping is mirrored
+			double uvArea = du1 * dv2 - du2 * dv1;
+			if (uvArea == 0)
+				continue;
+			double sign = uvArea < 0 ? -1 : 1;
+
+			double edge1[3], edge2[3], faceTangent[3], faceBitangent[3];
+			subtract(positions + 3 * corner[1], positions + 3 * corner[0], edge1);
+			subtract(positions + 3 * corner[2], positions + 3 * corner[0], edge2);
+			for (int c = 0; c < 3; c++) {
+				faceTangent[c] = sign * (dv2 * edge1[c] - dv1 * edge2[c]);
+				faceBitangent[c] = sign * (du1 * edge2[c] - du2 * edge1[c]);
+			}
+
+			// Unit edges, edges[i] going from corner i to the next one
+			double edges[3][3];
+			bool degenerate = false;
+			for (int i = 0; i < 3; i++) {
+				subtract(positions + 3 * corner[(i + 1) % 3], positions + 3 * corner[i], edges[i]);
+				degenerate |= !normalize(edges[i]);
+			}
+			if (degenerate)
+				continue;
+
+			for (int i = 0; i < 3; i++) {
+				const float *vertexNormal = normals + 3 * corner[i];
+				double normal[3] = {vertexNormal[0], vertexNormal[1], vertexNormal[2]};
+				double tangent[3] = {faceTangent[0], faceTangent[1], faceTangent[2]};
+				double bitangent[3] = {faceBitangent[0], faceBitangent[1], faceBitangent[2]};
+				if (!orthogonalize(tangent, normal) || !orthogonalize(bitangent, normal))
+					continue;
+
+				// Between the edge leaving the corner and the one coming in, reversed
+				double angle = std::acos(std::max(-1.0, std::min(1.0, -dot(edges[i], edges[(i + 2) % 3]))));
+
+				for (int c = 0; c < 3; c++) {
+					tangentSums.add(3 * corner[i] + c, angle * tangent[c]);
+					bitangentSums.add(3 * corner[i] + c, angle * bitangent[c]);
+				}
+			}
+		}
+	});
+
+	forEachRange(vertexCount, [&](size_t first, size_t last) {
+		for (size_t v = first; v < last; v++) {
+			double normal[3] = {normals[3 * v], normals[3 * v + 1], normals[3 * v + 2]};
+			double tangent[3] = {tangentSums.get(3 * v), tangentSums.get(3 * v + 1), tangentSums.get(3 * v + 2)};
+			double bitangent[3] = {bitangentSums.get(3 * v), bitangentSums.get(3 * v + 1),
+			                       bitangentSums.get(3 * v + 2)};
+
+			// No usable UVs around this vertex: any direction in the normal's plane will do
+			if (!orthogonalize(tangent, normal)) {
+				double axis[3] = {0, 0, 0};
+				axis[std::fabs(normal[0]) < 0.9 ? 0 : 1] = 1;
+				cross(axis, normal, tangent);
+				normalize(tangent);
+			}
+
+			double expected[3];
+			cross(normal, tangent, expected);
+			for (int c = 0; c < 3; c++)
+				tangents[4 * v + c] = (float) tangent[c];
+			tangents[4 * v + 3] = dot(expected, bitangent) < 0 ? -1.0f : 1.0f;
+		}
+	});
+}
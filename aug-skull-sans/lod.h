@@ -0,0 +1,71 @@
+//
+// Levels of detail of a model, built by quadric error edge collapse
+//
+#include <vector>
+#include <opencv2/core.hpp>
+
+#ifndef IRON_HELMET_LOD_H
+#define IRON_HELMET_LOD_H
+
+/**
+ * One level of a LodChain. Levels only ever remove vertices, and the chain keeps the vertices
+ * ordered by how long they survive: a level references the first `vertexCount` of them, nothing else.
+ */
+struct LodLevel {
+    unsigned int indexOffset;  // First index of the level in LodChain::indices
+    unsigned int indexCount;
+    unsigned int vertexCount;
+    float error;               // How far, in model units, the level strays from the full mesh
+};
+
+/**
+ * Indexed model and its simplified versions, finest level first
+ */
+struct LodChain {
+    std::vector<cv::Point3d> vertices;
+    std::vector<cv::Point3d> normals;
+    std::vector<unsigned int> indices;  // Triangles of every level, one level after the other
+    std::vector<LodLevel> levels;
+};
+
+/**
+ * Triangle counts of the levels built by default, as fractions of the full mesh
+ */
+const std::vector<double> DefaultLodRatios = {1.0, 0.5, 0.25, 0.1};
+
+/**
+ * @brief Welds a triangle soup and simplifies it into a chain of levels
+ * Vertices sharing a position become one, their normals averaged. Each coarser level carries on from
+ * the previous one, collapsing the edge whose removal adds the least quadric error (Garland & Heckbert)
+ * onto one of its end points, until the triangle count drops to the level's ratio. Collapses that
+ * would flip a triangle or pinch the surface are skipped, so a level may stay above its target.
+ * @param in_vertices Triangle soup, 3 vertices per triangle, as loadOBJ() gives it
+ * @param in_normals One per vertex
+ * @param ratios Triangle count of each level relative to the full mesh, descending, the first one 1
+ * @param out The chain
+ * @return false if the soup is empty or its arrays don't match
+ */
+bool buildLodChain(const std::vector<cv::Point3d> &in_vertices, const std::vector<cv::Point3d> &in_normals,
+                   const std::vector<double> &ratios, LodChain &out);
+
+/**
+ * @brief Reads the chain saved next to `objPath` (skull.obj -> skull.lod)
+ * Fails when there is none or the OBJ was edited since it was saved
+ */
+bool loadLodChain(const char *objPath, LodChain &out);
+
+/**
+ * @brief Saves a chain next to `objPath`, with a hash of the OBJ to notice when it goes stale
+ */
+bool storeLodChain(const char *objPath, const LodChain &chain);
+
+/**
+ * @brief The coarsest level that still looks like the full mesh on screen
+ * @param chain Chain to choose from
+ * @param pixelsPerUnit Size of one model unit on screen, focal length (px) * scale / depth
+ * @param maxPixelError Largest error tolerated, in pixels
+ * @return Index into chain.levels
+ */
+size_t selectLod(const LodChain &chain, double pixelsPerUnit, double maxPixelError = 1.0);
+
+#endif //IRON_HELMET_LOD_H
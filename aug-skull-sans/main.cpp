@@ -1,7 +1,12 @@
 #include <iostream>
+#include <future>
+#include <cstring>
 #include <opencv2/imgproc.hpp>
 #include "opencv2/highgui/highgui.hpp"
 #include "render.h"
+#include "lod.h"
+#include "raster.h"
+#include "common/bundle.hpp"
 #include <dlib/opencv.h>
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/image_processing/render_face_detections.h>
@@ -14,10 +19,16 @@ static dlib::rectangle openCVRectToDlib(const cv::Rect &r);
 
 void readCameraParams(cv::Mat &, cv::Mat &, int &, int &);
 
+bool loadCascade(cv::CascadeClassifier &, const char *);
+
+void loadPosePredictor(dlib::shape_predictor &, const char *);
+
 void loadPointsToDetect(std::vector<u_int> &, std::vector<cv::Point3d> &);
 
 void loadPointsToAugment(std::vector<cv::Point3d> &);
 
+bool loadSkull(LodChain &, SoaMesh<float> &, TrianglePlanes &, std::vector<std::vector<TriangleEdge>> &, double);
+
 float findScaleFactor(const std::vector<cv::Point2d> &);
 
 /* Algorithm
@@ -40,8 +51,15 @@ float findScaleFactor(const std::vector<cv::Point2d> &);
 
 
 int main(int argc, const char *argv[]) {
+    // The cascade, the predictor, the calibration and the skull come from the bundle when there is one,
+    // see common/bundle.hpp
+    bundleOpen("assets.bundle");
 
-    cv::CascadeClassifier haar_cascade("haarcascade.xml");
+    cv::CascadeClassifier haar_cascade;
+    if (!loadCascade(haar_cascade, "haarcascade.xml")) {
+        std::cerr << "Cant read the face cascade haarcascade.xml\n";
+        return -1;
+    }
 
     // Get a handle to the Video device:
     cv::VideoCapture cap(deviceId);
@@ -66,35 +84,25 @@ int main(int argc, const char *argv[]) {
 
     dlib::image_window win;
 
-    // Model for estimating pose
+    // Model for estimating pose, and the skull with the edges of each level. The chain keeps the levels, the
+    // vertices are in skullMesh
     dlib::shape_predictor pose_model;
-    dlib::deserialize("shape_predictor_68_face_landmarks.dat") >> pose_model; // FIXME The file's freaking 64MB
-
-    // Loading the object vectors
-    std::vector<unsigned short> indices;
-    std::vector<cv::Point3d> indexed_vertices;
-    std::vector<cv::Point3d> indexed_normals;
-    std::vector<cv::Point3d> vertices;
-    std::vector<cv::Point3d> normals;
-
-    // Read our .obj file. Max norm(vertex) ~ 7.5 units
-    if (!loadOBJ("skull.obj", vertices, normals))
-        return EXIT_FAILURE;
-
-    // Index the indexes
-    indexVBO(vertices, normals, indices, indexed_vertices, indexed_normals, 0.35f);
-
-    // At this point normals and vertices are of no use now
-    vertices.clear();
-    normals.clear();
-    std::cout << indexed_vertices.size() << " number of vertices\n";
+    LodChain skull;
+    SoaMesh<float> skullMesh;
+    TrianglePlanes skullPlanes;
+    std::vector<std::vector<TriangleEdge>> levelEdges;
 
     // FIXME Remove this. add scaling
-    for (auto &indexed_vertice : indexed_vertices) {
-        indexed_vertice = indexed_vertice * 5;
-        indexed_vertice.x -= 18;
-        indexed_vertice.y -= 8;
-    }
+    const double skullScale = 5;
+
+    // Both load on worker threads while the camera already runs. Until the predictor is in, faces are
+    // only boxed; until the skull is, a line sticks out of the nose. Neither is touched before its future is ready
+    std::future<void> predictorLoading = std::async(std::launch::async, [&pose_model] {
+        loadPosePredictor(pose_model, "shape_predictor_68_face_landmarks.dat"); // FIXME The file's freaking 64MB
+    });
+    std::future<bool> skullLoading = std::async(std::launch::async, loadSkull, std::ref(skull), std::ref(skullMesh),
+                                                std::ref(skullPlanes), std::ref(levelEdges), skullScale);
+    bool predictorReady = false, skullReady = false;
 
     // Some points out of the 68 Face points
     std::vector<cv::Point2d> image_points;
@@ -108,14 +116,32 @@ int main(int argc, const char *argv[]) {
     // Project a 3D point (0, 0, 30.0) onto the image plane.
     // We use this to draw a line sticking out of the nose
 
-//    std::vector<cv::Point3d> nose_points3D;
+    std::vector<cv::Point3d> nose_points3D;
     std::vector<cv::Point2d> nose_points2D;
-//    loadPointsToAugment(nose_points3D);
+    std::vector<cv::Point2f> skull_points2D;
+    std::vector<float> skull_depths, skull_shades;
+    std::vector<unsigned char> visibleTriangles, neededVertices;
+
+    // The skull is shaded and see-through, --wireframe draws its edges instead
+    bool wireframe = argc > 1 && strcmp(argv[1], "--wireframe") == 0;
+    Rasterizer rasterizer;
+    loadPointsToAugment(nose_points3D);
 
     do {
 
         cap >> original;
 
+        // Pick up whatever finished loading since the last frame
+        if (!predictorReady && predictorLoading.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            predictorLoading.get(); // Rethrows if the file couldn't be read
+            predictorReady = true;
+        }
+        if (!skullReady && skullLoading.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            if (!skullLoading.get())
+                return EXIT_FAILURE;
+            skullReady = true;
+        }
+
         // Convert the current frame to grayscale:
         cvtColor(original, gray, CV_BGR2GRAY);
 
@@ -132,8 +158,12 @@ int main(int argc, const char *argv[]) {
         // Find the pose of each face.
         // pose_model provides 68 points on face
         shapes.clear();
-        for (const cv::Rect_<int> &face : faces)
-            shapes.push_back(pose_model(cimg, openCVRectToDlib(face)));
+        for (const cv::Rect_<int> &face : faces) {
+            if (predictorReady)
+                shapes.push_back(pose_model(cimg, openCVRectToDlib(face)));
+            else
+                cv::rectangle(original, face, cv::Scalar(0, 180, 0));
+        }
 
         if (!shapes.empty()) {
             // 2D face image points
@@ -146,13 +176,45 @@ int main(int argc, const char *argv[]) {
             // Solve for pose
             cv::solvePnP(model_points, image_points, camera_matrix, dist_coeffs, rotation_vector, translation_vector);
 
-            // NOTE Core drawing Part
-//            projectPoints(nose_points3D, rotation_vector, translation_vector, camera_matrix, dist_coeffs,nose_points2D);
-            projectPoints(indexed_vertices, rotation_vector, translation_vector, camera_matrix, dist_coeffs,nose_points2D);
-
-//            cv::line(original, nose_points2D[0], nose_points2D[1], cv::Scalar(255, 0, 0), 2);
-            for(unsigned int i = 0;i<nose_points2D.size()-1;++i)
-                cv::line(original, nose_points2D.at(i), nose_points2D.at(i+1), cv::Scalar(0, 180, 0));
+            // Still loading: the old nose line shows the pose meanwhile
+            if (!skullReady) {
+                projectPoints(nose_points3D, rotation_vector, translation_vector, camera_matrix, dist_coeffs,
+                              nose_points2D);
+                cv::line(original, nose_points2D[0], nose_points2D[1], cv::Scalar(255, 0, 0), 2);
+            } else {
+                // Level of detail from the face's distance. A model unit covers fx * skullScale / z pixels
+                double depth = translation_vector.at<double>(2);
+                double pixelsPerUnit = depth > 0 ? camera_matrix.at<double>(0, 0) * skullScale / depth : 0;
+                size_t level = selectLod(skull, pixelsPerUnit);
+
+                // NOTE Core drawing Part
+                // Back faces go first, only the vertices of the triangles left get projected. The level's
+                // vertices are the first ones of the chain, the rest needn't be looked at either
+                const LodLevel &lod = skull.levels[level];
+                cullBackFaces(skullPlanes, lod.indexOffset / 3, lod.indexCount / 3, rotation_vector,
+                              translation_vector, visibleTriangles);
+                neededVertices.assign(lod.vertexCount, 0);
+                for (size_t t = 0; t < visibleTriangles.size(); ++t)
+                    if (visibleTriangles[t])
+                        for (int corner = 0; corner < 3; ++corner)
+                            neededVertices[skullMesh.indices[lod.indexOffset + 3 * t + corner]] = 1;
+                projectMesh(skullMesh, lod.vertexCount, rotation_vector, translation_vector, camera_matrix,
+                            dist_coeffs, skull_points2D, neededVertices.data(), &skull_depths);
+
+                if (wireframe) {
+                    // An edge shows as long as one of its sides does, which keeps the silhouette
+                    for (auto &edge : levelEdges[level])
+                        if (visibleTriangles[edge.triangles[0]] || visibleTriangles[edge.triangles[1]])
+                            cv::line(original, skull_points2D[edge.a], skull_points2D[edge.b], cv::Scalar(0, 180, 0));
+                } else {
+                    shadeMesh(skullMesh, lod.vertexCount, rotation_vector, translation_vector, skull_shades,
+                              neededVertices.data());
+                    RasterMesh raster = {skull_points2D.data(), skull_depths.data(), skull_shades.data(),
+                                         &skullMesh.indices[lod.indexOffset], lod.indexCount / 3,
+                                         visibleTriangles.data()};
+                    rasterizer.draw(original, raster, cv::Scalar(215, 230, 235), 0.75f, RASTER_GOURAUD);
+                }
+            }
         }
 
         // Display it all on the screen
@@ -162,6 +224,11 @@ int main(int argc, const char *argv[]) {
 
     } while (cv::waitKey(10) != 27);// Exit this loop on escape:
 
+    // The loaders may still be reading from the mapping
+    predictorLoading.wait();
+    skullLoading.wait();
+    bundleClose();
+
     return 0;
 }
 
@@ -169,8 +236,63 @@ inline static dlib::rectangle openCVRectToDlib(const cv::Rect &r) {
     return {(long) r.tl().x, (long) r.tl().y, (long) r.br().x - 1, (long) r.br().y - 1};
 }
 
+/**
+ * @brief Reads the skull's levels of detail, simplifying skull.obj if they aren't cached yet
+ * Runs on a worker thread, touching nothing but its arguments
+ * @param skull The chain's levels, its geometry moved to `mesh`
+ * @param mesh Vertices, scaled and placed on the face, and the triangles of every level
+ * @param planes Planes of the triangles, for back-face culling
+ * @param levelEdges Edges of each level, drawn as the wireframe
+ * @param scale Size of the skull relative to skull.obj
+ */
+bool loadSkull(LodChain &skull, SoaMesh<float> &mesh, TrianglePlanes &planes,
+               std::vector<std::vector<TriangleEdge>> &levelEdges, double scale) {
+    // Simplified once, later runs read the levels back from skull.lod
+    if (!loadLodChain("skull.obj", skull)) {
+        std::vector<cv::Point3d> vertices;
+        std::vector<cv::Point3d> normals;
+
+        // Read our .obj file. Max norm(vertex) ~ 7.5 units
+        if (!loadOBJ("skull.obj", vertices, normals))
+            return false;
+
+        if (!buildLodChain(vertices, normals, DefaultLodRatios, skull))
+            return false;
+        storeLodChain("skull.obj", skull);
+    }
+
+    levelEdges.resize(skull.levels.size());
+    for (size_t level = 0; level < skull.levels.size(); ++level) {
+        triangleEdges(skull.indices, skull.levels[level].indexOffset, skull.levels[level].indexCount,
+                      levelEdges[level]);
+        std::cout << "Level " << level << " : " << skull.levels[level].vertexCount << " vertices, "
+                  << levelEdges[level].size() << " edges\n";
+    }
+
+    // FIXME Remove this. add scaling
+    for (auto &vertex : skull.vertices) {
+        vertex = vertex * scale;
+        vertex.x -= 18;
+        vertex.y -= 8;
+    }
+
+    // Half the size in floats, and laid out for the projection
+    mesh.assign(skull.vertices, skull.normals);
+    mesh.indices.swap(skull.indices);
+    std::vector<cv::Point3d>().swap(skull.vertices);
+    std::vector<cv::Point3d>().swap(skull.normals);
+    computeTrianglePlanes(mesh, planes);
+    return true;
+}
+
 void readCameraParams(cv::Mat &camera_matrix, cv::Mat &dist_coeffs, int &width, int &height) {
-    cv::FileStorage fs("calib.yaml", cv::FileStorage::READ);
+    // FileStorage parses from memory too, it needs its own copy of the text though
+    BundleView view;
+    cv::FileStorage fs;
+    if (bundleFind("calib.yaml", view))
+        fs.open(std::string((const char *) view.data, view.size), cv::FileStorage::READ | cv::FileStorage::MEMORY);
+    else
+        fs.open("calib.yaml", cv::FileStorage::READ);
     if (!fs.isOpened()) {
         std::cerr << "Cant open camera calibration file";
         exit(EXIT_FAILURE);
@@ -182,6 +304,44 @@ void readCameraParams(cv::Mat &camera_matrix, cv::Mat &dist_coeffs, int &width,
     fs["image_height"] >> height;
 }
 
+/**
+ * @brief Reads a cascade in the XML format of opencv_traincascade, from the bundle when it's in there
+ * @return Whether the cascade could be read
+ */
+bool loadCascade(cv::CascadeClassifier &cascade, const char *path) {
+    BundleView view;
+    if (!bundleFind(path, view))
+        return cascade.load(path);
+
+    cv::FileStorage fs(std::string((const char *) view.data, view.size),
+                       cv::FileStorage::READ | cv::FileStorage::MEMORY);
+    return fs.isOpened() && cascade.read(fs.getFirstTopLevelNode());
+}
+
+// Read only stream straight over a bundle entry, so dlib deserializes from the mapping without a copy
+struct BundleStreamBuf : std::streambuf {
+    explicit BundleStreamBuf(const BundleView &view) {
+        char *data = (char *) view.data;
+        setg(data, data, data + view.size);
+    }
+};
+
+/**
+ * @brief Deserializes a dlib shape predictor, from the bundle when it's in there
+ * Throws dlib::serialization_error when it can't be read, like dlib::deserialize() does
+ */
+void loadPosePredictor(dlib::shape_predictor &predictor, const char *path) {
+    BundleView view;
+    if (!bundleFind(path, view)) {
+        dlib::deserialize(path) >> predictor;
+        return;
+    }
+
+    BundleStreamBuf buffer(view);
+    std::istream in(&buffer);
+    dlib::deserialize(predictor, in);
+}
+
 void loadPointsToDetect(std::vector<u_int> &POI, std::vector<cv::Point3d> &model_points) {
     // I know numbers are wrong(wrt the image) but it works
 
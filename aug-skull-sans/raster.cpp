@@ -0,0 +1,267 @@
+//
+// Tile based rasterizer, see raster.h
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "raster.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RASTER_SSE2 1
+#endif
+
+// Side of a tile in pixels, a multiple of the 4 pixels the inner loop does at once
+static const int TileSize = 64;
+
+// How far outside its edges a pixel center still counts as inside a triangle, in barycentric units. Rounding
+// may otherwise leave a pixel on a shared edge to neither side; drawing it twice does no harm, the nearest
+// surface only gets blended once
+static const float EdgeTolerance = 1e-4f;
+
+// A triangle ready to be rasterized, set up once while binning
+struct TriangleSetup {
+    // Barycentric weight of corner i at pixel center (x, y) is a[i] * x + b[i] * y + c[i], all 3 >= 0 inside
+    float a[3], b[3], c[3];
+    float invDepth[3];           // 1 / z is linear in screen space, z itself isn't
+    float shade[3];
+    int minX, minY, maxX, maxY;  // Pixel bounds, clipped to the image
+};
+
+struct Rasterizer::State {
+    // Workers, each waiting for the next `generation` of `job`
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    std::function<void(unsigned int)> job;
+    unsigned int generation = 0;
+    unsigned int running = 0;
+    bool quit = false;
+
+    // Reused from one draw to the next
+    std::vector<TriangleSetup> setups;
+    std::vector<std::vector<std::vector<unsigned int>>> bins;  // [thread][tile], triangles in mesh order
+    std::atomic<unsigned int> nextTile{0};
+
+    void worker(unsigned int index) {
+        unsigned int seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return quit || generation != seen; });
+            if (quit)
+                return;
+            seen = generation;
+            lock.unlock();
+            job(index);
+            lock.lock();
+            if (--running == 0)
+                finished.notify_one();
+        }
+    }
+
+    // work(index) on every thread, the caller being index 0, and wait for all of them
+    void run(const std::function<void(unsigned int)> &work) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = work;
+            ++generation;
+            running = (unsigned int) threads.size();
+        }
+        wake.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return running == 0; });
+    }
+};
+
+/**
+ * @brief Edge functions and bounds of triangle `t`
+ * @return false if it can't be seen: culled, degenerate, behind the camera or off the image
+ */
+static bool setupTriangle(const RasterMesh &mesh, size_t t, RasterShading shading, int width, int height,
+                          TriangleSetup &out) {
+    if (mesh.visible != nullptr && !mesh.visible[t])
+        return false;
+
+    const unsigned int *corner = mesh.indices + 3 * t;
+    cv::Point2f p[3];
+    for (int i = 0; i < 3; ++i) {
+        if (!(mesh.depths[corner[i]] > 0))
+            return false;
+        p[i] = mesh.points[corner[i]];
+    }
+
+    float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+    if (area == 0 || !std::isfinite(area))
+        return false;
+
+    out.minX = std::max(0, (int) std::floor(std::min({p[0].x, p[1].x, p[2].x})));
+    out.minY = std::max(0, (int) std::floor(std::min({p[0].y, p[1].y, p[2].y})));
+    out.maxX = std::min(width - 1, (int) std::ceil(std::max({p[0].x, p[1].x, p[2].x})));
+    out.maxY = std::min(height - 1, (int) std::ceil(std::max({p[0].y, p[1].y, p[2].y})));
+    if (out.minX > out.maxX || out.minY > out.maxY)
+        return false;
+
+    // Weight of corner i: signed area of the triangle it makes with the opposite edge, over the whole area.
+    // Dividing by the signed area takes care of either winding
+    for (int i = 0; i < 3; ++i) {
+        const cv::Point2f &from = p[(i + 1) % 3], &to = p[(i + 2) % 3];
+        out.a[i] = -(to.y - from.y) / area;
+        out.b[i] = (to.x - from.x) / area;
+        out.c[i] = ((to.y - from.y) * from.x - (to.x - from.x) * from.y) / area;
+        out.invDepth[i] = 1 / mesh.depths[corner[i]];
+        out.shade[i] = mesh.shades[corner[i]];
+    }
+    if (shading == RASTER_FLAT)
+        std::fill(out.shade, out.shade + 3, (out.shade[0] + out.shade[1] + out.shade[2]) / 3);
+    return true;
+}
+
+/**
+ * @brief Depth tests and writes the pixels [x0, x1] of row y of a tile, x0 a multiple of 4
+ * @param s The triangle
+ * @param px Image x of the center of the tile's first pixel
+ * @param py Image y of the center of the row
+ * @param depth Nearest 1 / z so far in the row, 0 where nothing was drawn
+ * @param shade Shade of the nearest surface in the row
+ */
+static inline void rasterRow(const TriangleSetup &s, float px, float py, int x0, int x1, float *depth, float *shade) {
+    float w[3];
+    for (int i = 0; i < 3; ++i)
+        w[i] = s.a[i] * (px + x0) + s.b[i] * py + s.c[i];
+
+#ifdef RASTER_SSE2
+    const __m128 steps = _mm_set_ps(3, 2, 1, 0), outside = _mm_set1_ps(-EdgeTolerance);
+    __m128 w0 = _mm_add_ps(_mm_set1_ps(w[0]), _mm_mul_ps(steps, _mm_set1_ps(s.a[0])));
+    __m128 w1 = _mm_add_ps(_mm_set1_ps(w[1]), _mm_mul_ps(steps, _mm_set1_ps(s.a[1])));
+    __m128 w2 = _mm_add_ps(_mm_set1_ps(w[2]), _mm_mul_ps(steps, _mm_set1_ps(s.a[2])));
+    const __m128 dw0 = _mm_set1_ps(4 * s.a[0]), dw1 = _mm_set1_ps(4 * s.a[1]), dw2 = _mm_set1_ps(4 * s.a[2]);
+    const __m128 z0 = _mm_set1_ps(s.invDepth[0]), z1 = _mm_set1_ps(s.invDepth[1]), z2 = _mm_set1_ps(s.invDepth[2]);
+    const __m128 s0 = _mm_set1_ps(s.shade[0]), s1 = _mm_set1_ps(s.shade[1]), s2 = _mm_set1_ps(s.shade[2]);
+
+    for (int x = x0; x <= x1; x += 4) {
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, outside), _mm_cmpge_ps(w1, outside)),
+                                   _mm_cmpge_ps(w2, outside));
+        if (_mm_movemask_ps(inside) != 0) {
+            __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, z0), _mm_mul_ps(w1, z1)), _mm_mul_ps(w2, z2));
+            __m128 nearest = _mm_load_ps(depth + x);
+            __m128 closer = _mm_and_ps(inside, _mm_cmpgt_ps(z, nearest));
+            __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, s0), _mm_mul_ps(w1, s1)), _mm_mul_ps(w2, s2));
+            _mm_store_ps(depth + x, _mm_or_ps(_mm_and_ps(closer, z), _mm_andnot_ps(closer, nearest)));
+            _mm_store_ps(shade + x, _mm_or_ps(_mm_and_ps(closer, c), _mm_andnot_ps(closer, _mm_load_ps(shade + x))));
+        }
+        w0 = _mm_add_ps(w0, dw0);
+        w1 = _mm_add_ps(w1, dw1);
+        w2 = _mm_add_ps(w2, dw2);
+    }
+#else
+    for (int x = x0; x <= x1; ++x) {
+        if (w[0] >= -EdgeTolerance && w[1] >= -EdgeTolerance && w[2] >= -EdgeTolerance) {
+            float z = w[0] * s.invDepth[0] + w[1] * s.invDepth[1] + w[2] * s.invDepth[2];
+            if (z > depth[x]) {
+                depth[x] = z;
+                shade[x] = w[0] * s.shade[0] + w[1] * s.shade[1] + w[2] * s.shade[2];
+            }
+        }
+        for (int i = 0; i < 3; ++i)
+            w[i] += s.a[i];
+    }
+#endif
+}
+
+Rasterizer::Rasterizer(unsigned int threadCount) : state(new State) {
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    state->bins.resize(threadCount);
+    for (unsigned int i = 1; i < threadCount; ++i)
+        state->threads.emplace_back(&State::worker, state.get(), i);
+}
+
+Rasterizer::~Rasterizer() {
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->quit = true;
+    }
+    state->wake.notify_all();
+    for (std::thread &thread : state->threads)
+        thread.join();
+}
+
+void Rasterizer::draw(cv::Mat &image, const RasterMesh &mesh, const cv::Scalar &color, float alpha,
+                      RasterShading shading) {
+    if (image.empty() || image.type() != CV_8UC3 || mesh.triangleCount == 0)
+        return;
+
+    const int width = image.cols, height = image.rows;
+    const int tilesX = (width + TileSize - 1) / TileSize, tilesY = (height + TileSize - 1) / TileSize;
+    const auto threadCount = (unsigned int) state->bins.size();
+    State &s = *state;
+
+    // Binning: each thread sets up a share of the triangles and files them under the tiles they overlap
+    s.setups.resize(mesh.triangleCount);
+    for (auto &threadBins : s.bins) {
+        threadBins.resize((size_t) tilesX * tilesY);
+        for (auto &bin : threadBins)
+            bin.clear();
+    }
+    s.run([&](unsigned int index) {
+        size_t first = mesh.triangleCount * index / threadCount, last = mesh.triangleCount * (index + 1) / threadCount;
+        std::vector<std::vector<unsigned int>> &bins = s.bins[index];
+        for (size_t t = first; t < last; ++t) {
+            TriangleSetup &setup = s.setups[t];
+            if (!setupTriangle(mesh, t, shading, width, height, setup))
+                continue;
+            for (int ty = setup.minY / TileSize; ty <= setup.maxY / TileSize; ++ty)
+                for (int tx = setup.minX / TileSize; tx <= setup.maxX / TileSize; ++tx)
+                    bins[ty * tilesX + tx].push_back((unsigned int) t);
+        }
+    });
+
+    // Tiles: handed out one at a time, each rasterized into its own z-buffer then blended into the image
+    const float blend[3] = {(float) (alpha * color[0]), (float) (alpha * color[1]), (float) (alpha * color[2])};
+    s.nextTile = 0;
+    s.run([&](unsigned int) {
+        alignas(16) float depth[TileSize * TileSize];
+        alignas(16) float shade[TileSize * TileSize];
+        unsigned int tile;
+        while ((tile = s.nextTile++) < (unsigned int) (tilesX * tilesY)) {
+            const int left = (int) (tile % tilesX) * TileSize, top = (int) (tile / tilesX) * TileSize;
+            const int right = std::min(width, left + TileSize), bottom = std::min(height, top + TileSize);
+
+            bool drawn = false;
+            std::fill(depth, depth + TileSize * TileSize, 0.0f);
+            for (unsigned int thread = 0; thread < threadCount; ++thread) {
+                for (unsigned int t : s.bins[thread][tile]) {
+                    const TriangleSetup &setup = s.setups[t];
+                    int x0 = (std::max(setup.minX, left) - left) & ~3, x1 = std::min(setup.maxX, right - 1) - left;
+                    int y0 = std::max(setup.minY, top) - top, y1 = std::min(setup.maxY, bottom - 1) - top;
+                    for (int y = y0; y <= y1; ++y)
+                        rasterRow(setup, left + 0.5f, top + y + 0.5f, x0, x1, depth + y * TileSize,
+                                  shade + y * TileSize);
+                    drawn = true;
+                }
+            }
+            if (!drawn)
+                continue;
+
+            for (int y = top; y < bottom; ++y) {
+                auto *row = image.ptr<unsigned char>(y);
+                const float *rowDepth = depth + (y - top) * TileSize, *rowShade = shade + (y - top) * TileSize;
+                for (int x = left; x < right; ++x) {
+                    if (rowDepth[x - left] == 0)
+                        continue;
+                    float intensity = std::min(1.0f, std::max(0.0f, rowShade[x - left]));
+                    unsigned char *pixel = row + 3 * x;
+                    for (int c = 0; c < 3; ++c)
+                        pixel[c] = cv::saturate_cast<unsigned char>((1 - alpha) * pixel[c] + intensity * blend[c]);
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,60 @@
+//
+// Software rasterizer for drawing meshes over camera frames, no GL context needed
+//
+#include <memory>
+#include <opencv2/core.hpp>
+
+#ifndef IRON_HELMET_RASTER_H
+#define IRON_HELMET_RASTER_H
+
+/**
+ * How the color of a triangle varies across it
+ */
+enum RasterShading {
+    RASTER_FLAT,    // The mean of its corners' shades
+    RASTER_GOURAUD  // Corner shades interpolated
+};
+
+/**
+ * An indexed mesh already in screen space, as projectMesh() and shadeMesh() leave it
+ */
+struct RasterMesh {
+    const cv::Point2f *points;      // Pixel position of each vertex
+    const float *depths;            // Camera space z of each vertex, triangles with a corner at z <= 0 are dropped
+    const float *shades;            // Intensity of each vertex, 0 to 1
+    const unsigned int *indices;    // 3 per triangle
+    size_t triangleCount;
+    const unsigned char *visible;   // Optional flag per triangle, as given by cullBackFaces()
+};
+
+/**
+ * Draws meshes into a BGR cv::Mat. The image is cut in square tiles; triangles are binned into the tiles
+ * they overlap, then each tile is rasterized on its own by a pool of threads with a local z-buffer, 4
+ * pixels at a time. Only the nearest surface of each pixel is blended into the image, once, so a
+ * translucent mesh doesn't darken where it overlaps itself.
+ */
+class Rasterizer {
+public:
+    /**
+     * @param threadCount Threads drawing tiles, the calling one included. 0 for one per core
+     */
+    explicit Rasterizer(unsigned int threadCount = 0);
+    ~Rasterizer();
+
+    /**
+     * @brief Draws a mesh
+     * @param image CV_8UC3 image to draw into
+     * @param mesh Triangles to draw
+     * @param color BGR color at full intensity
+     * @param alpha Opacity, 1 hides the image under the mesh
+     * @param shading Flat or Gouraud
+     */
+    void draw(cv::Mat &image, const RasterMesh &mesh, const cv::Scalar &color, float alpha, RasterShading shading);
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+
+#endif //IRON_HELMET_RASTER_H
@@ -3,142 +3,356 @@
 //
 
 #include <map>
+#include <unordered_map>
+#include <cmath>
+#include <algorithm>
+#include <opencv2/calib3d.hpp>
 #include "render.h"
+#include "common/bundle.hpp"
+#include "common/objparser.hpp"
 
 bool loadOBJ(const char *path, std::vector<cv::Point3d> &out_vertices, std::vector<cv::Point3d> &out_normals){
+        // Preprocessed by packbundle, the triangle soup only needs widening to doubles
+        uint32_t vertexCount;
+        const float *positions, *uvs, *normals;
+        if (bundleFindMesh(path, vertexCount, positions, uvs, normals)) {
+            for (uint32_t i = 0; i < vertexCount; i++) {
+                out_vertices.emplace_back(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+                out_normals.emplace_back(normals[3 * i], normals[3 * i + 1], normals[3 * i + 2]);
+            }
+            return true;
+        }
+
         printf("Loading OBJ file %s...\n", path);
 
-        std::vector<unsigned int> vertexIndices, normalIndices;
-        std::vector<cv::Point3d> temp_vertices;
-        std::vector<cv::Point3d> temp_normals;
+        ObjMesh mesh;
+        if (!objParse(path, mesh))
+            return false;
 
+        for (size_t i = 0; i < mesh.vertexCount(); i++) {
+            const float *position = &mesh.positions[3 * i], *normal = &mesh.normals[3 * i];
+            out_vertices.emplace_back(position[0], position[1], position[2]);
+            out_normals.emplace_back(normal[0], normal[1], normal[2]);
+        }
 
-        FILE * file = fopen(path, "r");
-        if( file == nullptr ){
-            printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-            getchar();
-            return false;
+        return true;
+    }
+
+// Pose and intrinsics in floats, the way the kernels take them
+struct ProjectionParams {
+    float r[9], t[3];
+    float fx, fy, cx, cy;
+    float k1, k2, p1, p2, k3;
+};
+
+static void readPose(const cv::Mat &rvec, const cv::Mat &tvec, double r[9], double t[3]) {
+    // solvePnP() gives doubles
+    cv::Mat R;
+    cv::Rodrigues(rvec, R);
+    for (int i = 0; i < 9; ++i)
+        r[i] = R.at<double>(i / 3, i % 3);
+    for (int i = 0; i < 3; ++i)
+        t[i] = tvec.at<double>(i);
+}
+
+static double coefficient(const cv::Mat &coeffs, int i) {
+    return i >= (int) coeffs.total() ? 0 : coeffs.depth() == CV_32F ? coeffs.at<float>(i) : coeffs.at<double>(i);
+}
+
+static void readCoefficients(const cv::Mat &dist_coeffs, double k[5]) {
+    cv::Mat coeffs = dist_coeffs.reshape(1, 1);
+    for (int i = 0; i < 5; ++i)
+        k[i] = coefficient(coeffs, i);
+}
+
+// Whether any of the `n` vertices from `first` is needed, all of them when there are no flags
+static inline bool blockNeeded(const unsigned char *needed, size_t first, size_t n) {
+    if (needed == nullptr)
+        return true;
+    for (size_t i = first; i < first + n; ++i)
+        if (needed[i])
+            return true;
+    return false;
+}
+
+template<DistortionModel Model>
+static inline cv::Point2f projectPoint(const ProjectionParams &p, float x, float y, float z, float &Z) {
+    float X = p.r[0] * x + p.r[1] * y + p.r[2] * z + p.t[0];
+    float Y = p.r[3] * x + p.r[4] * y + p.r[5] * z + p.t[1];
+    Z = p.r[6] * x + p.r[7] * y + p.r[8] * z + p.t[2];
+    float iz = 1 / Z;
+    float xd = X * iz, yd = Y * iz;
+
+    if (Model != DISTORTION_NONE) {
+        float xn = xd, yn = yd;
+        float r2 = xn * xn + yn * yn;
+        float radial = Model == DISTORTION_FULL ? 1 + r2 * (p.k1 + r2 * (p.k2 + r2 * p.k3))
+                                                : 1 + r2 * (p.k1 + r2 * p.k2);
+        xd = xn * radial;
+        yd = yn * radial;
+        if (Model == DISTORTION_FULL) {
+            float xy = xn * yn;
+            xd += 2 * p.p1 * xy + p.p2 * (r2 + 2 * xn * xn);
+            yd += p.p1 * (r2 + 2 * yn * yn) + 2 * p.p2 * xy;
         }
+    }
+    return {p.fx * xd + p.cx, p.fy * yd + p.cy};
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RENDER_AVX2 1
+
+// Built for AVX2 whatever the compiler flags, only called once the CPU says it has it
+static bool hasAvx2() {
+    static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return has;
+}
+
+// projectPoint() 8 vertices at a time, over [0, count / 8 * 8)
+template<DistortionModel Model>
+__attribute__((target("avx2,fma")))
+static void projectAvx2(const ProjectionParams &p, const float *x, const float *y, const float *z, size_t count,
+                        const unsigned char *needed, cv::Point2f *out, float *depths) {
+    const __m256 r0 = _mm256_set1_ps(p.r[0]), r1 = _mm256_set1_ps(p.r[1]), r2 = _mm256_set1_ps(p.r[2]);
+    const __m256 r3 = _mm256_set1_ps(p.r[3]), r4 = _mm256_set1_ps(p.r[4]), r5 = _mm256_set1_ps(p.r[5]);
+    const __m256 r6 = _mm256_set1_ps(p.r[6]), r7 = _mm256_set1_ps(p.r[7]), r8 = _mm256_set1_ps(p.r[8]);
+    const __m256 t0 = _mm256_set1_ps(p.t[0]), t1 = _mm256_set1_ps(p.t[1]), t2 = _mm256_set1_ps(p.t[2]);
+    const __m256 fx = _mm256_set1_ps(p.fx), fy = _mm256_set1_ps(p.fy);
+    const __m256 cx = _mm256_set1_ps(p.cx), cy = _mm256_set1_ps(p.cy);
+    const __m256 k1 = _mm256_set1_ps(p.k1), k2 = _mm256_set1_ps(p.k2), k3 = _mm256_set1_ps(p.k3);
+    const __m256 p1 = _mm256_set1_ps(p.p1), p2 = _mm256_set1_ps(p.p2);
+    const __m256 one = _mm256_set1_ps(1), two = _mm256_set1_ps(2);
 
-        while( true ){
-
-            char lineHeader[128];
-
-            // read the first word of the line
-            int res = fscanf(file, "%s", lineHeader);
-            if (res == EOF)
-                break; // EOF = End Of File. Quit the loop.
-
-            // else : parse lineHeader
-
-            if ( strcmp( lineHeader, "v" ) == 0 ) {
-                cv::Point3d vertex;
-                fscanf(file, "%lf %lf %lf\n", &vertex.x, &vertex.y, &vertex.z);
-                temp_vertices.push_back(vertex);
-            }else if ( strcmp( lineHeader, "vn" ) == 0 ){
-                cv::Point3d normal;
-                fscanf(file, "%lf %lf %lf\n", &normal.x, &normal.y, &normal.z );
-                temp_normals.push_back(normal);
-            }else if ( strcmp( lineHeader, "f" ) == 0 ){
-                std::string vertex1, vertex2, vertex3;
-                unsigned int vertexIndex[3], normalIndex[3];
-                int matches = fscanf(file, "%d//%d %d//%d %d//%d\n", &vertexIndex[0], &normalIndex[0], &vertexIndex[1], &normalIndex[1], &vertexIndex[2], &normalIndex[2] );
-                if (matches != 6){
-                    printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-                    fclose(file);
-                    return false;
-                }
-                vertexIndices.push_back(temp_vertices.size() + vertexIndex[0]);
-                vertexIndices.push_back(temp_vertices.size() + vertexIndex[1]);
-                vertexIndices.push_back(temp_vertices.size() + vertexIndex[2]);
-                normalIndices.push_back(temp_normals.size() + normalIndex[0]);
-                normalIndices.push_back(temp_normals.size() + normalIndex[1]);
-                normalIndices.push_back(temp_normals.size() + normalIndex[2]);
-            }else{
-                // Probably a comment, eat up the rest of the line
-                char stupidBuffer[1000];
-                fgets(stupidBuffer, 1000, file);
+    for (size_t i = 0; i + 8 <= count; i += 8) {
+        if (!blockNeeded(needed, i, 8))
+            continue;
+
+        // SoaMesh streams are aligned and padded, whole registers load straight from them
+        __m256 vx = _mm256_load_ps(x + i), vy = _mm256_load_ps(y + i), vz = _mm256_load_ps(z + i);
+        __m256 X = _mm256_fmadd_ps(r0, vx, _mm256_fmadd_ps(r1, vy, _mm256_fmadd_ps(r2, vz, t0)));
+        __m256 Y = _mm256_fmadd_ps(r3, vx, _mm256_fmadd_ps(r4, vy, _mm256_fmadd_ps(r5, vz, t1)));
+        __m256 Z = _mm256_fmadd_ps(r6, vx, _mm256_fmadd_ps(r7, vy, _mm256_fmadd_ps(r8, vz, t2)));
+        __m256 iz = _mm256_div_ps(one, Z);
+        __m256 xd = _mm256_mul_ps(X, iz), yd = _mm256_mul_ps(Y, iz);
+
+        if (Model != DISTORTION_NONE) {
+            __m256 xn = xd, yn = yd;
+            __m256 rr = _mm256_fmadd_ps(xn, xn, _mm256_mul_ps(yn, yn));
+            __m256 radial = Model == DISTORTION_FULL ? _mm256_fmadd_ps(k3, rr, k2) : k2;
+            radial = _mm256_fmadd_ps(rr, _mm256_fmadd_ps(rr, radial, k1), one);
+            xd = _mm256_mul_ps(xn, radial);
+            yd = _mm256_mul_ps(yn, radial);
+            if (Model == DISTORTION_FULL) {
+                __m256 xy2 = _mm256_mul_ps(two, _mm256_mul_ps(xn, yn));
+                __m256 xx2 = _mm256_fmadd_ps(two, _mm256_mul_ps(xn, xn), rr);
+                __m256 yy2 = _mm256_fmadd_ps(two, _mm256_mul_ps(yn, yn), rr);
+                xd = _mm256_add_ps(xd, _mm256_fmadd_ps(p1, xy2, _mm256_mul_ps(p2, xx2)));
+                yd = _mm256_add_ps(yd, _mm256_fmadd_ps(p1, yy2, _mm256_mul_ps(p2, xy2)));
             }
+        }
+        __m256 u = _mm256_fmadd_ps(fx, xd, cx), v = _mm256_fmadd_ps(fy, yd, cy);
+
+        // u0 v0 u1 v1 u4 v4 u5 v5 and u2 v2 u3 v3 u6 v6 u7 v7, put back in order as 8 cv::Point2f
+        __m256 low = _mm256_unpacklo_ps(u, v), high = _mm256_unpackhi_ps(u, v);
+        _mm256_storeu_ps(&out[i].x, _mm256_permute2f128_ps(low, high, 0x20));
+        _mm256_storeu_ps(&out[i + 4].x, _mm256_permute2f128_ps(low, high, 0x31));
+        if (depths != nullptr)
+            _mm256_storeu_ps(depths + i, Z);
+    }
+}
+
+// Sign test of cullBackFaces() 8 triangles at a time, over [0, count / 8 * 8)
+__attribute__((target("avx2,fma")))
+static void cullAvx2(const float *nx, const float *ny, const float *nz, const float *d, size_t count,
+                     const float camera[3], unsigned char *out) {
+    const __m256 cx = _mm256_set1_ps(camera[0]), cy = _mm256_set1_ps(camera[1]), cz = _mm256_set1_ps(camera[2]);
+    for (size_t i = 0; i + 8 <= count; i += 8) {
+        __m256 side = _mm256_fmadd_ps(_mm256_loadu_ps(nx + i), cx,
+                                      _mm256_fmadd_ps(_mm256_loadu_ps(ny + i), cy,
+                                                      _mm256_fmsub_ps(_mm256_loadu_ps(nz + i), cz,
+                                                                      _mm256_loadu_ps(d + i))));
+        int front = _mm256_movemask_ps(_mm256_cmp_ps(side, _mm256_setzero_ps(), _CMP_GT_OQ));
+        for (int j = 0; j < 8; ++j)
+            out[i + j] = (unsigned char) ((front >> j) & 1);
+    }
+}
+#endif
 
+template<DistortionModel Model>
+static void projectKernel(const ProjectionParams &p, const SoaMesh<float> &mesh, size_t count,
+                          const unsigned char *needed, cv::Point2f *out, float *depths) {
+    const float *x = mesh.x().data, *y = mesh.y().data, *z = mesh.z().data;
+    size_t first = 0;
+#ifdef RENDER_AVX2
+    if (hasAvx2()) {
+        projectAvx2<Model>(p, x, y, z, count, needed, out, depths);
+        first = count / 8 * 8;
+    }
+#endif
+    for (size_t i = first; i < count; i += SoaMesh<float>::Lanes) {
+        size_t last = std::min(count, i + SoaMesh<float>::Lanes);
+        if (!blockNeeded(needed, i, last - i))
+            continue;
+        for (size_t j = i; j < last; ++j) {
+            float depth;
+            out[j] = projectPoint<Model>(p, x[j], y[j], z[j], depth);
+            if (depths != nullptr)
+                depths[j] = depth;
         }
+    }
+}
+
+DistortionModel distortionModel(const cv::Mat &dist_coeffs) {
+    // Rational, thin prism and tilt terms come after k3
+    cv::Mat coeffs = dist_coeffs.reshape(1, 1);
+    for (int i = 5; i < (int) coeffs.total(); ++i)
+        if (coefficient(coeffs, i) != 0)
+            return DISTORTION_OPENCV;
+
+    double k[5];
+    readCoefficients(dist_coeffs, k);
+    if (k[2] != 0 || k[3] != 0 || k[4] != 0)
+        return DISTORTION_FULL;
+    return k[0] != 0 || k[1] != 0 ? DISTORTION_RADIAL : DISTORTION_NONE;
+}
 
-        // For each vertex of each triangle
-        for( unsigned int i=0; i<vertexIndices.size(); i++ ){
+void computeTrianglePlanes(const SoaMesh<float> &mesh, TrianglePlanes &out) {
+    size_t triangleCount = mesh.indices.size() / 3;
+    out.nx.resize(triangleCount);
+    out.ny.resize(triangleCount);
+    out.nz.resize(triangleCount);
+    out.d.resize(triangleCount);
 
-            // Get the indices of its attributes
-            unsigned int vertexIndex = vertexIndices[i];
-            unsigned int normalIndex = normalIndices[i];
+    for (size_t t = 0; t < triangleCount; ++t) {
+        const unsigned int *corner = &mesh.indices[3 * t];
+        cv::Point3d p0(mesh.position(corner[0])), p1(mesh.position(corner[1])), p2(mesh.position(corner[2]));
+        cv::Point3d n = (p1 - p0).cross(p2 - p0);
+        double length = cv::norm(n);
+        n = length > 0 ? n * (1 / length) : cv::Point3d();
 
-            // Get the attributes thanks to the index
-            cv::Point3d vertex = temp_vertices[ vertexIndex]; //vertexIndex-1 ];
-            cv::Point3d normal = temp_normals[ normalIndex]; //normalIndex-1 ];
+        cv::Point3d vertexNormals = cv::Point3d(mesh.normal(corner[0])) + cv::Point3d(mesh.normal(corner[1])) +
+                                    cv::Point3d(mesh.normal(corner[2]));
+        if (n.dot(vertexNormals) < 0)
+            n = n * -1.0;
 
-            // Put the attributes in buffers
-            out_vertices.push_back(vertex);
-            out_normals .push_back(normal);
+        out.nx[t] = (float) n.x;
+        out.ny[t] = (float) n.y;
+        out.nz[t] = (float) n.z;
+        out.d[t] = (float) n.dot(p0);
+    }
+}
 
+void triangleEdges(const std::vector<unsigned int> &indices, size_t firstIndex, size_t indexCount,
+                   std::vector<TriangleEdge> &out_edges) {
+    out_edges.clear();
+    std::unordered_map<unsigned long long, size_t> found;
+    for (size_t t = 0; t < indexCount / 3; ++t) {
+        const unsigned int *corner = &indices[firstIndex + 3 * t];
+        for (int i = 0; i < 3; ++i) {
+            unsigned int a = std::min(corner[i], corner[(i + 1) % 3]), b = std::max(corner[i], corner[(i + 1) % 3]);
+            auto inserted = found.insert({(unsigned long long) a << 32 | b, out_edges.size()});
+            if (inserted.second)
+                out_edges.push_back({a, b, {(unsigned int) t, (unsigned int) t}});
+            else
+                out_edges[inserted.first->second].triangles[1] = (unsigned int) t;
         }
+    }
+}
 
-        fclose(file);
+void cullBackFaces(const TrianglePlanes &planes, size_t firstTriangle, size_t triangleCount, const cv::Mat &rvec,
+                   const cv::Mat &tvec, std::vector<unsigned char> &out_visible) {
+    // The camera in model space, -R^T t
+    double r[9], t[3];
+    readPose(rvec, tvec, r, t);
+    float camera[3];
+    for (int i = 0; i < 3; ++i)
+        camera[i] = (float) -(r[i] * t[0] + r[3 + i] * t[1] + r[6 + i] * t[2]);
 
-        return true;
+    const float *nx = &planes.nx[firstTriangle], *ny = &planes.ny[firstTriangle];
+    const float *nz = &planes.nz[firstTriangle], *d = &planes.d[firstTriangle];
+    out_visible.resize(triangleCount);
+    size_t first = 0;
+#ifdef RENDER_AVX2
+    if (hasAvx2()) {
+        cullAvx2(nx, ny, nz, d, triangleCount, camera, out_visible.data());
+        first = triangleCount / 8 * 8;
     }
+#endif
+    for (size_t i = first; i < triangleCount; ++i)
+        out_visible[i] = nx[i] * camera[0] + ny[i] * camera[1] + (nz[i] * camera[2] - d[i]) > 0;
+}
 
-// Searches through all already-exported vertices for a similar one.
-// Similar = same position + same normal
-bool getSimilarVertexIndex(
-        cv::Point3d& in_vertex,
-        cv::Point3d& in_normal,
-        std::vector<cv::Point3d> & out_vertices,
-        std::vector<cv::Point3d> & out_normals,
-        unsigned short & result,
-        const float min_distance
-){
-    // Lame linear search
-    for ( unsigned short i=0; i<out_vertices.size(); i++ ){
-        if (
-                fabs( in_vertex.x - out_vertices[i].x )<min_distance &&
-                fabs( in_vertex.y - out_vertices[i].y )<min_distance &&
-                fabs( in_vertex.z - out_vertices[i].z )<min_distance &&
-                fabs( in_normal.x - out_normals [i].x )<min_distance &&
-                fabs( in_normal.y - out_normals [i].y )<min_distance &&
-                fabs( in_normal.z - out_normals [i].z )<min_distance
-                ){
-            result = i;
-            return true;
+void projectMesh(const SoaMesh<float> &mesh, size_t count, const cv::Mat &rvec, const cv::Mat &tvec,
+                 const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs, std::vector<cv::Point2f> &out_points,
+                 const unsigned char *needed, std::vector<float> *out_depths) {
+    double r[9], t[3], k[5];
+    readPose(rvec, tvec, r, t);
+    readCoefficients(dist_coeffs, k);
+
+    ProjectionParams p;
+    for (int i = 0; i < 9; ++i)
+        p.r[i] = (float) r[i];
+    for (int i = 0; i < 3; ++i)
+        p.t[i] = (float) t[i];
+    p.fx = (float) camera_matrix.at<double>(0, 0);
+    p.fy = (float) camera_matrix.at<double>(1, 1);
+    p.cx = (float) camera_matrix.at<double>(0, 2);
+    p.cy = (float) camera_matrix.at<double>(1, 2);
+    p.k1 = (float) k[0];
+    p.k2 = (float) k[1];
+    p.p1 = (float) k[2];
+    p.p2 = (float) k[3];
+    p.k3 = (float) k[4];
+
+    out_points.resize(count);
+    float *depths = nullptr;
+    if (out_depths != nullptr) {
+        out_depths->resize(count);
+        depths = out_depths->data();
+    }
+    switch (distortionModel(dist_coeffs)) {
+        case DISTORTION_NONE:
+            projectKernel<DISTORTION_NONE>(p, mesh, count, needed, out_points.data(), depths);
+            break;
+        case DISTORTION_RADIAL:
+            projectKernel<DISTORTION_RADIAL>(p, mesh, count, needed, out_points.data(), depths);
+            break;
+        case DISTORTION_FULL:
+            projectKernel<DISTORTION_FULL>(p, mesh, count, needed, out_points.data(), depths);
+            break;
+        case DISTORTION_OPENCV: {
+            // No kernel for the longer models, the whole range goes through OpenCV
+            std::vector<cv::Point3f> points(count);
+            for (size_t i = 0; i < count; ++i)
+                points[i] = mesh.position(i);
+            if (count > 0)
+                cv::projectPoints(points, rvec, tvec, camera_matrix, dist_coeffs, out_points);
+            for (size_t i = 0; depths != nullptr && i < count; ++i)
+                depths[i] = p.r[6] * points[i].x + p.r[7] * points[i].y + p.r[8] * points[i].z + p.t[2];
+            break;
         }
     }
-    // No other vertex could be used instead.
-    // Looks like we'll have to add it to the VBO.
-    return false;
 }
 
-/**
- * @brief Reduces the normal, vertices size by removing very closely placed ones
- * @param in_vertices
- * @param in_normals
- * @param out_indices
- * @param out_vertices
- * @param out_normals
- * @param min_distance Min Distance to be maintained b/t points
- */
-void indexVBO(std::vector<cv::Point3d> &in_vertices, std::vector<cv::Point3d> &in_normals,
-              std::vector<unsigned short> &out_indices, std::vector<cv::Point3d> &out_vertices,
-              std::vector<cv::Point3d> &out_normals,const float min_distance) {
-
-    // For each input vertex
-    for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-        // Try to find a similar vertex in out_XXXX
-        unsigned short index;
-        bool found = getSimilarVertexIndex(in_vertices[i], in_normals[i], out_vertices, out_normals, index, min_distance);
-
-        if ( found ) // A similar vertex is already in the VBO, use it instead !
-            out_indices.push_back( index );
-        else{ // If not, it needs to be added in the output data.
-            out_vertices.push_back( in_vertices[i]);
-            out_normals .push_back( in_normals[i]);
-            out_indices .push_back(out_vertices.size() - 1);
-        }
+void shadeMesh(const SoaMesh<float> &mesh, size_t count, const cv::Mat &rvec, const cv::Mat &tvec,
+               std::vector<float> &out_shades, const unsigned char *needed) {
+    // The camera in model space, -R^T t
+    double r[9], t[3];
+    readPose(rvec, tvec, r, t);
+    float camera[3];
+    for (int i = 0; i < 3; ++i)
+        camera[i] = (float) -(r[i] * t[0] + r[3 + i] * t[1] + r[6 + i] * t[2]);
+
+    AlignedSpan<const float> x = mesh.x(), y = mesh.y(), z = mesh.z();
+    AlignedSpan<const float> nx = mesh.nx(), ny = mesh.ny(), nz = mesh.nz();
+    out_shades.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (needed != nullptr && !needed[i])
+            continue;
+        float lx = camera[0] - x[i], ly = camera[1] - y[i], lz = camera[2] - z[i];
+        float length = std::sqrt(lx * lx + ly * ly + lz * lz);
+        float lambert = nx[i] * lx + ny[i] * ly + nz[i] * lz;
+        out_shades[i] = length > 0 ? std::max(0.0f, lambert / length) : 0;
     }
 }
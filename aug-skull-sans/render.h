@@ -2,6 +2,7 @@
 // Created by akshay on 29/1/18.
 //
 #include<opencv2/core.hpp>
+#include "mesh.h"
 
 #ifndef IRON_HELMET_RENDER_H
 #define IRON_HELMET_RENDER_H
@@ -12,15 +13,97 @@ bool loadOBJ(
         std::vector<cv::Point3d> & out_normals
 );
 
-void indexVBO(
-        std::vector<cv::Point3d> & in_vertices,
-        std::vector<cv::Point3d> & in_normals,
+/**
+ * Lens distortion models projectMesh() tells apart, each one a superset of the previous. All but the last have
+ * a kernel
+ */
+enum DistortionModel {
+    DISTORTION_NONE,   // Pinhole
+    DISTORTION_RADIAL, // k1, k2
+    DISTORTION_FULL,   // k1, k2, p1, p2, k3
+    DISTORTION_OPENCV  // Rational, thin prism or tilt terms too, projected by cv::projectPoints()
+};
 
-        std::vector<unsigned short> & out_indices,
-        std::vector<cv::Point3d> & out_vertices,
-        std::vector<cv::Point3d> & out_normals,
-        float min_distance
-);
+/**
+ * @brief The cheapest model reproducing a set of coefficients exactly, zeros are dropped
+ * @param dist_coeffs k1, k2, p1, p2[, k3[, k4, k5, k6[, s1, s2, s3, s4[, tauX, tauY]]]], empty for none
+ */
+DistortionModel distortionModel(const cv::Mat &dist_coeffs);
+
+/**
+ * Plane of every triangle of a mesh, n . p = d with n facing out, for back-face culling.
+ * One array per component, like SoaMesh
+ */
+struct TrianglePlanes {
+    std::vector<float> nx, ny, nz, d;
+};
+
+/**
+ * @brief Planes of all the triangles of `mesh.indices`
+ * The winding of the triangles isn't trusted, each normal is turned to agree with its corners' vertex normals
+ */
+void computeTrianglePlanes(const SoaMesh<float> &mesh, TrianglePlanes &out);
+
+/**
+ * An edge between two triangles, to be drawn when either of them faces the camera
+ */
+struct TriangleEdge {
+    unsigned int a, b;            // Vertex indices, lower one first
+    unsigned int triangles[2];    // Both sides, counted from the first triangle of the range. Twice the same on borders
+};
+
+/**
+ * @brief Every edge of a range of triangles once, with the triangles on each side
+ * @param indices Triangles, 3 vertex indices each
+ * @param firstIndex Start of the range in `indices`
+ * @param indexCount Length of the range
+ * @param out_edges The edges
+ */
+void triangleEdges(const std::vector<unsigned int> &indices, size_t firstIndex, size_t indexCount,
+                   std::vector<TriangleEdge> &out_edges);
+
+/**
+ * @brief Which triangles of a range face the camera, the camera being on the front side of their plane
+ * @param planes As given by computeTrianglePlanes()
+ * @param firstTriangle Start of the range
+ * @param triangleCount Length of the range
+ * @param rvec Rodrigues rotation of the model
+ * @param tvec Translation of the model
+ * @param out_visible 1 per front facing triangle, 0 per back facing one
+ */
+void cullBackFaces(const TrianglePlanes &planes, size_t firstTriangle, size_t triangleCount, const cv::Mat &rvec,
+                   const cv::Mat &tvec, std::vector<unsigned char> &out_visible);
+
+/**
+ * @brief cv::projectPoints() straight off the float streams of a mesh, same pinhole and distortion model
+ * Runs the kernel of distortionModel(dist_coeffs), 8 vertices at a time on CPUs with AVX2. Coefficients past k3
+ * have no kernel, the points then come from cv::projectPoints() itself.
+ * @param mesh Model space positions
+ * @param count How many vertices to project, from the first one
+ * @param rvec Rodrigues rotation of the model
+ * @param tvec Translation of the model
+ * @param camera_matrix 3x3 intrinsics
+ * @param dist_coeffs As OpenCV takes them, empty for none
+ * @param out_points One image point per vertex
+ * @param needed Optional flag per vertex. Runs of SoaMesh::Lanes vertices none of which is needed are skipped,
+ * their points left as they were
+ * @param out_depths Optional camera space z of each vertex, for depth testing
+ */
+void projectMesh(const SoaMesh<float> &mesh, size_t count, const cv::Mat &rvec, const cv::Mat &tvec,
+                 const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs, std::vector<cv::Point2f> &out_points,
+                 const unsigned char *needed = nullptr, std::vector<float> *out_depths = nullptr);
+
+/**
+ * @brief Diffuse shade of each vertex, lit by a light at the camera
+ * @param mesh Model space positions and normals
+ * @param count How many vertices to shade, from the first one
+ * @param rvec Rodrigues rotation of the model
+ * @param tvec Translation of the model
+ * @param out_shades max(0, n . l) per vertex, l pointing from the vertex to the camera
+ * @param needed Optional flag per vertex, the others are left as they were
+ */
+void shadeMesh(const SoaMesh<float> &mesh, size_t count, const cv::Mat &rvec, const cv::Mat &tvec,
+               std::vector<float> &out_shades, const unsigned char *needed = nullptr);
 
 
 #endif //IRON_HELMET_RENDER_H
@@ -0,0 +1,376 @@
+//
+// Binned SAH hierarchy and ray queries, see bvh.h
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include "bvh.h"
+
+namespace {
+
+const uint32_t BvhFileMagic = 0x43485642; // "BVHC"
+const uint32_t BvhFileVersion = 1;
+
+// Leaves stop splitting at this many triangles
+const uint32_t MaxLeafTriangles = 4;
+
+// Candidate split planes per axis and node
+const int SplitBins = 12;
+
+// Below this depth splits fall back to the median, which keeps the query stack bounded
+const int MaxDepth = 48;
+const int MaxStack = 2 * MaxDepth + 2;
+
+struct BvhFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t geometryHash;
+    uint32_t nodeCount;
+    uint32_t triangleCount;
+};
+
+struct Box {
+    float min[3], max[3];
+
+    Box() {
+        for (int c = 0; c < 3; c++) {
+            min[c] = std::numeric_limits<float>::max();
+            max[c] = -std::numeric_limits<float>::max();
+        }
+    }
+
+    void grow(const float *p) {
+        for (int c = 0; c < 3; c++) {
+            min[c] = std::min(min[c], p[c]);
+            max[c] = std::max(max[c], p[c]);
+        }
+    }
+
+    void grow(const Box &box) {
+        grow(box.min);
+        grow(box.max);
+    }
+
+    float area() const {
+        float d[3];
+        for (int c = 0; c < 3; c++)
+            d[c] = std::max(0.0f, max[c] - min[c]);
+        return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+    }
+};
+
+struct Builder {
+    std::vector<Box> boxes;
+    std::vector<float> centroids;  // 3 a triangle
+    std::vector<uint32_t> &order;
+    std::vector<BvhNode> &nodes;
+
+    Builder(std::vector<uint32_t> &order, std::vector<BvhNode> &nodes) : order(order), nodes(nodes) {}
+
+    // Bin of a centroid along `axis` of the centroids' bounds
+    static int bin(float value, float low, float scale) {
+        return std::min(SplitBins - 1, std::max(0, (int) ((value - low) * scale)));
+    }
+
+    // Node over order[first, first + count), its subtree appended after it. Returns its index
+    uint32_t build(uint32_t first, uint32_t count, int depth) {
+        auto index = (uint32_t) nodes.size();
+        nodes.emplace_back();
+
+        Box bounds, centroidBounds;
+        for (uint32_t i = first; i < first + count; i++) {
+            bounds.grow(boxes[order[i]]);
+            centroidBounds.grow(&centroids[3 * order[i]]);
+        }
+        std::copy(bounds.min, bounds.min + 3, nodes[index].min);
+        std::copy(bounds.max, bounds.max + 3, nodes[index].max);
+
+        if (count <= MaxLeafTriangles) {
+            nodes[index].offset = first;
+            nodes[index].count = count;
+            return index;
+        }
+
+        // Cheapest plane among the bin borders of all 3 axes: area of each side times its triangles
+        int bestAxis = -1, bestBin = 0;
+        float bestCost = std::numeric_limits<float>::max();
+        for (int axis = 0; axis < 3 && depth < MaxDepth; axis++) {
+            float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            if (!(extent > 0))
+                continue;
+            float scale = SplitBins / extent;
+
+            Box binBoxes[SplitBins];
+            uint32_t binCounts[SplitBins] = {};
+            for (uint32_t i = first; i < first + count; i++) {
+                int b = bin(centroids[3 * order[i] + axis], centroidBounds.min[axis], scale);
+                binBoxes[b].grow(boxes[order[i]]);
+                binCounts[b]++;
+            }
+
+            // Sweep from the right, then from the left
+            float rightAreas[SplitBins];
+            uint32_t rightCounts[SplitBins];
+            Box right;
+            uint32_t rightCount = 0;
+            for (int b = SplitBins - 1; b > 0; b--) {
+                right.grow(binBoxes[b]);
+                rightCount += binCounts[b];
+                rightAreas[b] = right.area();
+                rightCounts[b] = rightCount;
+            }
+            Box left;
+            uint32_t leftCount = 0;
+            for (int b = 0; b < SplitBins - 1; b++) {
+                left.grow(binBoxes[b]);
+                leftCount += binCounts[b];
+                if (leftCount == 0 || rightCounts[b + 1] == 0)
+                    continue;
+                float cost = left.area() * leftCount + rightAreas[b + 1] * rightCounts[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        uint32_t middle;
+        if (bestAxis >= 0) {
+            float low = centroidBounds.min[bestAxis];
+            float scale = SplitBins / (centroidBounds.max[bestAxis] - low);
+            middle = (uint32_t) (std::partition(order.begin() + first, order.begin() + first + count,
+                                                [&](uint32_t t) {
+                                                    return bin(centroids[3 * t + bestAxis], low, scale) <= bestBin;
+                                                }) - order.begin());
+        } else {
+            // Centroids all in one spot, or too deep: halves along the longest axis
+            int axis = 0;
+            for (int c = 1; c < 3; c++)
+                if (bounds.max[c] - bounds.min[c] > bounds.max[axis] - bounds.min[axis])
+                    axis = c;
+            middle = first + count / 2;
+            std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+                             [&](uint32_t a, uint32_t b) { return centroids[3 * a + axis] < centroids[3 * b + axis]; });
+        }
+
+        build(first, middle - first, depth + 1);
+        uint32_t second = build(middle, first + count - middle, depth + 1);
+        nodes[index].offset = second;
+        nodes[index].count = 0;
+        return index;
+    }
+};
+
+// skull.obj -> skull.bvh
+std::string bvhPath(const char *objPath) {
+    std::string path = objPath;
+    size_t dot = path.find_last_of('.');
+    if (dot != std::string::npos && path.find('/', dot) == std::string::npos)
+        path.erase(dot);
+    return path + ".bvh";
+}
+
+// FNV-1a over the corners of the triangles, so any change to the mesh shows
+uint64_t geometryHash(const SoaMesh<float> &mesh, size_t firstIndex, size_t indexCount) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = firstIndex; i < firstIndex + indexCount; i++) {
+        cv::Point3f p = mesh.position(mesh.indices[i]);
+        uint32_t bits[3];
+        memcpy(bits, &p.x, sizeof(bits));
+        for (uint32_t word : bits)
+            hash = (hash ^ word) * 1099511628211ULL;
+    }
+    return (hash ^ indexCount) * 1099511628211ULL;
+}
+
+// Corner and edges of every leaf slot, read from the mesh
+void fillCorners(const SoaMesh<float> &mesh, size_t firstIndex, Bvh &bvh) {
+    bvh.corners.resize(9 * bvh.triangles.size());
+    for (size_t slot = 0; slot < bvh.triangles.size(); slot++) {
+        const unsigned int *corner = &mesh.indices[firstIndex + 3 * bvh.triangles[slot]];
+        cv::Point3f v0 = mesh.position(corner[0]), e1 = mesh.position(corner[1]) - v0,
+                    e2 = mesh.position(corner[2]) - v0;
+        const float values[9] = {v0.x, v0.y, v0.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z};
+        std::copy(values, values + 9, &bvh.corners[9 * slot]);
+    }
+}
+
+// Where the ray enters the box, infinity if it misses it or only gets there past `limit`
+inline float enterBox(const BvhNode &node, const float *origin, const float *inverse, float limit) {
+    float near = 0, far = limit;
+    for (int c = 0; c < 3; c++) {
+        float t0 = (node.min[c] - origin[c]) * inverse[c], t1 = (node.max[c] - origin[c]) * inverse[c];
+        near = std::max(near, std::min(t0, t1));
+        far = std::min(far, std::max(t0, t1));
+    }
+    return near <= far ? near : std::numeric_limits<float>::infinity();
+}
+
+}
+
+void buildBvh(const SoaMesh<float> &mesh, size_t firstIndex, size_t indexCount, Bvh &out) {
+    auto triangleCount = (uint32_t) (indexCount / 3);
+    out.nodes.clear();
+    out.triangles.resize(triangleCount);
+    out.geometryHash = geometryHash(mesh, firstIndex, indexCount);
+
+    Builder builder(out.triangles, out.nodes);
+    builder.boxes.resize(triangleCount);
+    builder.centroids.resize(3 * triangleCount);
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        out.triangles[t] = t;
+        for (int i = 0; i < 3; i++) {
+            cv::Point3f p = mesh.position(mesh.indices[firstIndex + 3 * t + i]);
+            builder.boxes[t].grow(&p.x);
+        }
+        for (int c = 0; c < 3; c++)
+            builder.centroids[3 * t + c] = (builder.boxes[t].min[c] + builder.boxes[t].max[c]) / 2;
+    }
+    if (triangleCount > 0)
+        builder.build(0, triangleCount, 0);
+
+    fillCorners(mesh, firstIndex, out);
+}
+
+bool loadBvh(const char *objPath, const SoaMesh<float> &mesh, size_t firstIndex, size_t indexCount, Bvh &out) {
+    std::string path = bvhPath(objPath);
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    BvhFileHeader header{};
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == BvhFileMagic &&
+                 header.version == BvhFileVersion && header.nodeCount > 0;
+    if (valid && (header.geometryHash != geometryHash(mesh, firstIndex, indexCount) ||
+                  header.triangleCount != indexCount / 3)) {
+        printf("%s was built for another mesh, rebuilding it\n", path.c_str());
+        fclose(file);
+        return false;
+    }
+
+    if (valid) {
+        out.geometryHash = header.geometryHash;
+        out.nodes.resize(header.nodeCount);
+        out.triangles.resize(header.triangleCount);
+        valid = fread(out.nodes.data(), sizeof(BvhNode), out.nodes.size(), file) == out.nodes.size() &&
+                fread(out.triangles.data(), sizeof(uint32_t), out.triangles.size(), file) == out.triangles.size();
+    }
+    fclose(file);
+
+    // Children come after their parent, so one forward pass gives every node's depth. The query stack holds at
+    // most one entry per level plus one, deeper trees than it has room for are refused
+    std::vector<int> depths(valid ? out.nodes.size() : 0, 0);
+    for (size_t i = 0; valid && i < out.nodes.size(); i++) {
+        const BvhNode &node = out.nodes[i];
+        valid = node.count == 0 ? node.offset > i + 1 && node.offset < out.nodes.size()
+                                : node.offset <= out.triangles.size() && node.count <= out.triangles.size() - node.offset;
+        if (valid && node.count == 0) {
+            valid = depths[i] + 2 <= MaxStack;
+            depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+            depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+        }
+    }
+    for (size_t i = 0; valid && i < out.triangles.size(); i++)
+        valid = out.triangles[i] < header.triangleCount;
+    if (!valid) {
+        printf("%s is damaged, rebuilding it\n", path.c_str());
+        return false;
+    }
+
+    fillCorners(mesh, firstIndex, out);
+    return true;
+}
+
+bool storeBvh(const char *objPath, const Bvh &bvh) {
+    BvhFileHeader header{};
+    header.magic = BvhFileMagic;
+    header.version = BvhFileVersion;
+    header.geometryHash = bvh.geometryHash;
+    header.nodeCount = (uint32_t) bvh.nodes.size();
+    header.triangleCount = (uint32_t) bvh.triangles.size();
+
+    std::string path = bvhPath(objPath);
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        printf("Could not write %s\n", path.c_str());
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(bvh.nodes.data(), sizeof(BvhNode), bvh.nodes.size(), file) == bvh.nodes.size() &&
+                   fwrite(bvh.triangles.data(), sizeof(uint32_t), bvh.triangles.size(), file) == bvh.triangles.size();
+    written &= fclose(file) == 0;
+    if (!written) {
+        printf("Could not write %s\n", path.c_str());
+        remove(path.c_str());
+    }
+    return written;
+}
+
+bool intersectBvh(const Bvh &bvh, const cv::Point3f &origin, const cv::Point3f &direction, BvhHit &hit) {
+    if (bvh.nodes.empty())
+        return false;
+
+    const float o[3] = {origin.x, origin.y, origin.z}, d[3] = {direction.x, direction.y, direction.z};
+    const float inverse[3] = {1 / d[0], 1 / d[1], 1 / d[2]};
+    float best = std::numeric_limits<float>::infinity();
+    bool found = false;
+
+    uint32_t stack[MaxStack];
+    int size = 0;
+    if (enterBox(bvh.nodes[0], o, inverse, best) < best)
+        stack[size++] = 0;
+    while (size > 0) {
+        const BvhNode &node = bvh.nodes[stack[--size]];
+
+        if (node.count == 0) {
+            // Nearer child on top, children the ray misses or only reaches past the best hit never go on
+            uint32_t first = (uint32_t) (&node - bvh.nodes.data()) + 1, second = node.offset;
+            float tFirst = enterBox(bvh.nodes[first], o, inverse, best);
+            float tSecond = enterBox(bvh.nodes[second], o, inverse, best);
+            if (tFirst > tSecond) {
+                std::swap(first, second);
+                std::swap(tFirst, tSecond);
+            }
+            if (tSecond < best)
+                stack[size++] = second;
+            if (tFirst < best)
+                stack[size++] = first;
+            continue;
+        }
+
+        // Moller-Trumbore, either winding
+        for (uint32_t slot = node.offset; slot < node.offset + node.count; slot++) {
+            const float *v0 = &bvh.corners[9 * slot], *e1 = v0 + 3, *e2 = v0 + 6;
+            float p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+            float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+            if (det == 0)
+                continue;
+            float inverseDet = 1 / det;
+            float s[3] = {o[0] - v0[0], o[1] - v0[1], o[2] - v0[2]};
+            float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDet;
+            if (u < 0 || u > 1)
+                continue;
+            float q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+            float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverseDet;
+            if (v < 0 || u + v > 1)
+                continue;
+            float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverseDet;
+            if (t > 0 && t < best) {
+                best = t;
+                hit.triangle = bvh.triangles[slot];
+                found = true;
+            }
+        }
+    }
+
+    if (found) {
+        hit.distance = best;
+        hit.point = origin + direction * best;
+    }
+    return found;
+}
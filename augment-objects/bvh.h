@@ -0,0 +1,74 @@
+//
+// Bounding volume hierarchy over a mesh's triangles, for picking with rays
+//
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "mesh.h"
+
+#ifndef IRON_HELMET_BVH_H
+#define IRON_HELMET_BVH_H
+
+/**
+ * A box of the hierarchy. Inner nodes are followed by their first child, `offset` points to the second one.
+ * Leaves hold `count` triangles from Bvh::triangles[offset]
+ */
+struct BvhNode {
+    float min[3];
+    float max[3];
+    uint32_t offset;
+    uint32_t count;  // 0 for inner nodes
+};
+
+/**
+ * Hierarchy over a range of a mesh's triangles. Leaves keep their own copy of the triangles, corner and two
+ * edges each, so a query never goes back to the mesh
+ */
+struct Bvh {
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> triangles;  // Triangle of the range each leaf slot stands for
+    std::vector<float> corners;       // 9 floats a leaf slot: v0, v1 - v0, v2 - v0
+    uint64_t geometryHash;            // Of the triangles it was built from, to tell when a saved one is stale
+};
+
+/**
+ * The closest triangle a ray goes through
+ */
+struct BvhHit {
+    uint32_t triangle;  // Counted from the first triangle of the range the Bvh was built over
+    float distance;     // Along the ray, in lengths of its direction
+    cv::Point3f point;  // Model space
+};
+
+/**
+ * @brief Builds the hierarchy, splitting nodes where the surface area heuristic says it's cheapest
+ * @param mesh Positions and triangles
+ * @param firstIndex Start of the triangles in mesh.indices
+ * @param indexCount Length of the range
+ * @param out The hierarchy
+ */
+void buildBvh(const SoaMesh<float> &mesh, size_t firstIndex, size_t indexCount, Bvh &out);
+
+/**
+ * @brief Reads the hierarchy saved next to `objPath` (skull.obj -> skull.bvh)
+ * Fails when there is none or it was built over other triangles than these
+ */
+bool loadBvh(const char *objPath, const SoaMesh<float> &mesh, size_t firstIndex, size_t indexCount, Bvh &out);
+
+/**
+ * @brief Saves a hierarchy next to `objPath`
+ */
+bool storeBvh(const char *objPath, const Bvh &bvh);
+
+/**
+ * @brief Closest intersection of a ray with the triangles, both faces of them
+ * @param bvh Hierarchy to search
+ * @param origin Start of the ray, model space
+ * @param direction Direction of the ray, needn't be unit length
+ * @param hit Set when something is hit
+ * @return Whether something was
+ */
+bool intersectBvh(const Bvh &bvh, const cv::Point3f &origin, const cv::Point3f &direction, BvhHit &hit);
+
+
+#endif //IRON_HELMET_BVH_H
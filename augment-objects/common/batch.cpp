@@ -0,0 +1,316 @@
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "batch.hpp"
+
+#define BATCH_GLSL_VERSION "#version 330 core\n"
+
+namespace {
+
+	// 32 bytes, position is already in clip space
+	struct BatchVertex {
+		GLfloat position[4];
+		GLubyte color[4];
+		GLfloat uv[2];
+		GLfloat padding;
+	};
+
+	// A run of primitives drawn with one glDrawArrays
+	struct BatchCommand {
+		GLenum mode;
+		GLuint texture;
+		GLint first;
+		GLsizei count;
+	};
+
+	// The buffer is split in this many segments. A fence guards every segment
+	// the GPU may still read from, so we only wait when the ring wraps around
+	// faster than the GPU draws.
+	const int RingSegments = 3;
+
+	const char *VertexShaderCode = BATCH_GLSL_VERSION
+		"layout(location = 0) in vec4 vertexPosition_clipspace;\n"
+		"layout(location = 1) in vec4 vertexColor;\n"
+		"layout(location = 2) in vec2 vertexUV;\n"
+		"out vec4 fragmentColor;\n"
+		"out vec2 UV;\n"
+		"void main(){\n"
+		"	gl_Position = vertexPosition_clipspace;\n"
+		"	fragmentColor = vertexColor;\n"
+		"	UV = vertexUV;\n"
+		"}\n";
+
+	const char *FragmentShaderCode = BATCH_GLSL_VERSION
+		"in vec4 fragmentColor;\n"
+		"in vec2 UV;\n"
+		"layout(location = 0) out vec4 color;\n"
+		"uniform sampler2D batchTextureSampler;\n"
+		"uniform int textured;\n"
+		"void main(){\n"
+		"	color = textured != 0 ? fragmentColor * texture(batchTextureSampler, UV) : fragmentColor;\n"
+		"}\n";
+
+	GLuint programID = 0;
+	GLuint vertexArrayID = 0;
+	GLuint vertexBufferID = 0;
+	GLint texturedID = -1;
+	GLint samplerID = -1;
+
+	// Persistently mapped storage, or a CPU shadow copy when ARB_buffer_storage is missing
+	BatchVertex *ring = nullptr;
+	std::vector<BatchVertex> shadow;
+	bool persistent = false;
+
+	GLint capacity = 0;      // in vertices
+	GLint segmentSize = 0;   // in vertices
+	GLint cursor = 0;        // next vertex to write
+	GLint flushedUpTo = 0;   // vertices before this one are already drawn
+	GLsync fences[RingSegments] = {};
+
+	std::vector<BatchCommand> commands;
+
+	// Current state, glBegin/glEnd style
+	GLfloat transform[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+	GLuint currentTexture = 0;
+	BatchMode currentMode = BATCH_TRIANGLES;
+	BatchVertex current = {{0, 0, 0, 1}, {255, 255, 255, 255}, {0, 0}, 0};
+
+	// Vertices of the primitive being assembled
+	BatchVertex primitive[4];
+	int primitiveSize = 0;
+
+	bool hasExtension(const char *name) {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++)
+			if (strcmp((const char *) glGetStringi(GL_EXTENSIONS, (GLuint) i), name) == 0)
+				return true;
+		return false;
+	}
+
+	void waitForSegment(int segment) {
+		if (fences[segment] == nullptr)
+			return;
+		while (glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fences[segment]);
+		fences[segment] = nullptr;
+	}
+
+	// Room for `count` contiguous vertices, wrapping and waiting if needed
+	BatchVertex *reserve(GLint count) {
+		if (cursor + count > capacity) {
+			batchFlush();
+			cursor = flushedUpTo = 0;
+			waitForSegment(0);
+		}
+
+		int from = cursor == 0 ? -1 : (cursor - 1) / segmentSize;
+		int to = (cursor + count - 1) / segmentSize;
+		for (int segment = from + 1; segment <= to; segment++)
+			waitForSegment(segment);
+
+		BatchVertex *vertices = (persistent ? ring : shadow.data()) + cursor;
+		cursor += count;
+		return vertices;
+	}
+
+	void emit(GLenum mode, const BatchVertex *vertices, GLint count) {
+		memcpy(reserve(count), vertices, count * sizeof(BatchVertex));
+
+		// Not the cursor before reserve(), that one may have wrapped
+		GLint first = cursor - count;
+
+		if (!commands.empty()) {
+			BatchCommand &last = commands.back();
+			if (last.mode == mode && last.texture == currentTexture && last.first + last.count == first) {
+				last.count += count;
+				return;
+			}
+		}
+		commands.push_back({mode, currentTexture, first, count});
+	}
+}
+
+ShaderProgramSource batchShaderSource() {
+	return {SHADER_CODE, VertexShaderCode, FragmentShaderCode, "batch"};
+}
+
+bool batchInit(GLuint program, unsigned int maxVerticesPerFrame) {
+	if (program == 0) {
+		fprintf(stderr, "No batch program\n");
+		return false;
+	}
+	programID = program;
+	texturedID = glGetUniformLocation(programID, "textured");
+	samplerID = glGetUniformLocation(programID, "batchTextureSampler");
+
+	segmentSize = (GLint) maxVerticesPerFrame;
+	capacity = segmentSize * RingSegments;
+	auto bytes = (GLsizeiptr) (capacity * sizeof(BatchVertex));
+
+	glGenVertexArrays(1, &vertexArrayID);
+	glBindVertexArray(vertexArrayID);
+	glGenBuffers(1, &vertexBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+
+	persistent = hasExtension("GL_ARB_buffer_storage");
+	if (persistent) {
+		// Mapped once for the lifetime of the buffer, writes land straight in GPU visible memory
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+		ring = (BatchVertex *) glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags);
+		persistent = ring != nullptr;
+	}
+	if (!persistent) {
+		glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+		shadow.resize((size_t) capacity);
+	}
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (void *) offsetof(BatchVertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BatchVertex), (void *) offsetof(BatchVertex, color));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (void *) offsetof(BatchVertex, uv));
+	glBindVertexArray(0);
+
+	return true;
+}
+
+void batchShutdown() {
+	for (auto &fence : fences) {
+		if (fence)
+			glDeleteSync(fence);
+		fence = nullptr;
+	}
+	if (persistent) {
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		ring = nullptr;
+	}
+	glDeleteBuffers(1, &vertexBufferID);
+	glDeleteVertexArrays(1, &vertexArrayID);
+	glDeleteProgram(programID);
+	shadow.clear();
+	commands.clear();
+}
+
+void batchTransform(const GLfloat matrix[16]) {
+	memcpy(transform, matrix, sizeof(transform));
+}
+
+void batchTransform(const GLfloat projection[16], const GLfloat modelView[16]) {
+	for (int col = 0; col < 4; col++)
+		for (int row = 0; row < 4; row++) {
+			GLfloat sum = 0;
+			for (int k = 0; k < 4; k++)
+				sum += projection[k * 4 + row] * modelView[col * 4 + k];
+			transform[col * 4 + row] = sum;
+		}
+}
+
+void batchTexture(GLuint texture) {
+	currentTexture = texture;
+}
+
+void batchBegin(BatchMode mode) {
+	currentMode = mode;
+	primitiveSize = 0;
+}
+
+void batchColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+	current.color[0] = (GLubyte) (r * 255.0f + 0.5f);
+	current.color[1] = (GLubyte) (g * 255.0f + 0.5f);
+	current.color[2] = (GLubyte) (b * 255.0f + 0.5f);
+	current.color[3] = (GLubyte) (a * 255.0f + 0.5f);
+}
+
+void batchTexCoord(GLfloat u, GLfloat v) {
+	current.uv[0] = u;
+	current.uv[1] = v;
+}
+
+void batchVertex(GLfloat x, GLfloat y, GLfloat z) {
+	BatchVertex &vertex = primitive[primitiveSize++];
+	vertex = current;
+	for (int row = 0; row < 4; row++)
+		vertex.position[row] = transform[row] * x + transform[4 + row] * y + transform[8 + row] * z + transform[12 + row];
+
+	switch (currentMode) {
+		case BATCH_LINES:
+			if (primitiveSize == 2) {
+				emit(GL_LINES, primitive, 2);
+				primitiveSize = 0;
+			}
+			break;
+		case BATCH_TRIANGLES:
+			if (primitiveSize == 3) {
+				emit(GL_TRIANGLES, primitive, 3);
+				primitiveSize = 0;
+			}
+			break;
+		case BATCH_QUADS:
+			if (primitiveSize == 4) {
+				BatchVertex triangles[6] = {primitive[0], primitive[1], primitive[2],
+											primitive[0], primitive[2], primitive[3]};
+				emit(GL_TRIANGLES, triangles, 3);
+				emit(GL_TRIANGLES, triangles + 3, 3);
+				primitiveSize = 0;
+			}
+			break;
+	}
+}
+
+void batchEnd() {
+	// Incomplete primitives are dropped, like glEnd does
+	primitiveSize = 0;
+}
+
+void batchFlush() {
+	if (commands.empty())
+		return;
+
+	glBindVertexArray(vertexArrayID);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+
+	if (!persistent) {
+		// Fences already keep us off the ranges the GPU still reads, no need for the driver to sync
+		GLintptr offset = flushedUpTo * sizeof(BatchVertex);
+		GLsizeiptr length = (cursor - flushedUpTo) * sizeof(BatchVertex);
+		void *mapped = glMapBufferRange(GL_ARRAY_BUFFER, offset, length,
+										GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		memcpy(mapped, shadow.data() + flushedUpTo, (size_t) length);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+
+	glUseProgram(programID);
+	glUniform1i(samplerID, 0);
+
+	GLuint boundTexture = 0;
+	for (const BatchCommand &command : commands) {
+		if (command.texture != boundTexture) {
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, command.texture);
+			boundTexture = command.texture;
+		}
+		glUniform1i(texturedID, command.texture != 0);
+		glDrawArrays(command.mode, command.first, command.count);
+	}
+
+	// Guard every segment this flush read from
+	for (int segment = flushedUpTo / segmentSize; segment <= (cursor - 1) / segmentSize; segment++) {
+		if (fences[segment])
+			glDeleteSync(fences[segment]);
+		fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	commands.clear();
+	flushedUpTo = cursor;
+
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
@@ -0,0 +1,51 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "shader.hpp"
+
+// A small replacement for glBegin/glEnd that also works in a core profile.
+// Vertices are transformed on the CPU as they come in and written straight
+// into a ring of persistently mapped VBO regions, one region per frame in
+// flight. batchFlush() then draws everything queued since the last flush in
+// one call per run of equal primitive type and texture.
+//
+//	batchTransform(Projection, ModelView);
+//	batchBegin(BATCH_LINES);
+//	batchColor(1, 0, 0);
+//	batchVertex(0, 0, 0);
+//	batchVertex(1, 0, 0);
+//	batchEnd();
+//	...
+//	batchFlush();
+
+enum BatchMode {
+	BATCH_LINES,
+	BATCH_TRIANGLES,
+	BATCH_QUADS // split into two triangles, core profile has no quads
+};
+
+// The batch program, to be loaded with the others through LoadShaderPrograms()
+ShaderProgramSource batchShaderSource();
+
+// Takes the linked batch program and creates the ring buffer, needs a current GL context
+bool batchInit(GLuint program, unsigned int maxVerticesPerFrame = 65536);
+void batchShutdown();
+
+// Column major matrix applied to all the following vertices
+void batchTransform(const GLfloat matrix[16]);
+void batchTransform(const GLfloat projection[16], const GLfloat modelView[16]);
+
+// Texture modulating the color of the following primitives, 0 for none
+void batchTexture(GLuint texture);
+
+void batchBegin(BatchMode mode);
+void batchColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.0f);
+void batchTexCoord(GLfloat u, GLfloat v);
+void batchVertex(GLfloat x, GLfloat y, GLfloat z);
+void batchEnd();
+
+// Draws everything queued so far. Call it at least once per frame, and
+// before anything that must be drawn on top of the queued primitives.
+void batchFlush();
+
+#endif
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "bcencoder.hpp"
+
+namespace {
+
+	unsigned int pack565(const float color[3]) {
+		auto r = (unsigned int) std::min(31.0f, std::max(0.0f, color[0] * 31 / 255 + 0.5f));
+		auto g = (unsigned int) std::min(63.0f, std::max(0.0f, color[1] * 63 / 255 + 0.5f));
+		auto b = (unsigned int) std::min(31.0f, std::max(0.0f, color[2] * 31 / 255 + 0.5f));
+		return (r << 11) | (g << 5) | b;
+	}
+
+	// What the GPU will decode, low bits repeat the high ones
+	void unpack565(unsigned int packed, int color[3]) {
+		int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	void encodeColorBlock(const unsigned char pixels[16][4], unsigned char out[8]) {
+		float mean[3] = {0, 0, 0};
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 3; c++)
+				mean[c] += pixels[i][c] / 16.0f;
+
+		float covariance[6] = {0, 0, 0, 0, 0, 0}; // rr rg rb gg gb bb
+		for (int i = 0; i < 16; i++) {
+			float r = pixels[i][0] - mean[0], g = pixels[i][1] - mean[1], b = pixels[i][2] - mean[2];
+			covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+			covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+		}
+
+		// A few power iterations are plenty for the main axis of 16 points
+		float axis[3] = {1, 1, 1};
+		for (int iteration = 0; iteration < 4; iteration++) {
+			float next[3] = {
+				covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+				covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+				covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]};
+			float length = std::max(std::fabs(next[0]), std::max(std::fabs(next[1]), std::fabs(next[2])));
+			if (length < 1e-6f)
+				break;
+			for (int c = 0; c < 3; c++)
+				axis[c] = next[c] / length;
+		}
+
+		// The two pixels furthest apart along the axis become the endpoints
+		int lowest = 0, highest = 0;
+		float lowestDot = 1e30f, highestDot = -1e30f;
+		for (int i = 0; i < 16; i++) {
+			float dot = pixels[i][0] * axis[0] + pixels[i][1] * axis[1] + pixels[i][2] * axis[2];
+			if (dot < lowestDot) { lowestDot = dot; lowest = i; }
+			if (dot > highestDot) { highestDot = dot; highest = i; }
+		}
+
+		// Pull them in a little, the ends of the range are rarely hit exactly
+		float high[3], low[3];
+		for (int c = 0; c < 3; c++) {
+			float inset = (pixels[highest][c] - pixels[lowest][c]) / 16.0f;
+			high[c] = pixels[highest][c] - inset;
+			low[c] = pixels[lowest][c] + inset;
+		}
+
+		unsigned int color0 = pack565(high), color1 = pack565(low);
+		if (color0 < color1)
+			std::swap(color0, color1);
+
+		// color0 > color1 selects the four color mode, equal endpoints need no indices
+		unsigned int indices = 0;
+		if (color0 != color1) {
+			int palette[4][3];
+			unpack565(color0, palette[0]);
+			unpack565(color1, palette[1]);
+			for (int c = 0; c < 3; c++) {
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+
+			for (int i = 0; i < 16; i++) {
+				int best = 0, bestDistance = 1 << 30;
+				for (int p = 0; p < 4; p++) {
+					int dr = pixels[i][0] - palette[p][0], dg = pixels[i][1] - palette[p][1],
+						db = pixels[i][2] - palette[p][2];
+					int distance = dr * dr + dg * dg + db * db;
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						best = p;
+					}
+				}
+				indices |= (unsigned int) best << (2 * i);
+			}
+		}
+
+		out[0] = (unsigned char) (color0 & 0xFF);
+		out[1] = (unsigned char) (color0 >> 8);
+		out[2] = (unsigned char) (color1 & 0xFF);
+		out[3] = (unsigned char) (color1 >> 8);
+		for (int i = 0; i < 4; i++)
+			out[4 + i] = (unsigned char) (indices >> (8 * i));
+	}
+
+	void encodeAlphaBlock(const unsigned char pixels[16][4], unsigned char out[8]) {
+		int alpha0 = 0, alpha1 = 255;
+		for (int i = 0; i < 16; i++) {
+			alpha0 = std::max(alpha0, (int) pixels[i][3]);
+			alpha1 = std::min(alpha1, (int) pixels[i][3]);
+		}
+
+		// alpha0 > alpha1 selects the eight level mode
+		unsigned long long indices = 0;
+		if (alpha0 != alpha1) {
+			int palette[8] = {alpha0, alpha1};
+			for (int p = 1; p < 7; p++)
+				palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+
+			for (int i = 0; i < 16; i++) {
+				int best = 0, bestDistance = 256;
+				for (int p = 0; p < 8; p++) {
+					int distance = std::abs(pixels[i][3] - palette[p]);
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						best = p;
+					}
+				}
+				indices |= (unsigned long long) best << (3 * i);
+			}
+		}
+
+		out[0] = (unsigned char) alpha0;
+		out[1] = (unsigned char) alpha1;
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = (unsigned char) (indices >> (8 * i));
+	}
+
+	void encodeBlockRow(const unsigned char *rgba, unsigned int width, unsigned int height, bool alpha,
+	                    unsigned int blockRow, unsigned char *out) {
+		unsigned int blocksWide = (width + 3) / 4;
+		unsigned int blockSize = alpha ? 16 : 8;
+
+		unsigned char pixels[16][4];
+		for (unsigned int blockColumn = 0; blockColumn < blocksWide; blockColumn++) {
+			for (unsigned int y = 0; y < 4; y++) {
+				unsigned int row = std::min(blockRow * 4 + y, height - 1);
+				for (unsigned int x = 0; x < 4; x++) {
+					unsigned int column = std::min(blockColumn * 4 + x, width - 1);
+					memcpy(pixels[4 * y + x], rgba + 4 * (size_t(row) * width + column), 4);
+				}
+			}
+
+			unsigned char *block = out + size_t(blockColumn) * blockSize;
+			if (alpha) {
+				encodeAlphaBlock(pixels, block);
+				encodeColorBlock(pixels, block + 8);
+			} else {
+				encodeColorBlock(pixels, block);
+			}
+		}
+	}
+}
+
+size_t bcEncodedSize(unsigned int width, unsigned int height, bool alpha) {
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * (alpha ? 16 : 8);
+}
+
+void bcEncode(const unsigned char *rgba, unsigned int width, unsigned int height, bool alpha, unsigned char *out) {
+	unsigned int blockRows = (height + 3) / 4;
+	size_t rowBytes = bcEncodedSize(width, 4, alpha);
+
+	// Rows are independent, whichever thread is free takes the next one
+	std::atomic<unsigned int> nextRow(0);
+	auto worker = [&]() {
+		for (unsigned int row = nextRow++; row < blockRows; row = nextRow++)
+			encodeBlockRow(rgba, width, height, alpha, row, out + row * rowBytes);
+	};
+
+	unsigned int threadCount = std::min(std::max(std::thread::hardware_concurrency(), 1u), blockRows);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < threadCount; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (std::thread &thread : threads)
+		thread.join();
+}
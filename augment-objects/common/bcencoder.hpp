@@ -0,0 +1,22 @@
+#ifndef BCENCODER_HPP
+#define BCENCODER_HPP
+
+#include <cstddef>
+
+// CPU encoder for the S3TC block formats, BC1 (DXT1) for opaque images and
+// BC3 (DXT5) when the alpha matters. Endpoints come from the principal axis
+// of each 4x4 block's colors. Rows of blocks are shared out between threads.
+//
+//	std::vector<unsigned char> blocks(bcEncodedSize(width, height, false));
+//	bcEncode(rgba, width, height, false, blocks.data());
+//
+// Blocks come out in the same row order as the pixels went in. Edges of
+// images that aren't a multiple of 4 repeat the last row or column.
+
+// Bytes needed for one image, 8 per block for BC1 and 16 for BC3
+size_t bcEncodedSize(unsigned int width, unsigned int height, bool alpha);
+
+// rgba holds width * height RGBA8 pixels, tightly packed
+void bcEncode(const unsigned char *rgba, unsigned int width, unsigned int height, bool alpha, unsigned char *out);
+
+#endif
@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+#include <GL/glew.h>
+
+#include "governor.hpp"
+
+namespace {
+
+	// Quality levels, best first. MSAA goes before resolution does
+	struct Level {
+		float scale;
+		int samples;
+	};
+	const Level Levels[] = {{1.0f, 4}, {1.0f, 2}, {1.0f, 0}, {0.85f, 0}, {0.7f, 0}, {0.6f, 0}, {0.5f, 0}};
+	const int LevelCount = sizeof(Levels) / sizeof(Levels[0]);
+
+	// Timestamp pairs in flight, a result is read this many frames after it was queued
+	const int QuerySlots = 4;
+
+	// Step down as soon as the budget is blown, step up only after a calm period
+	const double UpThreshold = 0.7;
+	const int DownCooldown = 15, UpCooldown = 90;
+
+	const char *VertexShaderCode =
+		"#version 330 core\n"
+		"out vec2 UV;\n"
+		"uniform vec2 uvScale;\n"
+		"void main(){\n"
+		"	// One triangle covering the viewport\n"
+		"	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+		"	UV = corner * uvScale;\n"
+		"	gl_Position = vec4(corner * 2.0 - 1.0, 0, 1);\n"
+		"}\n";
+
+	const char *FragmentShaderCode =
+		"#version 330 core\n"
+		"in vec2 UV;\n"
+		"out vec4 color;\n"
+		"uniform sampler2D overlaySampler;\n"
+		"void main(){\n"
+		"	color = texture(overlaySampler, UV);\n"
+		"}\n";
+
+	int fullWidth = 0, fullHeight = 0;
+	double targetMs = 16.6;
+
+	int level = 0;
+	int cooldown = 0;
+	double filteredMs = 0;
+	bool hasSample = false;
+
+	// Everything is allocated at full resolution, lower levels use a corner of it
+	GLuint resolveFramebuffer = 0;
+	GLuint resolveTexture = 0;
+	GLuint resolveDepth = 0;
+
+	struct MultisampleTarget {
+		GLuint framebuffer;
+		GLuint color;
+		GLuint depth;
+	};
+	std::map<int, MultisampleTarget> multisampleTargets; // by sample count, created on first use
+
+	GLuint programID = 0;
+	GLuint vertexArrayID = 0;
+	GLint uvScaleID = -1;
+	GLint samplerID = -1;
+
+	GLuint queries[QuerySlots][2];
+	bool queryPending[QuerySlots] = {};
+	int frame = 0;
+
+	// State to give back in governorEndVirtual()
+	GLint previousFramebuffer = 0;
+	GLint previousViewport[4];
+
+	const MultisampleTarget &getMultisampleTarget(int samples) {
+		auto it = multisampleTargets.find(samples);
+		if (it != multisampleTargets.end())
+			return it->second;
+
+		MultisampleTarget target{};
+		glGenRenderbuffers(1, &target.color);
+		glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, fullWidth, fullHeight);
+
+		glGenRenderbuffers(1, &target.depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, fullWidth, fullHeight);
+
+		glGenFramebuffers(1, &target.framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			fprintf(stderr, "%dx MSAA overlay target is incomplete\n", samples);
+
+		return multisampleTargets[samples] = target;
+	}
+
+	void scaledSize(int &width, int &height) {
+		width = std::max(1, int(fullWidth * Levels[level].scale + 0.5f));
+		height = std::max(1, int(fullHeight * Levels[level].scale + 0.5f));
+	}
+
+	void adjustLevel(double gpuMs) {
+		// Smooth out single slow frames, a level change costs more than it saves
+		filteredMs = hasSample ? 0.8 * filteredMs + 0.2 * gpuMs : gpuMs;
+		hasSample = true;
+
+		if (cooldown > 0) {
+			cooldown--;
+			return;
+		}
+		if (filteredMs > targetMs && level < LevelCount - 1) {
+			level++;
+			cooldown = DownCooldown;
+		} else if (filteredMs < UpThreshold * targetMs && level > 0) {
+			level--;
+			cooldown = UpCooldown;
+		}
+	}
+}
+
+ShaderProgramSource governorShaderSource() {
+	return {SHADER_CODE, VertexShaderCode, FragmentShaderCode, "overlay"};
+}
+
+bool governorInit(GLuint program, int width, int height, double targetMs) {
+	if (program == 0) {
+		fprintf(stderr, "No overlay program\n");
+		return false;
+	}
+	programID = program;
+
+	fullWidth = width;
+	fullHeight = height;
+	::targetMs = targetMs;
+
+	glGenTextures(1, &resolveTexture);
+	glBindTexture(GL_TEXTURE_2D, resolveTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	// Bilinear does the upsampling
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenRenderbuffers(1, &resolveDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, resolveDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+	GLint framebuffer = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+	glGenFramebuffers(1, &resolveFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, resolveFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, resolveTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, resolveDepth);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, (GLuint) framebuffer);
+	if (!complete) {
+		fprintf(stderr, "Overlay target is incomplete\n");
+		return false;
+	}
+
+	uvScaleID = glGetUniformLocation(programID, "uvScale");
+	samplerID = glGetUniformLocation(programID, "overlaySampler");
+
+	// Core profile wants a VAO bound even without attributes
+	glGenVertexArrays(1, &vertexArrayID);
+	glGenQueries(2 * QuerySlots, &queries[0][0]);
+
+	// Start at the highest level the driver can give
+	GLint maxSamples = 0;
+	glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+	while (level < LevelCount - 1 && Levels[level].samples > maxSamples)
+		level++;
+
+	return true;
+}
+
+void governorShutdown() {
+	for (auto &target : multisampleTargets) {
+		glDeleteFramebuffers(1, &target.second.framebuffer);
+		glDeleteRenderbuffers(1, &target.second.color);
+		glDeleteRenderbuffers(1, &target.second.depth);
+	}
+	multisampleTargets.clear();
+
+	glDeleteFramebuffers(1, &resolveFramebuffer);
+	glDeleteTextures(1, &resolveTexture);
+	glDeleteRenderbuffers(1, &resolveDepth);
+	glDeleteProgram(programID);
+	glDeleteVertexArrays(1, &vertexArrayID);
+	glDeleteQueries(2 * QuerySlots, &queries[0][0]);
+}
+
+void governorBeginFrame() {
+	int slot = frame % QuerySlots;
+	if (queryPending[slot]) {
+		// Four frames old, only read it if the GPU is done so we never wait
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		// The first frame compiles shaders and uploads everything, it says nothing about the budget
+		if (available && frame > QuerySlots) {
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(queries[slot][0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(queries[slot][1], GL_QUERY_RESULT, &end);
+			adjustLevel((end - start) / 1e6);
+		}
+		queryPending[slot] = false;
+	}
+	glQueryCounter(queries[slot][0], GL_TIMESTAMP);
+}
+
+void governorBeginVirtual() {
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+	int width, height;
+	scaledSize(width, height);
+
+	int samples = Levels[level].samples;
+	glBindFramebuffer(GL_FRAMEBUFFER, samples > 0 ? getMultisampleTarget(samples).framebuffer : resolveFramebuffer);
+	glViewport(0, 0, width, height);
+
+	// One texel more than we use, so bilinear filtering at the edge reads transparent
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(0, 0, std::min(width + 1, fullWidth), std::min(height + 1, fullHeight));
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+}
+
+void governorEndVirtual() {
+	int width, height;
+	scaledSize(width, height);
+
+	int samples = Levels[level].samples;
+	if (samples > 0) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, getMultisampleTarget(samples).framebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffer);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, (GLuint) previousFramebuffer);
+	glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+}
+
+void governorComposite() {
+	int width, height;
+	scaledSize(width, height);
+
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+
+	// Resolved edges are already multiplied by their coverage
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	glUseProgram(programID);
+	glUniform2f(uvScaleID, float(width) / fullWidth, float(height) / fullHeight);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, resolveTexture);
+	glUniform1i(samplerID, 0);
+	glBindVertexArray(vertexArrayID);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+
+	glDisable(GL_BLEND);
+	if (depthTest)
+		glEnable(GL_DEPTH_TEST);
+}
+
+void governorEndFrame() {
+	int slot = frame % QuerySlots;
+	glQueryCounter(queries[slot][1], GL_TIMESTAMP);
+	queryPending[slot] = true;
+	frame++;
+}
+
+void governorMetrics(double &gpuMs, float &scale, int &samples) {
+	gpuMs = filteredMs;
+	scale = Levels[level].scale;
+	samples = Levels[level].samples;
+}
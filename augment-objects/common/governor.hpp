@@ -0,0 +1,48 @@
+#ifndef GOVERNOR_HPP
+#define GOVERNOR_HPP
+
+#include <GL/glew.h>
+
+#include "shader.hpp"
+
+// Dynamic resolution for the virtual content. The overlay is drawn into an
+// offscreen target whose resolution and MSAA level follow the measured GPU
+// frame time, then upsampled and blended over the full resolution camera
+// image. The frame time comes from GL_TIMESTAMP pairs read a few frames late,
+// so measuring never stalls the pipeline and never clashes with a
+// GL_TIME_ELAPSED query that may be running around the whole frame.
+//
+//	governorBeginFrame();
+//	... camera background at full resolution ...
+//	governorBeginVirtual();
+//	... markers ...
+//	governorEndVirtual();
+//	governorComposite();
+//	governorEndFrame();
+
+// The composite program, to be loaded with the others through LoadShaderPrograms()
+ShaderProgramSource governorShaderSource();
+
+// Needs a current 3.3 context and the linked composite program. width and
+// height are the full resolution
+bool governorInit(GLuint program, int width, int height, double targetMs = 16.6);
+void governorShutdown();
+
+void governorBeginFrame();
+
+// Binds the scaled target and clears it to transparent
+void governorBeginVirtual();
+
+// Resolves the samples and gives back the framebuffer and viewport from before
+void governorEndVirtual();
+
+// Blends the resolved overlay over the bound framebuffer, filling the viewport
+void governorComposite();
+
+// Picks up old timings and moves between quality levels
+void governorEndFrame();
+
+// Filtered GPU frame time in ms, the overlay scale and its MSAA samples
+void governorMetrics(double &gpuMs, float &scale, int &samples);
+
+#endif
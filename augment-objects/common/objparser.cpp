@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "objparser.hpp"
+#include "meshnormals.hpp"
+
+namespace {
+
+	// Below this a single thread is quicker than starting the others
+	const size_t MinChunkSize = 256 * 1024;
+
+	const int NoIndex = INT_MIN;
+
+	// Negative OBJ indices are only known relative to the chunk until every chunk has been counted
+	struct Corner {
+		int position, uv, normal;
+		unsigned char relative; // bit 0 position, 1 uv, 2 normal
+	};
+
+	struct Chunk {
+		const char *begin, *end;
+		std::vector<float> positions, uvs, normals;
+		std::vector<Corner> corners; // 3 per triangle, polygons already fanned
+		bool missingUV = false, missingNormal = false;
+		const char *error = nullptr;
+
+		// Filled in between the two passes
+		size_t positionBase = 0, uvBase = 0, normalBase = 0, vertexBase = 0;
+	};
+
+	inline bool isSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	inline const char *skipSpaces(const char *p, const char *end) {
+		while (p < end && isSpace(*p))
+			p++;
+		return p;
+	}
+
+	inline const char *skipLine(const char *p, const char *end) {
+		const void *newline = memchr(p, '\n', size_t(end - p));
+		return newline != nullptr ? (const char *) newline + 1 : end;
+	}
+
+	bool parseInt(const char *&p, const char *end, int &value) {
+		bool negative = p < end && *p == '-';
+		if (negative || (p < end && *p == '+'))
+			p++;
+		if (p == end || *p < '0' || *p > '9')
+			return false;
+		long long result = 0;
+		while (p < end && *p >= '0' && *p <= '9' && result < INT_MAX)
+			result = result * 10 + (*p++ - '0');
+		value = (int) (negative ? -result : result);
+		return true;
+	}
+
+	bool parseFloat(const char *&p, const char *end, float &value) {
+		static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+		const char *start = p;
+		bool negative = p < end && *p == '-';
+		if (negative || (p < end && *p == '+'))
+			p++;
+
+		// 19 digits fit an unsigned 64 bit integer, the rest only move the exponent
+		unsigned long long mantissa = 0;
+		int digits = 0, exponent = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+			if (digits < 19)
+				mantissa = mantissa * 10 + (*p - '0');
+			else
+				exponent++;
+		}
+		if (p < end && *p == '.') {
+			for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+				if (digits < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					exponent--;
+				}
+			}
+		}
+		if (digits == 0) {
+			p = start;
+			return false;
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char *mark = p++;
+			int power;
+			if (parseInt(p, end, power))
+				exponent += power;
+			else
+				p = mark;
+		}
+
+		double result = (double) mantissa;
+		if (exponent < 0)
+			result /= exponent >= -22 ? powers[-exponent] : std::pow(10.0, -exponent);
+		else if (exponent > 0)
+			result *= exponent <= 22 ? powers[exponent] : std::pow(10.0, exponent);
+		value = (float) (negative ? -result : result);
+		return true;
+	}
+
+	// Up to count floats, missing ones stay 0
+	const char *parseFloats(const char *p, const char *end, std::vector<float> &out, int count) {
+		for (int i = 0; i < count; i++) {
+			p = skipSpaces(p, end);
+			float value = 0;
+			parseFloat(p, end, value);
+			out.push_back(value);
+		}
+		return p;
+	}
+
+	// v, v/vt, v//vn or v/vt/vn. OBJ counts from 1, negative indices count back from the latest element.
+	bool parseCorner(const char *&p, const char *end, const Chunk &chunk, Corner &corner) {
+		corner = {NoIndex, NoIndex, NoIndex, 0};
+		int values[3] = {0, 0, 0};
+		bool present[3] = {false, false, false};
+
+		for (int field = 0; field < 3; field++) {
+			if (field > 0) {
+				if (p == end || *p != '/')
+					break;
+				p++;
+			}
+			present[field] = parseInt(p, end, values[field]);
+			if (field == 0 && !present[0])
+				return false;
+		}
+
+		const size_t counts[3] = {chunk.positions.size() / 3, chunk.uvs.size() / 2, chunk.normals.size() / 3};
+		int *targets[3] = {&corner.position, &corner.uv, &corner.normal};
+		for (int field = 0; field < 3; field++) {
+			if (!present[field])
+				continue;
+			if (values[field] == 0)
+				return false;
+			if (values[field] > 0) {
+				*targets[field] = values[field] - 1;
+			} else {
+				*targets[field] = (int) counts[field] + values[field];
+				corner.relative |= 1 << field;
+			}
+		}
+		return true;
+	}
+
+	void parseChunk(Chunk &chunk) {
+		std::vector<Corner> polygon;
+		const char *end = chunk.end;
+
+		for (const char *p = chunk.begin; p < end;) {
+			const char *line = p = skipSpaces(p, end);
+			if (p + 1 < end && p[0] == 'v' && isSpace(p[1])) {
+				p = parseFloats(p + 1, end, chunk.positions, 3);
+			} else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+				p = parseFloats(p + 2, end, chunk.uvs, 2);
+			} else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+				p = parseFloats(p + 2, end, chunk.normals, 3);
+			} else if (p + 1 < end && p[0] == 'f' && isSpace(p[1])) {
+				polygon.clear();
+				p = skipSpaces(p + 1, end);
+				while (p < end && *p != '\n' && *p != '#') {
+					Corner corner;
+					if (!parseCorner(p, end, chunk, corner)) {
+						if (chunk.error == nullptr)
+							chunk.error = line;
+						break;
+					}
+					polygon.push_back(corner);
+					p = skipSpaces(p, end);
+				}
+
+				for (size_t i = 2; i < polygon.size(); i++) {
+					chunk.corners.push_back(polygon[0]);
+					chunk.corners.push_back(polygon[i - 1]);
+					chunk.corners.push_back(polygon[i]);
+				}
+				for (const Corner &corner : polygon) {
+					chunk.missingUV |= corner.uv == NoIndex;
+					chunk.missingNormal |= corner.normal == NoIndex;
+				}
+			}
+			p = skipLine(p, end);
+		}
+	}
+
+	inline bool resolve(int &index, bool relative, size_t base, size_t count) {
+		if (index == NoIndex)
+			return true;
+		long long absolute = relative ? (long long) base + index : index;
+		if (absolute < 0 || absolute >= (long long) count)
+			return false;
+		index = (int) absolute;
+		return true;
+	}
+
+	// Second pass : every chunk writes its triangles at its own offset of the output.
+	// Corners without a normal are left at 0, their position index goes to cornerPositions.
+	bool emitChunk(Chunk &chunk, const std::vector<Chunk> &chunks, size_t positionCount, size_t uvCount,
+	               size_t normalCount, bool withUVs, ObjMesh &mesh, std::vector<unsigned int> &cornerPositions) {
+		// Attributes are looked up in whichever chunk defined them
+		auto attribute = [&chunks](size_t index, size_t Chunk::*base, std::vector<float> Chunk::*values,
+		                           int size) -> const float * {
+			size_t c = chunks.size() - 1;
+			while (chunks[c].*base > index)
+				c--;
+			return &(chunks[c].*values)[size * (index - chunks[c].*base)];
+		};
+
+		for (size_t t = 0; t < chunk.corners.size(); t += 3) {
+			Corner *triangle = &chunk.corners[t];
+			for (int i = 0; i < 3; i++) {
+				Corner &corner = triangle[i];
+				if (!resolve(corner.position, corner.relative & 1, chunk.positionBase, positionCount) ||
+				    !resolve(corner.uv, corner.relative & 2, chunk.uvBase, uvCount) ||
+				    !resolve(corner.normal, corner.relative & 4, chunk.normalBase, normalCount) ||
+				    corner.position == NoIndex)
+					return false;
+			}
+
+			const float *p[3];
+			for (int i = 0; i < 3; i++)
+				p[i] = attribute((size_t) triangle[i].position, &Chunk::positionBase, &Chunk::positions, 3);
+
+			for (int i = 0; i < 3; i++) {
+				size_t vertex = chunk.vertexBase + t + i;
+				memcpy(&mesh.positions[3 * vertex], p[i], 3 * sizeof(float));
+
+				const Corner &corner = triangle[i];
+				if (!cornerPositions.empty())
+					cornerPositions[vertex] = (unsigned int) corner.position;
+				if (corner.normal != NoIndex)
+					memcpy(&mesh.normals[3 * vertex],
+					       attribute((size_t) corner.normal, &Chunk::normalBase, &Chunk::normals, 3), 3 * sizeof(float));
+
+				if (withUVs)
+					memcpy(&mesh.uvs[2 * vertex],
+					       attribute((size_t) corner.uv, &Chunk::uvBase, &Chunk::uvs, 2), 2 * sizeof(float));
+			}
+		}
+		return true;
+	}
+
+	template<typename Work>
+	void forEachChunk(std::vector<Chunk> &chunks, Work work) {
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < chunks.size(); i++)
+			threads.emplace_back(work, std::ref(chunks[i]));
+		work(chunks[0]);
+		for (std::thread &thread : threads)
+			thread.join();
+	}
+}
+
+bool objParse(const char *text, size_t size, ObjMesh &mesh) {
+	mesh = ObjMesh();
+	if (size == 0)
+		return true;
+
+	// Line aligned chunks, one per thread
+	size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+	size_t chunkCount = std::max<size_t>(1, std::min(threadCount, size / MinChunkSize));
+	std::vector<Chunk> chunks(chunkCount);
+	const char *end = text + size;
+	const char *begin = text;
+	for (size_t i = 0; i < chunkCount; i++) {
+		const char *split = i + 1 == chunkCount ? end : text + size * (i + 1) / chunkCount;
+		if (split < begin)
+			split = begin;
+		if (split < end)
+			split = skipLine(split, end);
+		chunks[i].begin = begin;
+		chunks[i].end = split;
+		begin = split;
+	}
+
+	forEachChunk(chunks, [](Chunk &chunk) { parseChunk(chunk); });
+
+	// Where each chunk's elements land in the whole file
+	size_t positionCount = 0, uvCount = 0, normalCount = 0, vertexCount = 0;
+	bool withUVs = true, missingNormals = false;
+	for (Chunk &chunk : chunks) {
+		if (chunk.error != nullptr) {
+			const char *lineEnd = chunk.error;
+			while (lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r')
+				lineEnd++;
+			printf("Can't read the face '%.*s'\n", (int) std::min<ptrdiff_t>(lineEnd - chunk.error, 80),
+			       chunk.error);
+			return false;
+		}
+		chunk.positionBase = positionCount;
+		chunk.uvBase = uvCount;
+		chunk.normalBase = normalCount;
+		chunk.vertexBase = vertexCount;
+		positionCount += chunk.positions.size() / 3;
+		uvCount += chunk.uvs.size() / 2;
+		normalCount += chunk.normals.size() / 3;
+		vertexCount += chunk.corners.size();
+		withUVs &= !chunk.missingUV;
+		missingNormals |= chunk.missingNormal;
+	}
+	withUVs &= vertexCount > 0;
+
+	mesh.positions.resize(3 * vertexCount);
+	mesh.normals.resize(3 * vertexCount);
+	if (withUVs)
+		mesh.uvs.resize(2 * vertexCount);
+
+	std::vector<char> valid(chunks.size(), 1);
+	std::vector<unsigned int> cornerPositions(missingNormals ? vertexCount : 0);
+	forEachChunk(chunks, [&](Chunk &chunk) {
+		valid[&chunk - chunks.data()] = emitChunk(chunk, chunks, positionCount, uvCount, normalCount, withUVs, mesh,
+		                                          cornerPositions);
+	});
+	if (std::find(valid.begin(), valid.end(), 0) != valid.end()) {
+		printf("A face refers to a vertex that doesn't exist\n");
+		mesh = ObjMesh();
+		return false;
+	}
+
+	// Corners without vn get the smooth normal of their position, over every face using it
+	if (missingNormals) {
+		std::vector<float> positions, smoothNormals(3 * positionCount);
+		positions.reserve(3 * positionCount);
+		for (const Chunk &chunk : chunks)
+			positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+		meshSmoothNormals(positions.data(), positionCount, cornerPositions.data(), vertexCount, smoothNormals.data());
+
+		size_t vertex = 0;
+		for (const Chunk &chunk : chunks) {
+			for (const Corner &corner : chunk.corners) {
+				if (corner.normal == NoIndex)
+					memcpy(&mesh.normals[3 * vertex], &smoothNormals[3 * cornerPositions[vertex]], 3 * sizeof(float));
+				vertex++;
+			}
+		}
+	}
+	return true;
+}
+
+bool objParse(const char *path, ObjMesh &mesh) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Impossible to open %s ! Are you in the right path ?\n", path);
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return false;
+	}
+	if (info.st_size == 0) {
+		close(fd);
+		mesh = ObjMesh();
+		return true;
+	}
+
+	void *mapping = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		printf("Could not map %s\n", path);
+		return false;
+	}
+	madvise(mapping, (size_t) info.st_size, MADV_SEQUENTIAL);
+
+	bool parsed = objParse((const char *) mapping, (size_t) info.st_size, mesh);
+	munmap(mapping, (size_t) info.st_size);
+	return parsed;
+}
@@ -0,0 +1,33 @@
+#ifndef OBJPARSER_HPP
+#define OBJPARSER_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Wavefront OBJ reader behind every loadOBJ(). The file is mmapped and cut
+// into line aligned chunks that are parsed side by side, numbers go through
+// a small hand written parser instead of fscanf.
+//
+// Understands v, vt and vn, faces written as v, v/vt, v//vn or v/vt/vn with
+// any number of corners (polygons are fanned) and negative indices counting
+// back from the latest element. Everything else is skipped.
+//
+//	ObjMesh mesh;
+//	if (objParse("skull.obj", mesh))
+//		... mesh.positions, mesh.normals, mesh.vertexCount() ...
+
+// A triangle soup, every face corner is a vertex of its own
+struct ObjMesh {
+	std::vector<float> positions; // 3 per vertex
+	std::vector<float> uvs;       // 2 per vertex, empty unless every corner has one. V as in the file
+	std::vector<float> normals;   // 3 per vertex, smooth ones from meshSmoothNormals() where the file has none
+
+	size_t vertexCount() const { return positions.size() / 3; }
+};
+
+bool objParse(const char *path, ObjMesh &mesh);
+
+// Same thing on text already in memory
+bool objParse(const char *text, size_t size, ObjMesh &mesh);
+
+#endif
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <GL/glew.h>
+
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "offscreen.hpp"
+
+namespace {
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Frames whose pixels may still be in flight. Mapping a PBO waits for its
+	// frame, so with three of them we only ever wait for the frame before last.
+	const int ReadbackSlots = 3;
+
+	// GL_TIME_ELAPSED results are picked up this many frames later
+	const int QuerySlots = 4;
+
+	bool requested = false;
+	int frameCount = 0;
+	const char *dumpPath = nullptr;
+
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	int width = 0, height = 0;
+
+	GLuint framebuffer = 0;
+	GLuint colorbuffer = 0;
+	GLuint depthbuffer = 0;
+
+	GLuint pixelbuffers[ReadbackSlots] = {};
+	int pixelbufferFrames[ReadbackSlots];
+	GLsync readFences[ReadbackSlots] = {};
+
+	GLuint queries[QuerySlots] = {};
+	bool queryPending[QuerySlots] = {};
+
+	int frame = 0; // frames begun so far
+	Clock::time_point frameStart, lastFrameEnd;
+
+	// In milliseconds, one entry per frame
+	std::vector<double> cpuTimes, gpuTimes, frameTimes, readbackWaits;
+
+	std::vector<unsigned char> lastPixels;
+	unsigned int lastChecksum = 0;
+
+	double milliseconds(Clock::duration duration) {
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+
+	EGLDisplay openDisplay() {
+		// Mesa's surfaceless platform needs neither X nor a DRM device
+		const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (extensions != nullptr && strstr(extensions, "EGL_MESA_platform_surfaceless") != nullptr &&
+		    getPlatformDisplay != nullptr)
+			return getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	void createFramebuffer() {
+		glGenRenderbuffers(1, &colorbuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, colorbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+		glGenRenderbuffers(1, &depthbuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthbuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorbuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+
+		glGenBuffers(ReadbackSlots, pixelbuffers);
+		for (int slot = 0; slot < ReadbackSlots; slot++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelbuffers[slot]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, 4 * width * height, nullptr, GL_STREAM_READ);
+			pixelbufferFrames[slot] = -1;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		glGenQueries(QuerySlots, queries);
+
+		// A surfaceless context starts with an empty viewport
+		glViewport(0, 0, width, height);
+	}
+
+	void collectQuery(int slot) {
+		if (!queryPending[slot])
+			return;
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsed);
+		gpuTimes.push_back(elapsed / 1e6);
+		queryPending[slot] = false;
+	}
+
+	void collectReadback(int slot) {
+		if (pixelbufferFrames[slot] < 0)
+			return;
+
+		Clock::time_point waitStart = Clock::now();
+		glClientWaitSync(readFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(readFences[slot]);
+		readFences[slot] = nullptr;
+		readbackWaits.push_back(milliseconds(Clock::now() - waitStart));
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelbuffers[slot]);
+		auto pixels = (const unsigned char *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4 * width * height,
+		                                                       GL_MAP_READ_BIT);
+		if (pixels != nullptr) {
+			// Only the last frame is kept, as a reference image for regressions
+			if (pixelbufferFrames[slot] == frameCount - 1) {
+				lastPixels.assign(pixels, pixels + 4 * width * height);
+				lastChecksum = 2166136261u; // FNV-1a
+				for (unsigned char pixel : lastPixels)
+					lastChecksum = (lastChecksum ^ pixel) * 16777619u;
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		pixelbufferFrames[slot] = -1;
+	}
+
+	void printTimes(const char *name, std::vector<double> times) {
+		if (times.empty())
+			return;
+		std::sort(times.begin(), times.end());
+		double total = 0;
+		for (double time : times)
+			total += time;
+		printf("  %-14s avg %8.3f ms  p50 %8.3f  p95 %8.3f  max %8.3f\n", name, total / times.size(),
+		       times[times.size() / 2], times[(times.size() * 95) / 100], times.back());
+	}
+
+	void writeDump() {
+		FILE *file = fopen(dumpPath, "wb");
+		if (file == nullptr) {
+			fprintf(stderr, "Could not write %s\n", dumpPath);
+			return;
+		}
+		// GL rows go bottom up, PPM rows top down
+		fprintf(file, "P6\n%d %d\n255\n", width, height);
+		for (int row = height - 1; row >= 0; row--)
+			for (int column = 0; column < width; column++)
+				fwrite(&lastPixels[4 * (row * width + column)], 1, 3, file);
+		fclose(file);
+	}
+}
+
+bool offscreenRequested(int argc, char **argv) {
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--offscreen") == 0) {
+			requested = true;
+			frameCount = std::max(1, atoi(argv[i + 1]));
+		} else if (strcmp(argv[i], "--dump") == 0)
+			dumpPath = argv[i + 1];
+	}
+	return requested;
+}
+
+bool offscreenActive() {
+	return context != EGL_NO_CONTEXT;
+}
+
+bool offscreenInit(int width, int height, bool coreProfile) {
+	::width = width;
+	::height = height;
+
+	display = openDisplay();
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+		fprintf(stderr, "Failed to initialize EGL\n");
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "EGL has no desktop OpenGL\n");
+		return false;
+	}
+
+	// We never draw to an EGL surface, any GL config will do
+	const EGLint configAttributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = nullptr;
+	EGLint configCount = 0;
+	if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+		config = nullptr; // EGL_NO_CONFIG_KHR
+
+	const EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+		EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, coreProfile ? EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR
+		                                                 : EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT_KHR,
+		EGL_NONE
+	};
+	context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+	if (context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Failed to create a 3.3 context, EGL error 0x%x\n", eglGetError());
+		eglTerminate(display);
+		return false;
+	}
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		fprintf(stderr, "EGL has no surfaceless contexts, EGL error 0x%x\n", eglGetError());
+		eglDestroyContext(display, context);
+		context = EGL_NO_CONTEXT;
+		eglTerminate(display);
+		return false;
+	}
+
+	printf("Offscreen %dx%d on EGL %d.%d\n", width, height, major, minor);
+	return true;
+}
+
+void offscreenBeginFrame() {
+	if (framebuffer == 0) {
+		createFramebuffer();
+		printf("Rendering %d frames with %s\n", frameCount, glGetString(GL_RENDERER));
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	// The first frame compiles shaders and uploads everything, it is not timed
+	if (frame > 0) {
+		int slot = frame % QuerySlots;
+		collectQuery(slot);
+		glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+		queryPending[slot] = true;
+	}
+
+	frameStart = Clock::now();
+}
+
+bool offscreenEndFrame() {
+	Clock::time_point submitted = Clock::now();
+	if (frame > 0) {
+		cpuTimes.push_back(milliseconds(submitted - frameStart));
+		glEndQuery(GL_TIME_ELAPSED);
+	}
+
+	// The copy into the PBO is queued, nothing waits for it here
+	int slot = frame % ReadbackSlots;
+	collectReadback(slot);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelbuffers[slot]);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	pixelbufferFrames[slot] = frame;
+	glFlush();
+
+	Clock::time_point end = Clock::now();
+	if (frame > 0)
+		frameTimes.push_back(milliseconds(end - lastFrameEnd));
+	lastFrameEnd = end;
+
+	return ++frame < frameCount;
+}
+
+double offscreenTime() {
+	return frame / 60.0;
+}
+
+void offscreenShutdown() {
+	if (!offscreenActive())
+		return;
+
+	if (framebuffer != 0) {
+		for (int i = 0; i < ReadbackSlots; i++)
+			collectReadback((frame + i) % ReadbackSlots);
+		for (int i = 0; i < QuerySlots; i++)
+			collectQuery((frame + i) % QuerySlots);
+
+		printf("%d frames at %dx%d, first one left out\n", frame, width, height);
+		printTimes("cpu", cpuTimes);
+		printTimes("gpu", gpuTimes);
+		printTimes("frame", frameTimes);
+		printTimes("readback wait", readbackWaits);
+		printf("  last frame checksum %08x\n", lastChecksum);
+
+		if (dumpPath != nullptr && !lastPixels.empty())
+			writeDump();
+
+		glDeleteQueries(QuerySlots, queries);
+		glDeleteBuffers(ReadbackSlots, pixelbuffers);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(1, &colorbuffer);
+		glDeleteRenderbuffers(1, &depthbuffer);
+	}
+
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, context);
+	eglTerminate(display);
+	context = EGL_NO_CONTEXT;
+}
@@ -0,0 +1,497 @@
+//
+// Quadric error simplification, see lod.h
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include "lod.h"
+
+namespace {
+
+const uint32_t LodFileMagic = 0x43444f4c; // "LODC"
+const uint32_t LodFileVersion = 1;
+
+// Boundary edges are held in place by a plane through them, perpendicular to their triangle.
+// Weighted well above the triangles' own planes so open borders don't shrink away.
+const double BoundaryWeight = 10.0;
+
+struct LodFileHeader {
+    uint32_t magic, version;
+    uint64_t sourceHash;
+    uint32_t levelCount, vertexCount, indexCount, padding;
+};
+
+// Sum of squared distances to a set of planes, as a symmetric 4x4 matrix, and the planes' total weight
+struct Quadric {
+    double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+    double weight;
+
+    Quadric() : a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0), a22(0), a23(0), a33(0), weight(0) {}
+
+    // Plane n.p + d = 0, n of unit length
+    Quadric(const cv::Point3d &n, double d, double w) :
+            a00(w * n.x * n.x), a01(w * n.x * n.y), a02(w * n.x * n.z), a03(w * n.x * d),
+            a11(w * n.y * n.y), a12(w * n.y * n.z), a13(w * n.y * d),
+            a22(w * n.z * n.z), a23(w * n.z * d),
+            a33(w * d * d), weight(w) {}
+
+    Quadric &operator+=(const Quadric &q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+        return *this;
+    }
+
+    double evaluate(const cv::Point3d &p) const {
+        double value = a00 * p.x * p.x + 2 * a01 * p.x * p.y + 2 * a02 * p.x * p.z + 2 * a03 * p.x +
+                       a11 * p.y * p.y + 2 * a12 * p.y * p.z + 2 * a13 * p.y +
+                       a22 * p.z * p.z + 2 * a23 * p.z + a33;
+        return std::max(value, 0.0);  // Rounding can take it slightly below
+    }
+};
+
+// Moving vertex `from` onto vertex `to`. The stamps tell whether either end changed since it was queued.
+struct Collapse {
+    double cost;
+    unsigned int from, to;
+    unsigned int fromStamp, toStamp;
+
+    bool operator>(const Collapse &other) const { return cost > other.cost; }
+};
+
+struct PositionKey {
+    double x, y, z;
+
+    bool operator==(const PositionKey &other) const {
+        return memcmp(this, &other, sizeof(PositionKey)) == 0;
+    }
+};
+
+struct PositionKeyHash {
+    size_t operator()(const PositionKey &key) const {
+        uint64_t words[3];
+        memcpy(words, &key, sizeof(words));
+        uint64_t hash = 14695981039346656037ULL;
+        for (uint64_t word : words)
+            hash = (hash ^ word) * 1099511628211ULL;
+        return (size_t) hash;
+    }
+};
+
+/**
+ * Half edge collapses over an indexed triangle mesh. Triangles are never moved, a collapse renames
+ * a corner or kills the triangle, so the survivors of any step can be read off `triangles`.
+ */
+struct Simplifier {
+    const std::vector<cv::Point3d> &positions;
+    std::vector<unsigned int> triangles;
+    std::vector<char> triangleAlive;
+    size_t aliveTriangles;
+
+    std::vector<std::vector<unsigned int>> vertexTriangles;
+    std::vector<Quadric> quadrics;
+    std::vector<unsigned int> stamps;
+    std::vector<char> removed;
+    std::vector<unsigned int> removalOrder;
+
+    // Squared error of the worst collapse so far, averaged over the planes involved
+    double maxError = 0;
+
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+
+    // Neighbourhood marks for collapsible(), bumped instead of cleared
+    std::vector<unsigned int> marks;
+    unsigned int markStamp = 0;
+
+    Simplifier(const std::vector<cv::Point3d> &in_positions, std::vector<unsigned int> &in_triangles) :
+            positions(in_positions), aliveTriangles(in_triangles.size() / 3),
+            vertexTriangles(in_positions.size()), quadrics(in_positions.size()), stamps(in_positions.size(), 0),
+            removed(in_positions.size(), 0), marks(in_positions.size(), 0) {
+        triangles.swap(in_triangles);
+        triangleAlive.assign(aliveTriangles, 1);
+
+        // Every triangle's plane, weighted by its area, goes to its corners
+        std::vector<cv::Point3d> faceNormals(aliveTriangles);
+        for (unsigned int t = 0; t < aliveTriangles; t++) {
+            const unsigned int *corner = &triangles[3 * t];
+            for (int i = 0; i < 3; i++)
+                vertexTriangles[corner[i]].push_back(t);
+
+            cv::Point3d normal = faceNormal(positions[corner[0]], positions[corner[1]], positions[corner[2]]);
+            double length = cv::norm(normal);
+            if (length == 0)
+                continue;
+            faceNormals[t] = normal * (1 / length);
+            Quadric plane(faceNormals[t], -faceNormals[t].dot(positions[corner[0]]), length / 2);
+            for (int i = 0; i < 3; i++)
+                quadrics[corner[i]] += plane;
+        }
+
+        // Edges seen once are on the border
+        std::unordered_map<uint64_t, unsigned int> edgeUses;
+        for (unsigned int t = 0; t < aliveTriangles; t++)
+            for (int i = 0; i < 3; i++)
+                edgeUses[edgeKey(triangles[3 * t + i], triangles[3 * t + (i + 1) % 3])]++;
+        for (unsigned int t = 0; t < aliveTriangles; t++) {
+            for (int i = 0; i < 3; i++) {
+                unsigned int a = triangles[3 * t + i], b = triangles[3 * t + (i + 1) % 3];
+                if (edgeUses[edgeKey(a, b)] != 1)
+                    continue;
+                cv::Point3d edge = positions[b] - positions[a];
+                cv::Point3d normal = edge.cross(faceNormals[t]);
+                double length = cv::norm(normal);
+                if (length == 0)
+                    continue;
+                normal = normal * (1 / length);
+                Quadric plane(normal, -normal.dot(positions[a]), BoundaryWeight * edge.dot(edge));
+                quadrics[a] += plane;
+                quadrics[b] += plane;
+            }
+        }
+
+        for (unsigned int t = 0; t < aliveTriangles; t++) {
+            for (int i = 0; i < 3; i++) {
+                unsigned int a = triangles[3 * t + i], b = triangles[3 * t + (i + 1) % 3];
+                push(a, b);
+                push(b, a);
+            }
+        }
+    }
+
+    static cv::Point3d faceNormal(const cv::Point3d &a, const cv::Point3d &b, const cv::Point3d &c) {
+        return (b - a).cross(c - a);
+    }
+
+    static uint64_t edgeKey(unsigned int a, unsigned int b) {
+        return a < b ? (uint64_t) a << 32 | b : (uint64_t) b << 32 | a;
+    }
+
+    void push(unsigned int from, unsigned int to) {
+        Quadric sum = quadrics[from];
+        sum += quadrics[to];
+        queue.push({sum.evaluate(positions[to]), from, to, stamps[from], stamps[to]});
+    }
+
+    bool contains(unsigned int t, unsigned int vertex) const {
+        return triangles[3 * t] == vertex || triangles[3 * t + 1] == vertex || triangles[3 * t + 2] == vertex;
+    }
+
+    bool collapsible(unsigned int from, unsigned int to) {
+        // Link condition: the two ends may only share the neighbours across their common triangles,
+        // any other one would end up with two triangles over the same edge
+        markStamp += 2;
+        for (unsigned int t : vertexTriangles[to])
+            if (triangleAlive[t])
+                for (int i = 0; i < 3; i++)
+                    marks[triangles[3 * t + i]] = markStamp;
+
+        unsigned int shared = 0, common = 0;
+        for (unsigned int t : vertexTriangles[from]) {
+            if (!triangleAlive[t])
+                continue;
+            if (contains(t, to)) {
+                shared++;
+                continue;
+            }
+            for (int i = 0; i < 3; i++) {
+                unsigned int vertex = triangles[3 * t + i];
+                if (vertex != from && marks[vertex] == markStamp) {
+                    marks[vertex] = markStamp + 1;
+                    common++;
+                }
+            }
+
+            // Moving `from` must not turn the triangle over
+            cv::Point3d corners[3];
+            for (int i = 0; i < 3; i++)
+                corners[i] = positions[triangles[3 * t + i]];
+            cv::Point3d before = faceNormal(corners[0], corners[1], corners[2]);
+            for (int i = 0; i < 3; i++)
+                if (triangles[3 * t + i] == from)
+                    corners[i] = positions[to];
+            cv::Point3d after = faceNormal(corners[0], corners[1], corners[2]);
+            if (after.dot(before) <= 0)
+                return false;
+        }
+
+        // The triangles across the edge account for one common neighbour each
+        return shared > 0 && common <= shared;
+    }
+
+    void collapse(const Collapse &candidate) {
+        unsigned int from = candidate.from, to = candidate.to;
+
+        quadrics[to] += quadrics[from];
+        maxError = std::max(maxError, quadrics[to].evaluate(positions[to]) / std::max(quadrics[to].weight, 1e-30));
+
+        for (unsigned int t : vertexTriangles[from]) {
+            if (!triangleAlive[t])
+                continue;
+            if (contains(t, to)) {
+                triangleAlive[t] = 0;
+                aliveTriangles--;
+                continue;
+            }
+            for (int i = 0; i < 3; i++)
+                if (triangles[3 * t + i] == from)
+                    triangles[3 * t + i] = to;
+            vertexTriangles[to].push_back(t);
+        }
+
+        std::vector<unsigned int> &around = vertexTriangles[to];
+        around.erase(std::remove_if(around.begin(), around.end(), [this](unsigned int t) {
+            return !triangleAlive[t];
+        }), around.end());
+
+        vertexTriangles[from].clear();
+        removed[from] = 1;
+        removalOrder.push_back(from);
+        stamps[to]++;
+
+        // Every edge of `to` costs something else now
+        markStamp += 2;
+        for (unsigned int t : around) {
+            for (int i = 0; i < 3; i++) {
+                unsigned int vertex = triangles[3 * t + i];
+                if (vertex != to && marks[vertex] != markStamp) {
+                    marks[vertex] = markStamp;
+                    push(vertex, to);
+                    push(to, vertex);
+                }
+            }
+        }
+    }
+
+    void simplify(size_t targetTriangles) {
+        while (aliveTriangles > targetTriangles && !queue.empty()) {
+            Collapse candidate = queue.top();
+            queue.pop();
+            if (removed[candidate.from] || removed[candidate.to] || stamps[candidate.from] != candidate.fromStamp ||
+                stamps[candidate.to] != candidate.toStamp)
+                continue;
+            if (collapsible(candidate.from, candidate.to))
+                collapse(candidate);
+        }
+    }
+};
+
+// skull.obj -> skull.lod
+std::string lodPath(const char *objPath) {
+    std::string path = objPath;
+    size_t dot = path.find_last_of('.');
+    if (dot != std::string::npos && path.find('/', dot) == std::string::npos)
+        path.erase(dot);
+    return path + ".lod";
+}
+
+// FNV-1a over the OBJ contents, a word at a time
+bool sourceHash(const char *objPath, uint64_t &hash) {
+    FILE *file = fopen(objPath, "rb");
+    if (file == nullptr)
+        return false;
+    std::vector<unsigned char> contents;
+    unsigned char block[1 << 16];
+    size_t read;
+    while ((read = fread(block, 1, sizeof(block), file)) > 0)
+        contents.insert(contents.end(), block, block + read);
+    fclose(file);
+
+    hash = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= contents.size(); i += 8) {
+        uint64_t word;
+        memcpy(&word, &contents[i], sizeof(word));
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    for (; i < contents.size(); i++)
+        hash = (hash ^ contents[i]) * 1099511628211ULL;
+    hash = (hash ^ contents.size()) * 1099511628211ULL;
+    return true;
+}
+
+}
+
+bool buildLodChain(const std::vector<cv::Point3d> &in_vertices, const std::vector<cv::Point3d> &in_normals,
+                   const std::vector<double> &ratios, LodChain &out) {
+    if (in_vertices.size() != in_normals.size() || in_vertices.size() % 3 != 0 || in_vertices.empty() ||
+        ratios.empty() || in_vertices.size() > 0xffffffffu)
+        return false;
+
+    // Weld on the exact position, the collapses need to see the triangles around a vertex
+    std::unordered_map<PositionKey, unsigned int, PositionKeyHash> welded;
+    std::vector<cv::Point3d> positions, normals;
+    std::vector<unsigned int> corners(in_vertices.size());
+    for (size_t i = 0; i < in_vertices.size(); i++) {
+        PositionKey key = {in_vertices[i].x, in_vertices[i].y, in_vertices[i].z};
+        auto inserted = welded.emplace(key, (unsigned int) positions.size());
+        if (inserted.second) {
+            positions.push_back(in_vertices[i]);
+            normals.push_back(in_normals[i]);
+        } else {
+            normals[inserted.first->second] += in_normals[i];
+        }
+        corners[i] = inserted.first->second;
+    }
+    for (auto &normal : normals) {
+        double length = cv::norm(normal);
+        if (length > 0)
+            normal = normal * (1 / length);
+    }
+
+    // Triangles welded down to a line or a point are gone already
+    std::vector<unsigned int> triangles;
+    for (size_t i = 0; i < corners.size(); i += 3) {
+        unsigned int a = corners[i], b = corners[i + 1], c = corners[i + 2];
+        if (a != b && b != c && c != a)
+            triangles.insert(triangles.end(), {a, b, c});
+    }
+    const size_t fullTriangles = triangles.size() / 3;
+
+    std::vector<char> referenced(positions.size(), 0);
+    for (unsigned int vertex : triangles)
+        referenced[vertex] = 1;
+
+    // Levels carry on from each other, so each one's vertices are a subset of the previous one's
+    Simplifier simplifier(positions, triangles);
+    std::vector<std::vector<unsigned int>> levelTriangles(ratios.size());
+    std::vector<size_t> levelRemoved(ratios.size());
+    std::vector<float> levelErrors(ratios.size());
+    for (size_t level = 0; level < ratios.size(); level++) {
+        simplifier.simplify((size_t) (ratios[level] * fullTriangles));
+        for (size_t t = 0; t < fullTriangles; t++)
+            if (simplifier.triangleAlive[t])
+                levelTriangles[level].insert(levelTriangles[level].end(), &simplifier.triangles[3 * t],
+                                             &simplifier.triangles[3 * t] + 3);
+        levelRemoved[level] = simplifier.removalOrder.size();
+        levelErrors[level] = (float) std::sqrt(simplifier.maxError);
+    }
+
+    // Vertices that never go first, then the removed ones latest first, unused ones last:
+    // every level is a prefix
+    std::vector<unsigned int> order;
+    order.reserve(positions.size());
+    size_t unused = 0;
+    for (unsigned int vertex = 0; vertex < positions.size(); vertex++) {
+        if (!referenced[vertex])
+            unused++;
+        else if (!simplifier.removed[vertex])
+            order.push_back(vertex);
+    }
+    order.insert(order.end(), simplifier.removalOrder.rbegin(), simplifier.removalOrder.rend());
+    for (unsigned int vertex = 0; vertex < positions.size(); vertex++)
+        if (!referenced[vertex])
+            order.push_back(vertex);
+
+    std::vector<unsigned int> remap(positions.size());
+    out.vertices.resize(positions.size());
+    out.normals.resize(positions.size());
+    for (unsigned int i = 0; i < order.size(); i++) {
+        remap[order[i]] = i;
+        out.vertices[i] = positions[order[i]];
+        out.normals[i] = normals[order[i]];
+    }
+
+    out.indices.clear();
+    out.levels.clear();
+    for (size_t level = 0; level < ratios.size(); level++) {
+        LodLevel entry;
+        entry.indexOffset = (unsigned int) out.indices.size();
+        entry.indexCount = (unsigned int) levelTriangles[level].size();
+        entry.vertexCount = (unsigned int) (positions.size() - unused - levelRemoved[level]);
+        entry.error = levelErrors[level];
+        for (unsigned int vertex : levelTriangles[level])
+            out.indices.push_back(remap[vertex]);
+        out.levels.push_back(entry);
+    }
+    return true;
+}
+
+bool loadLodChain(const char *objPath, LodChain &out) {
+    std::string path = lodPath(objPath);
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    LodFileHeader header{};
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == LodFileMagic &&
+                 header.version == LodFileVersion && header.levelCount > 0;
+
+    // Without the OBJ around the saved chain is all there is
+    uint64_t hash;
+    if (valid && sourceHash(objPath, hash) && hash != header.sourceHash) {
+        printf("%s changed, rebuilding %s\n", objPath, path.c_str());
+        fclose(file);
+        return false;
+    }
+
+    if (valid) {
+        out.levels.resize(header.levelCount);
+        out.vertices.resize(header.vertexCount);
+        out.normals.resize(header.vertexCount);
+        out.indices.resize(header.indexCount);
+        valid = fread(out.levels.data(), sizeof(LodLevel), out.levels.size(), file) == out.levels.size() &&
+                fread(out.vertices.data(), sizeof(cv::Point3d), out.vertices.size(), file) == out.vertices.size() &&
+                fread(out.normals.data(), sizeof(cv::Point3d), out.normals.size(), file) == out.normals.size() &&
+                fread(out.indices.data(), sizeof(unsigned int), out.indices.size(), file) == out.indices.size();
+    }
+    fclose(file);
+
+    for (size_t i = 0; valid && i < out.levels.size(); i++) {
+        const LodLevel &level = out.levels[i];
+        valid = level.indexOffset <= out.indices.size() && level.indexCount <= out.indices.size() - level.indexOffset &&
+                level.vertexCount <= out.vertices.size();
+    }
+    for (size_t i = 0; valid && i < out.indices.size(); i++)
+        valid = out.indices[i] < out.vertices.size();
+    if (!valid) {
+        printf("%s is damaged, rebuilding it\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool storeLodChain(const char *objPath, const LodChain &chain) {
+    LodFileHeader header{};
+    header.magic = LodFileMagic;
+    header.version = LodFileVersion;
+    if (!sourceHash(objPath, header.sourceHash))
+        header.sourceHash = 0;
+    header.levelCount = (uint32_t) chain.levels.size();
+    header.vertexCount = (uint32_t) chain.vertices.size();
+    header.indexCount = (uint32_t) chain.indices.size();
+
+    std::string path = lodPath(objPath);
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        printf("Could not write %s\n", path.c_str());
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(chain.levels.data(), sizeof(LodLevel), chain.levels.size(), file) == chain.levels.size() &&
+                   fwrite(chain.vertices.data(), sizeof(cv::Point3d), chain.vertices.size(), file) == chain.vertices.size() &&
+                   fwrite(chain.normals.data(), sizeof(cv::Point3d), chain.normals.size(), file) == chain.normals.size() &&
+                   fwrite(chain.indices.data(), sizeof(unsigned int), chain.indices.size(), file) == chain.indices.size();
+    written &= fclose(file) == 0;
+    if (!written) {
+        printf("Could not write %s\n", path.c_str());
+        remove(path.c_str());
+    }
+    return written;
+}
+
+size_t selectLod(const LodChain &chain, double pixelsPerUnit, double maxPixelError) {
+    // Errors only grow along the chain
+    for (size_t level = chain.levels.size(); level-- > 1;)
+        if (chain.levels[level].error * pixelsPerUnit <= maxPixelError)
+            return level;
+    return 0;
+}
@@ -7,16 +7,26 @@
 #include <opencv2/videoio.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv/cv.hpp>
+#include <cstdlib>
+#include <cstring>
 #include "render.h"
+#include "lod.h"
+#include "mesh.h"
+#include "bvh.h"
 #include "common/shader.hpp"
 #include "common/texture.hpp"
+#include "common/batch.hpp"
+#include "common/offscreen.hpp"
+#include "common/governor.hpp"
+#include "common/bundle.hpp"
+#include <chrono>
+#include <future>
 
 
 // Main Window
 GLFWwindow *window;
 
 // OpenCV + ArUco variables
-GLfloat ratioX,ratioY;
 aruco::MarkerDetector PPDetector;
 aruco::MarkerPoseTracker markerPoseTracker;
 cv::VideoCapture TheVideoCapturer;
@@ -26,65 +36,173 @@ aruco::CameraParameters TheCameraParams;
 cv::Size TheGlWindowSize;
 bool TheCaptureFlag = true;
 
+// Size of the printed marker, in the units Tvec is reported in
+const float TheMarkerSize = 4;
+
+// Clipping planes of the camera frustum
+const float zNear = 0.05;
+const float zFar = 500.0;
+
 
 // IDs need to free up resources
 GLuint vertexbuffer;
-GLuint normalbuffer;
 GLuint elementbuffer;
+GLuint instancebuffer;
 GLuint programID;
-GLuint Texture;
 GLuint VertexArrayID;
+GLuint backgroundTexture;
+
+// Uniform handles of the instanced program
+GLint ProjectionMatrixID;
+GLint DiffuseColorID;
+
+// Per marker model-view matrices, 16 floats each, one list per level of detail. Streamed to
+// `instancebuffer` every frame, level after level
+std::vector<std::vector<GLfloat>> instanceModelViews;
+std::vector<GLfloat> axisModelViews;
+GLsizeiptr instanceBufferSize = 0;
+
+// Scales the model to the marker
+float ModelScale = 1;
+
+// Model space bounds of the model and of the marker axis, for frustum culling
+ModelBounds ModelBoundingVolume;
+ModelBounds AxisBoundingVolume;
+
+// Markers drawn and culled since the last frame rate report
+int markersDrawn = 0;
+int markersCulled = 0;
 
-// Loading the object vectors
-std::vector<unsigned short> indices;
-std::vector<cv::Point3d> indexed_vertices;
-std::vector<cv::Point3d> indexed_normals;
-std::vector<cv::Point3d> vertices;
-std::vector<cv::Point3d> normals;
+// Loading the object vectors. The chain only keeps its levels, the geometry moves to ModelMesh in floats
+LodChain ModelLods;
+SoaMesh<float> ModelMesh;
+
+// Hierarchy over the finest level, for clicks on the model. The last hit is marked until the next click
+Bvh ModelBvh;
+int PickedMarker = -1;
+cv::Point3f PickedPoint;
+
+// The model is read and simplified on a worker thread while the camera already runs. Nothing above that
+// it fills in is touched before ModelLoading is ready, the markers get a box of the model's size meanwhile
+std::future<int> ModelLoading;
+bool ModelReady = false;
 
 void displayFunction();
 void idleFunction();
 void axis(float);
+void placeholderBox(float);
 int glew_init();
 int glfw_init();
 void glfw_exit();
 int loadObjectModels();
-void loadSkull();
+int uploadObjectModels();
+bool pollObjectModels();
 void resizeCallback(GLFWwindow*, int,int);
+void mouseButtonCallback(GLFWwindow*, int, int, int);
+void pickModel(const cv::Point2f &);
+void pickMark(const cv::Point3f &, float);
 void onKeyboard(GLFWwindow*);
 void readCameraParams(cv::Mat &camera_matrix, cv::Mat &dist_coeffs, int &width, int &height);
 
 int main(int argc, char **argv) {
+    // Everything read below comes from the bundle when there is one, see common/bundle.hpp
+    bundleOpen("assets.bundle");
+
     // read camera parameters
     readCameraParams(TheCameraParams.CameraMatrix, TheCameraParams.Distorsion, TheCameraParams.CamSize.width,
                      TheCameraParams.CamSize.height);
     TheGlWindowSize = TheCameraParams.CamSize;
 
-    if (glfw_init()==-1) // Needs CamSize
+    // --offscreen FRAMES renders into an FBO without a window, see common/offscreen.hpp
+    bool offscreen = offscreenRequested(argc, argv);
+    if (offscreen ? !offscreenInit(TheGlWindowSize.width, TheGlWindowSize.height, true)
+                  : glfw_init()==-1) // Needs CamSize
         return -1;
 
     if (glew_init()==-1) // gl init to be called only after context/screen creation
         glfw_exit();
 
-    // Read video
-    TheVideoCapturer.open(0);
+    // Every program at once, the ones missing from the cache compile side by side, see common/shader.hpp
+    const ShaderProgramSource shaderSources[] = {
+            {SHADER_FILES, "InstancedShading.vertexshader", "InstancedShading.fragmentshader", nullptr},
+            batchShaderSource(),
+            governorShaderSource()
+    };
+    GLuint programs[3];
+    bool programsLoaded = LoadShaderPrograms(shaderSources, programs, 3);
+    programID = programs[0];
+    if (!programsLoaded) {
+        glfw_exit();
+        return -1;
+    }
+
+    if (!batchInit(programs[1])) {
+        glfw_exit();
+        return -1;
+    }
+
+    // The overlay follows the frame budget, --target-ms changes it
+    double targetMs = 16.6;
+    for (int i = 1; i + 1 < argc; i++)
+        if (strcmp(argv[i], "--target-ms") == 0)
+            targetMs = atof(argv[i + 1]);
+    if (!governorInit(programs[2], TheGlWindowSize.width, TheGlWindowSize.height, targetMs)) {
+        glfw_exit();
+        return -1;
+    }
+
+    // Camera frames are copied in here, always at full resolution
+    glGenTextures(1, &backgroundTexture);
+    glBindTexture(GL_TEXTURE_2D, backgroundTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, TheGlWindowSize.width, TheGlWindowSize.height, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                 nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    // Read video, from the camera unless --video FILE is given
+    const char *videoFile = nullptr;
+    for (int i = 1; i + 1 < argc; i++)
+        if (strcmp(argv[i], "--video") == 0)
+            videoFile = argv[i + 1];
+    if (videoFile != nullptr)
+        TheVideoCapturer.open(videoFile);
+    else
+        TheVideoCapturer.open(0);
     if (!TheVideoCapturer.isOpened()) {
         std::cerr << "Could not open video" << std::endl;
         glfw_exit();
     }
 
-    if (loadObjectModels() == -1)
-        glfw_exit();
+    // Marker axis bounds don't depend on the model
+    std::vector<cv::Point3d> axisEnds = {{0, 0, 0}, {TheMarkerSize, 0, 0}, {0, TheMarkerSize, 0}, {0, 0, TheMarkerSize}};
+    computeBounds(axisEnds, AxisBoundingVolume);
+
+    ModelLoading = std::async(std::launch::async, loadObjectModels);
 
-    onKeyboard(window);
+    if (!offscreen)
+        onKeyboard(window);
     //Assign  the function used in events
 //    glutDisplayFunc(displayFunction);
 //    glutIdleFunc(idleFunction);
 
     // Main Loop
-    while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && glfwWindowShouldClose(window) == 0) {
+    bool running = true;
+    while (running) {
+        if (!pollObjectModels()) {
+            glfw_exit();
+            return EXIT_FAILURE;
+        }
+
+        if (offscreen)
+            offscreenBeginFrame();
+
         idleFunction();
         displayFunction();
+
+        if (offscreen)
+            running = offscreenEndFrame();
+        else
+            running = glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && glfwWindowShouldClose(window) == 0;
     }
 
     glfw_exit();
@@ -94,33 +212,134 @@ int main(int argc, char **argv) {
 void glfw_exit(){
     // Cleanup VBO and shader
     glDeleteBuffers(1, &vertexbuffer);
-    glDeleteBuffers(1, &normalbuffer);
     glDeleteBuffers(1, &elementbuffer);
+    glDeleteBuffers(1, &instancebuffer);
     glDeleteProgram(programID);
-    glDeleteTextures(1, &Texture);
     glDeleteVertexArrays(1, &VertexArrayID);
+    glDeleteTextures(1, &backgroundTexture);
+    batchShutdown();
+    governorShutdown();
+
+    // Prints the frame times, needs the context still alive
+    offscreenShutdown();
+    bundleClose();
 
     // Close OpenGL window and terminate GLFW
     glfwTerminate();
 }
 
+/**
+ * @brief Reads the model and its levels of detail. Runs on a worker thread, no GL in here
+ * Fills ModelLods, ModelMesh, ModelBvh, ModelScale and ModelBoundingVolume
+ */
 int loadObjectModels(){
-    // Read our .obj file
-    if (!loadOBJ("skull.obj", vertices, normals))
-        return -1;
+    // Simplified once, later runs read the levels back from skull.lod
+    if (!loadLodChain("skull.obj", ModelLods)) {
+        std::vector<cv::Point3d> vertices;
+        std::vector<cv::Point3d> normals;
+
+        // Read our .obj file
+        if (!loadOBJ("skull.obj", vertices, normals))
+            return -1;
+
+        if (!buildLodChain(vertices, normals, DefaultLodRatios, ModelLods))
+            return -1;
+        storeLodChain("skull.obj", ModelLods);
+    }
+    for (auto &level : ModelLods.levels)
+        printf("Level of detail : %u triangles, %u vertices, error %f\n", level.indexCount / 3, level.vertexCount,
+               level.error);
+
+    // Fit the model on the marker
+    double maxNorm = 0;
+    for (auto &vertex : ModelLods.vertices)
+        maxNorm = std::max(maxNorm, cv::norm(vertex));
+    if (maxNorm > 0)
+        ModelScale = (float) (TheMarkerSize / (2 * maxNorm));
+
+    // Unscaled, the scale is part of each instance's model-view
+    computeBounds(ModelLods.vertices, ModelBoundingVolume);
+
+    // Levels index into ModelMesh.indices the same way they did into the chain's
+    ModelMesh.assign(ModelLods.vertices, ModelLods.normals);
+    ModelMesh.indices.swap(ModelLods.indices);
+    std::vector<cv::Point3d>().swap(ModelLods.vertices);
+    std::vector<cv::Point3d>().swap(ModelLods.normals);
+
+    // Built once like the levels, later runs read it back from skull.bvh
+    const LodLevel &finest = ModelLods.levels[0];
+    if (!loadBvh("skull.obj", ModelMesh, finest.indexOffset, finest.indexCount, ModelBvh)) {
+        buildBvh(ModelMesh, finest.indexOffset, finest.indexCount, ModelBvh);
+        storeBvh("skull.obj", ModelBvh);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Uploads the indexed model to the GPU once. All markers then share these buffers,
+ * only the per instance model-view matrices change from frame to frame
+ */
+int uploadObjectModels(){
+    glGenVertexArrays(1, &VertexArrayID);
+    glBindVertexArray(VertexArrayID);
 
-    indexVBO(vertices, normals, indices, indexed_vertices, indexed_normals, 0.35f);
+    ProjectionMatrixID = glGetUniformLocation(programID, "P");
+    DiffuseColorID = glGetUniformLocation(programID, "MaterialDiffuseColor");
+
+    // The mesh goes up as it sits in memory, one float attribute per coordinate: x, y, z of the position at
+    // locations 0 to 2, of the normal at 7 to 9
+    glGenBuffers(1, &vertexbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+    glBufferData(GL_ARRAY_BUFFER, ModelMesh.byteSize(), ModelMesh.data(), GL_STATIC_DRAW);
+    const GLuint streamLocations[MESH_STREAM_COUNT] = {0, 1, 2, 7, 8, 9};
+    for (int s = 0; s < MESH_STREAM_COUNT; ++s) {
+        glEnableVertexAttribArray(streamLocations[s]);
+        glVertexAttribPointer(streamLocations[s], 1, GL_FLOAT, GL_FALSE, 0,
+                              (void *) ModelMesh.streamOffset((MeshStream) s));
+    }
 
-    // At this point normals and vertices are of no use now
-    vertices.clear();
-    normals.clear();
-    std::cout << indexed_vertices.size() << " number of vertices to display\n";
+    // Index buffer, remembered by the VAO. Every level back to back, they share the vertices
+    glGenBuffers(1, &elementbuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, ModelMesh.indices.size() * sizeof(unsigned int), ModelMesh.indices.data(),
+                 GL_STATIC_DRAW);
+
+    // Instance buffer : a mat4 attribute is 4 vec4 columns, advancing once per instance
+    glGenBuffers(1, &instancebuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(3 + column);
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+                              (void *) (column * 4 * sizeof(GLfloat)));
+        glVertexAttribDivisor(3 + column, 1);
+    }
 
+    glBindVertexArray(0);
+    instanceModelViews.resize(ModelLods.levels.size());
     return 0;
 }
 
+/**
+ * @brief Uploads the model on the GL thread the first time it's called after the loader finished
+ * Cheap to call every frame, it only checks the loader until then
+ * @return false if the model couldn't be loaded or uploaded
+ */
+bool pollObjectModels(){
+    if (ModelReady || ModelLoading.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return true;
+    if (ModelLoading.get() == -1 || uploadObjectModels() == -1)
+        return false;
+    ModelReady = true;
+    return true;
+}
+
 void idleFunction() {
-    TheVideoCapturer.grab();
+    if (!TheVideoCapturer.grab()) {
+        // Video files loop, an offscreen run may want more frames than the clip has
+        TheVideoCapturer.set(cv::CAP_PROP_POS_FRAMES, 0);
+        TheVideoCapturer.grab();
+    }
     TheVideoCapturer.retrieve(TheInputImage);
     TheUndInputImage.create(TheInputImage.size(), CV_8UC3);
 
@@ -143,12 +362,19 @@ void idleFunction() {
 
     // resize the image to the size of the GL window
     cv::resize(TheUndInputImage, TheResizedImage, TheCameraParams.CamSize);
-    glfwPostEmptyEvent();
+    if (!offscreenActive())
+        glfwPostEmptyEvent();
 //    glutPostRedisplay();
 }
 
 void readCameraParams(cv::Mat &camera_matrix, cv::Mat &dist_coeffs, int &width, int &height) {
-    cv::FileStorage fs("calib.yaml", cv::FileStorage::READ);
+    // FileStorage parses from memory too, it needs its own copy of the text though
+    BundleView view;
+    cv::FileStorage fs;
+    if (bundleFind("calib.yaml", view))
+        fs.open(std::string((const char *) view.data, view.size), cv::FileStorage::READ | cv::FileStorage::MEMORY);
+    else
+        fs.open("calib.yaml", cv::FileStorage::READ);
     if (!fs.isOpened()) {
         std::cerr << "Cant open camera calibration file";
         exit(EXIT_FAILURE);
@@ -160,93 +386,220 @@ void readCameraParams(cv::Mat &camera_matrix, cv::Mat &dist_coeffs, int &width,
     fs["image_height"] >> height;
 }
 
+// NOTE Queued in the batch, drawn at the next batchFlush(). Core profile lines are 1px wide.
 void axis(float size) {
-    glLineWidth(2.5);
-    glColor3f(1, 0, 0);
-    glBegin(GL_LINES);
-    glVertex3f(0.0f, 0.0f, 0.0f);  // origin of the line
-    glVertex3f(size, 0.0f, 0.0f);  // ending point of the line
-    glEnd();
-
-    glLineWidth(2.5);
-    glColor3f(0, 1, 0);
-    glBegin(GL_LINES);
-    glVertex3f(0.0f, 0.0f, 0.0f);  // origin of the line
-    glVertex3f(0.0f, size, 0.0f);  // ending point of the line
-    glEnd();
-
-    glLineWidth(2.5);
-    glColor3f(0, 0, 1);
-    glBegin(GL_LINES);
-    glVertex3f(0.0f, 0.0f, 0.0f);  // origin of the line
-    glVertex3f(0.0f, 0.0f, size);  // ending point of the line
-    glEnd();
+    batchBegin(BATCH_LINES);
+
+    batchColor(1, 0, 0);
+    batchVertex(0.0f, 0.0f, 0.0f);  // origin of the line
+    batchVertex(size, 0.0f, 0.0f);  // ending point of the line
+
+    batchColor(0, 1, 0);
+    batchVertex(0.0f, 0.0f, 0.0f);  // origin of the line
+    batchVertex(0.0f, size, 0.0f);  // ending point of the line
+
+    batchColor(0, 0, 1);
+    batchVertex(0.0f, 0.0f, 0.0f);  // origin of the line
+    batchVertex(0.0f, 0.0f, size);  // ending point of the line
+
+    batchEnd();
 }
 
-inline void drawLine(){
-    glLineWidth(2.5);
-    glColor3f(0.0, 0.0, 0.0);
+// NOTE Stands in for the model while it loads: the cube it fits in, centered on the marker
+void placeholderBox(float size) {
+    const float h = size / 2;
+    batchBegin(BATCH_LINES);
+    batchColor(0.7, 0.7, 0.7);
+    for (int i = 0; i < 4; ++i) {
+        // Corner i of a face, counterclockwise, and the next one
+        float x0 = (i == 0 || i == 3) ? -h : h, y0 = (i < 2) ? -h : h;
+        float x1 = (i == 3 || i == 2) ? -h : h, y1 = (i == 0 || i == 3) ? -h : h;
+        batchVertex(x0, y0, -h);  // bottom face edge
+        batchVertex(x1, y1, -h);
+        batchVertex(x0, y0, h);   // top face edge
+        batchVertex(x1, y1, h);
+        batchVertex(x0, y0, -h);  // vertical edge
+        batchVertex(x0, y0, h);
+    }
+    batchEnd();
+}
 
-    glBegin(GL_LINES);
-    glVertex3f(0.0, 0.0, 0.0);
-    glVertex3f(0.1, 0.1, 0.1);
-    glEnd();
+// NOTE Cross on the point picked last, in model space
+void pickMark(const cv::Point3f &point, float size) {
+    batchBegin(BATCH_LINES);
+    batchColor(1, 1, 0);
+    batchVertex(point.x - size, point.y, point.z);
+    batchVertex(point.x + size, point.y, point.z);
+    batchVertex(point.x, point.y - size, point.z);
+    batchVertex(point.x, point.y + size, point.z);
+    batchVertex(point.x, point.y, point.z - size);
+    batchVertex(point.x, point.y, point.z + size);
+    batchEnd();
+}
+
+inline void drawLine(){
+    batchBegin(BATCH_LINES);
+    batchColor(0.0, 0.0, 0.0);
+    batchVertex(0.0, 0.0, 0.0);
+    batchVertex(0.1, 0.1, 0.1);
+    batchEnd();
 }
 
 inline void drawBackground(){
-    // draw image in the buffer
-//
-//
-//    // Give the image to OpenGL
-//    glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, TheGlWindowSize.width, TheGlWindowSize.height, 0, GL_BGR, GL_UNSIGNED_BYTE, TheResizedImage.data);
-//    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-//    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-//    glDisable(GL_DEPTH_TEST);
-//    glMatrixMode(GL_MODELVIEW);
-//    glLoadIdentity();
-//    glMatrixMode(GL_PROJECTION);
-//    glLoadIdentity();
-//    glOrtho(0, TheGlWindowSize.width, 0, TheGlWindowSize.height, -1.0, 1.0);
-//    glViewport(0, 0, TheGlWindowSize.width, TheGlWindowSize.height);
-//    glDisable(GL_TEXTURE_2D);
-//    glPixelZoom(1, -1);
-//    glRasterPos3f(0, TheGlWindowSize.height - 0.5, -1.0);
-//    glDrawPixels(TheGlWindowSize.width, TheGlWindowSize.height, GL_RGB, GL_UNSIGNED_BYTE, TheResizedImage.ptr(0));
+    // Give the image to OpenGL, rows of RGB aren't 4 byte aligned
+    glBindTexture(GL_TEXTURE_2D, backgroundTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TheResizedImage.cols, TheResizedImage.rows, GL_RGB, GL_UNSIGNED_BYTE,
+                    TheResizedImage.data);
+
+    // Whole viewport, the first image row goes on top
+    static const GLfloat identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+    batchTransform(identity);
+    batchTexture(backgroundTexture);
+    batchBegin(BATCH_QUADS);
+    batchColor(1, 1, 1);
+    batchTexCoord(0, 1);
+    batchVertex(-1, -1, 0);
+    batchTexCoord(1, 1);
+    batchVertex(1, -1, 0);
+    batchTexCoord(1, 0);
+    batchVertex(1, 1, 0);
+    batchTexCoord(0, 0);
+    batchVertex(-1, 1, 0);
+    batchEnd();
+    batchTexture(0);
+
+    glDisable(GL_DEPTH_TEST);
+    batchFlush();
+    glEnable(GL_DEPTH_TEST);
 }
 
 inline void drawObjectsOnMarkers(){
 
-    // NOTE I printed the model_view part. It always returned 0. So I removed it
-    // NOTE Also Tvec is of no use(as of now). TheMarker.Tvec.ptr<float>(0)[0]
     // NOTE Direction of Rvec vector is the same with the axis of rotation, magnitude of the vector is angle of rotation
-    // NOTE Parameters of glTranslate hv units = ratio of screen size. So bottom right corner is (1,1,0)
+    // NOTE Tvec is in the units of TheMarkerSize
 
-    for (auto &TheMarker : TheMarkers) {
-
-        // This is the output when i place a marker in image corner -> (x,y)
-        // 159=(9.06273,272.557) (11.8356,34.4309) (248.007,31.5478) (246.059,273.382) Txyz=-999999 ...
+    for (auto &levelModelViews : instanceModelViews)
+        levelModelViews.clear();
+    axisModelViews.clear();
 
-        // Calculate Tvec and Rvec
-        markerPoseTracker.estimatePose(TheMarker, TheCameraParams,TheMarker.size(), 4);
-        float TheMarkerSize = 0.1; // in ratio of screen size
+    GLfloat Projection[16];
+    intrinsicsToProjection(TheCameraParams.CameraMatrix, TheCameraParams.CamSize, zNear, zFar, Projection);
+    float planes[6][4];
+    frustumPlanes(Projection, planes);
 
-        glMatrixMode(GL_PROJECTION);
-        glLoadIdentity();
+    // Focal length in pixels, a model unit at depth z covers focalPixels * ModelScale / z of them
+    const double focalPixels = Projection[0] * TheCameraParams.CamSize.width / 2;
 
-        ratioX = 2*TheMarker.getCenter().x/TheGlWindowSize.width-1;
-        ratioY = 1- 2*TheMarker.getCenter().y/TheGlWindowSize.height; // since y is inverted
+    GLfloat pickModelView[16];
+    bool pickVisible = false;
 
-        glTranslatef(ratioX,ratioY,0);
+    for (auto &TheMarker : TheMarkers) {
 
+        // Calculate Tvec and Rvec
+        if (!markerPoseTracker.estimatePose(TheMarker, TheCameraParams, TheMarkerSize, 4))
+            continue;
 
-        glPushMatrix(); // Can add multiple draw calls b/t Push and Pop
         // TODO Small changes in Rvec shud be ignored
-        glRotated(cv::norm(TheMarker.Rvec)*57.13,TheMarker.Rvec.at<float>(0),-TheMarker.Rvec.at<float>(1),-TheMarker.Rvec.at<float>(2));
-        glColor3f(1, 0.4, 0.4);
-        loadSkull();
+        GLfloat modelView[16], axisModelView[16];
+        poseToModelView(TheMarker.Rvec, TheMarker.Tvec, ModelReady ? ModelScale : 1, modelView);
+        poseToModelView(TheMarker.Rvec, TheMarker.Tvec, 1, axisModelView);
+
+        // Off screen or behind the camera : skip it before anything reaches the instance buffer
+        bool modelVisible = ModelReady && boundsVisible(ModelBoundingVolume, modelView, planes);
+        bool axisVisible = boundsVisible(AxisBoundingVolume, axisModelView, planes);
+        if (!modelVisible && !axisVisible) {
+            markersCulled++;
+            continue;
+        }
+        markersDrawn++;
+
+        if (modelVisible) {
+            // Level picked from the depth of the bounding sphere's center
+            const cv::Point3f &center = ModelBoundingVolume.center;
+            float depth = -(modelView[2] * center.x + modelView[6] * center.y + modelView[10] * center.z + modelView[14]);
+            size_t level = depth > zNear ? selectLod(ModelLods, focalPixels * ModelScale / depth) : 0;
+            instanceModelViews[level].insert(instanceModelViews[level].end(), modelView, modelView + 16);
+
+            if (TheMarker.id == PickedMarker) {
+                std::memcpy(pickModelView, modelView, sizeof(pickModelView));
+                pickVisible = true;
+            }
+        }
+        if (axisVisible)
+            axisModelViews.insert(axisModelViews.end(), axisModelView, axisModelView + 16);
+    }
+
+    // Marker axis, all of them end up in a single line draw
+    for (size_t i = 0; i < axisModelViews.size() / 16; ++i) {
+        batchTransform(Projection, &axisModelViews[16 * i]);
         axis(TheMarkerSize);
-        glPopMatrix();
+        if (!ModelReady)
+            placeholderBox(TheMarkerSize);
+    }
+    if (pickVisible) {
+        batchTransform(Projection, pickModelView);
+        pickMark(PickedPoint, 0.05f * TheMarkerSize / ModelScale);
+    }
+
+    size_t instanceFloats = 0;
+    for (auto &levelModelViews : instanceModelViews)
+        instanceFloats += levelModelViews.size();
+    if (instanceFloats == 0)
+        return;
+
+    glUseProgram(programID);
+    glUniformMatrix4fv(ProjectionMatrixID, 1, GL_FALSE, Projection);
+    glUniform3f(DiffuseColorID, 1, 0.4, 0.4);
+
+    // Orphan the instance buffer before refilling it, so we never wait on the previous frame's draw
+    auto instanceBytes = (GLsizeiptr) (instanceFloats * sizeof(GLfloat));
+    if (instanceBytes > instanceBufferSize)
+        instanceBufferSize = 2 * instanceBytes;
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+    glBufferData(GL_ARRAY_BUFFER, instanceBufferSize, nullptr, GL_STREAM_DRAW);
+
+    // One draw call per level in use, the instance attributes pointed at that level's matrices
+    glBindVertexArray(VertexArrayID);
+    GLintptr instanceOffset = 0;
+    for (size_t i = 0; i < ModelLods.levels.size(); ++i) {
+        const std::vector<GLfloat> &levelModelViews = instanceModelViews[i];
+        if (levelModelViews.empty())
+            continue;
+
+        auto levelBytes = (GLsizeiptr) (levelModelViews.size() * sizeof(GLfloat));
+        glBufferSubData(GL_ARRAY_BUFFER, instanceOffset, levelBytes, levelModelViews.data());
+        for (GLuint column = 0; column < 4; ++column)
+            glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+                                  (void *) (instanceOffset + column * 4 * sizeof(GLfloat)));
+
+        const LodLevel &level = ModelLods.levels[i];
+        glDrawElementsInstanced(GL_TRIANGLES, (GLsizei) level.indexCount, GL_UNSIGNED_INT,
+                                (void *) (level.indexOffset * sizeof(unsigned int)),
+                                (GLsizei) (levelModelViews.size() / 16));
+        instanceOffset += levelBytes;
+    }
+    glBindVertexArray(0);
+}
+
+void reportFrameRate() {
+    static int frames = 0;
+    static auto lastTime = std::chrono::steady_clock::now();
+
+    frames++;
+    auto currentTime = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double, std::milli>(currentTime - lastTime).count();
+    if (elapsed >= 1000) {
+        double gpuMs;
+        float scale;
+        int samples;
+        governorMetrics(gpuMs, scale, samples);
+        printf("%f ms/frame, gpu %.3f ms, overlay at %.0f%% with %dx MSAA, %.1f markers drawn, %.1f culled\n",
+               elapsed / frames, gpuMs, 100 * scale, samples, (double) markersDrawn / frames,
+               (double) markersCulled / frames);
+        frames = 0;
+        markersDrawn = markersCulled = 0;
+        lastTime = currentTime;
     }
 }
 
@@ -255,16 +608,27 @@ void displayFunction() {
     if (TheResizedImage.rows == 0)  // prevent from going on until the image is initialized
         return;
 
+    governorBeginFrame();
+
     // Clear the screen
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Use our shader
-    glUseProgram(programID);
-
     if (TheCaptureFlag) // for debugging purposes
         drawBackground();
+
+    // Virtual content goes through the governor's scaled target
+    governorBeginVirtual();
     drawObjectsOnMarkers();
+    batchFlush();
+    governorEndVirtual();
+    governorComposite();
+
+    governorEndFrame();
+    reportFrameRate();
+
+    if (offscreenActive())
+        return;
 
     // Swap buffers
     glfwSwapBuffers(window);
@@ -280,30 +644,19 @@ int glew_init(){
     // Initialize GLEW
     glewExperimental = GL_TRUE; // Needed for core profile
 
-    if (glewInit() != GLEW_OK) {
+    // glewInit() looks for a window system, an offscreen context has none
+    if ((offscreenActive() ? glewContextInit() : glewInit()) != GLEW_OK) {
         fprintf(stderr, "Failed to initialize GLEW\n");
         getchar();
         return -1;
     }
-}
 
-void loadSkull(){
-    glGenVertexArrays(1, &VertexArrayID);
-    glBindVertexArray(VertexArrayID);
-
-    // Create and compile our GLSL program from the shaders
-    programID = LoadShaders("StandardShading.vertexshader", "StandardShading.fragmentshader");
+    // Enable depth test
+    glEnable(GL_DEPTH_TEST);
+    // Accept fragment if it closer to the camera than the former one
+    glDepthFunc(GL_LESS);
 
-    // Get a handle for our "MVP" uniform
-    auto MatrixID = (GLuint) glGetUniformLocation(programID, "MVP");
-    auto ViewMatrixID = (GLuint) glGetUniformLocation(programID, "V");
-    auto ModelMatrixID = (GLuint) glGetUniformLocation(programID, "M");
-
-    // Load the texture
-    Texture = loadDDS("uvmap.DDS");
-
-    // Get a handle for our "myTextureSampler" uniform
-    auto TextureID = (GLuint) glGetUniformLocation(programID, "myTextureSampler");
+    return 0;
 }
 
 int glfw_init(){
@@ -314,7 +667,8 @@ int glfw_init(){
         return -1;
     }
 
-    glfwWindowHint(GLFW_SAMPLES, 4);
+    // No multisampled window, the overlay target does its own MSAA
+    glfwWindowHint(GLFW_SAMPLES, 0);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
@@ -334,10 +688,57 @@ int glfw_init(){
     // Ensure we can capture the escape key being pressed below
     glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
     glfwSetFramebufferSizeCallback(window, resizeCallback);
+    glfwSetMouseButtonCallback(window, mouseButtonCallback);
 
     return 0;
 }
 
 void resizeCallback(GLFWwindow* window, int width, int height){
     glViewport(0, 0, width, height);
-}0
\ No newline at end of file
+}
+
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods){
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS || !ModelReady)
+        return;
+
+    // The camera image fills the window, whatever size it was given
+    double x, y;
+    int width, height;
+    glfwGetCursorPos(window, &x, &y);
+    glfwGetWindowSize(window, &width, &height);
+    pickModel(cv::Point2f((float) (x * TheCameraParams.CamSize.width / width),
+                          (float) (y * TheCameraParams.CamSize.height / height)));
+}
+
+/**
+ * @brief Finds the model triangle seen at an image pixel, on whichever marker is nearest the camera there
+ * Uses the poses of the last frame drawn
+ * @param pixel Position in the undistorted camera image
+ */
+void pickModel(const cv::Point2f &pixel){
+    auto start = std::chrono::steady_clock::now();
+    PickedMarker = -1;
+    BvhHit nearest{};
+    for (auto &TheMarker : TheMarkers) {
+        if (!TheMarker.isPoseValid())
+            continue;
+
+        // Depth is the ray's parameter in every marker's model space, hits compare directly
+        cv::Point3f origin, direction;
+        pixelRay(TheCameraParams.CameraMatrix, pixel, TheMarker.Rvec, TheMarker.Tvec, ModelScale, origin, direction);
+        BvhHit hit;
+        if (intersectBvh(ModelBvh, origin, direction, hit) && (PickedMarker < 0 || hit.distance < nearest.distance)) {
+            nearest = hit;
+            PickedMarker = TheMarker.id;
+        }
+    }
+    double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    if (PickedMarker < 0) {
+        printf("Nothing at (%.0f, %.0f), %.1f us\n", pixel.x, pixel.y, micros);
+        return;
+    }
+    PickedPoint = nearest.point;
+    printf("Marker %d : triangle %u at (%.3f, %.3f, %.3f), depth %.2f, %.1f us\n", PickedMarker, nearest.triangle,
+           PickedPoint.x, PickedPoint.y, PickedPoint.z, nearest.distance, micros);
+}
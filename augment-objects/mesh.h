@@ -0,0 +1,152 @@
+//
+// Float structure of arrays storage for meshes, shared by the CPU projection and the GL upload
+//
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#ifndef IRON_HELMET_MESH_H
+#define IRON_HELMET_MESH_H
+
+/**
+ * Alignment of every stream of a SoaMesh, one AVX register
+ */
+const size_t MeshAlignment = 32;
+
+/**
+ * Non owning view of `size` contiguous values, `data` aligned to MeshAlignment bytes
+ */
+template<typename T>
+struct AlignedSpan {
+    T *data;
+    size_t size;
+
+    T &operator[](size_t i) const { return data[i]; }
+    T *begin() const { return data; }
+    T *end() const { return data + size; }
+};
+
+/**
+ * The arrays of a SoaMesh, in the order they sit in memory
+ */
+enum MeshStream {
+    MESH_X, MESH_Y, MESH_Z,
+    MESH_NX, MESH_NY, MESH_NZ,
+    MESH_STREAM_COUNT
+};
+
+/**
+ * Indexed mesh with one array per coordinate: x of every vertex, then y, then z, then the normals the same way.
+ * All six share one allocation, each starting on a MeshAlignment boundary and padded to a whole number of
+ * SIMD registers with copies of the last vertex, so kernels can run full registers over the tail.
+ * The allocation goes to the GPU as is: one buffer, a float attribute per stream at streamOffset().
+ */
+template<typename T>
+class SoaMesh {
+public:
+    // Values per SIMD register, each stream is padded to a multiple of it
+    static const size_t Lanes = MeshAlignment / sizeof(T);
+
+    // Triangles, 3 vertex indices each
+    std::vector<unsigned int> indices;
+
+    SoaMesh() : count(0), stride(0), block(nullptr) {}
+
+    /**
+     * @brief Copies positions and normals in, converting them to T
+     * @param vertices Positions
+     * @param normals One per position
+     */
+    template<typename U>
+    void assign(const std::vector<cv::Point3_<U>> &vertices, const std::vector<cv::Point3_<U>> &normals) {
+        resize(vertices.size());
+        for (size_t i = 0; i < count; ++i) {
+            setPosition(i, vertices[i]);
+            setNormal(i, normals[i]);
+        }
+        pad();
+    }
+
+    /**
+     * @brief Makes room for `vertexCount` vertices, the old ones are lost
+     * Fill them with setPosition() and setNormal(), then call pad()
+     */
+    void resize(size_t vertexCount) {
+        count = vertexCount;
+        stride = (vertexCount + Lanes - 1) / Lanes * Lanes;
+        storage.reset(new unsigned char[MESH_STREAM_COUNT * stride * sizeof(T) + MeshAlignment]);
+        auto address = reinterpret_cast<size_t>(storage.get());
+        block = reinterpret_cast<T *>(storage.get() + (MeshAlignment - address % MeshAlignment) % MeshAlignment);
+        std::memset(block, 0, MESH_STREAM_COUNT * stride * sizeof(T));
+    }
+
+    /**
+     * @brief Repeats the last vertex over the padding, so SIMD tails compute something harmless
+     */
+    void pad() {
+        if (count == 0)
+            return;
+        for (int s = 0; s < MESH_STREAM_COUNT; ++s) {
+            T *values = block + s * stride;
+            for (size_t i = count; i < stride; ++i)
+                values[i] = values[count - 1];
+        }
+    }
+
+    void clear() {
+        indices.clear();
+        storage.reset();
+        block = nullptr;
+        count = stride = 0;
+    }
+
+    size_t size() const { return count; }
+
+    // Vertices per stream, padding included
+    size_t paddedSize() const { return stride; }
+
+    AlignedSpan<T> stream(MeshStream s) { return {block + s * stride, count}; }
+    AlignedSpan<const T> stream(MeshStream s) const { return {block + s * stride, count}; }
+
+    AlignedSpan<const T> x() const { return stream(MESH_X); }
+    AlignedSpan<const T> y() const { return stream(MESH_Y); }
+    AlignedSpan<const T> z() const { return stream(MESH_Z); }
+    AlignedSpan<const T> nx() const { return stream(MESH_NX); }
+    AlignedSpan<const T> ny() const { return stream(MESH_NY); }
+    AlignedSpan<const T> nz() const { return stream(MESH_NZ); }
+
+    cv::Point3_<T> position(size_t i) const { return {x()[i], y()[i], z()[i]}; }
+    cv::Point3_<T> normal(size_t i) const { return {nx()[i], ny()[i], nz()[i]}; }
+
+    template<typename U>
+    void setPosition(size_t i, const cv::Point3_<U> &p) {
+        block[MESH_X * stride + i] = (T) p.x;
+        block[MESH_Y * stride + i] = (T) p.y;
+        block[MESH_Z * stride + i] = (T) p.z;
+    }
+
+    template<typename U>
+    void setNormal(size_t i, const cv::Point3_<U> &n) {
+        block[MESH_NX * stride + i] = (T) n.x;
+        block[MESH_NY * stride + i] = (T) n.y;
+        block[MESH_NZ * stride + i] = (T) n.z;
+    }
+
+    // Every stream back to back, ready for glBufferData
+    const T *data() const { return block; }
+    size_t byteSize() const { return MESH_STREAM_COUNT * stride * sizeof(T); }
+
+    // Where a stream starts in data(), in bytes, for glVertexAttribPointer
+    size_t streamOffset(MeshStream s) const { return s * stride * sizeof(T); }
+
+private:
+    size_t count;
+    size_t stride;
+    std::unique_ptr<unsigned char[]> storage;
+    T *block;
+};
+
+
+#endif //IRON_HELMET_MESH_H
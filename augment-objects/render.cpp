@@ -3,142 +3,181 @@
 //
 
 #include <map>
+#include <algorithm>
+#include <cmath>
+#include <opencv2/calib3d.hpp>
 #include "render.h"
+#include "common/bundle.hpp"
+#include "common/objparser.hpp"
 
 bool loadOBJ(const char *path, std::vector<cv::Point3d> &out_vertices, std::vector<cv::Point3d> &out_normals){
-        printf("Loading OBJ file %s...\n", path);
-
-        std::vector<unsigned int> vertexIndices, normalIndices;
-        std::vector<cv::Point3d> temp_vertices;
-        std::vector<cv::Point3d> temp_normals;
+        // Preprocessed by packbundle, the triangle soup only needs widening to doubles
+        uint32_t vertexCount;
+        const float *positions, *uvs, *normals;
+        if (bundleFindMesh(path, vertexCount, positions, uvs, normals)) {
+            for (uint32_t i = 0; i < vertexCount; i++) {
+                out_vertices.emplace_back(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+                out_normals.emplace_back(normals[3 * i], normals[3 * i + 1], normals[3 * i + 2]);
+            }
+            return true;
+        }
 
+        printf("Loading OBJ file %s...\n", path);
 
-        FILE * file = fopen(path, "r");
-        if( file == nullptr ){
-            printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-            getchar();
+        ObjMesh mesh;
+        if (!objParse(path, mesh))
             return false;
-        }
-
-        while( true ){
-
-            char lineHeader[128];
-
-            // read the first word of the line
-            int res = fscanf(file, "%s", lineHeader);
-            if (res == EOF)
-                break; // EOF = End Of File. Quit the loop.
-
-            // else : parse lineHeader
-
-            if ( strcmp( lineHeader, "v" ) == 0 ) {
-                cv::Point3d vertex;
-                fscanf(file, "%lf %lf %lf\n", &vertex.x, &vertex.y, &vertex.z);
-                temp_vertices.push_back(vertex);
-            }else if ( strcmp( lineHeader, "vn" ) == 0 ){
-                cv::Point3d normal;
-                fscanf(file, "%lf %lf %lf\n", &normal.x, &normal.y, &normal.z );
-                temp_normals.push_back(normal);
-            }else if ( strcmp( lineHeader, "f" ) == 0 ){
-                std::string vertex1, vertex2, vertex3;
-                unsigned int vertexIndex[3], normalIndex[3];
-                int matches = fscanf(file, "%d//%d %d//%d %d//%d\n", &vertexIndex[0], &normalIndex[0], &vertexIndex[1], &normalIndex[1], &vertexIndex[2], &normalIndex[2] );
-                if (matches != 6){
-                    printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-                    fclose(file);
-                    return false;
-                }
-                vertexIndices.push_back(temp_vertices.size() + vertexIndex[0]);
-                vertexIndices.push_back(temp_vertices.size() + vertexIndex[1]);
-                vertexIndices.push_back(temp_vertices.size() + vertexIndex[2]);
-                normalIndices.push_back(temp_normals.size() + normalIndex[0]);
-                normalIndices.push_back(temp_normals.size() + normalIndex[1]);
-                normalIndices.push_back(temp_normals.size() + normalIndex[2]);
-            }else{
-                // Probably a comment, eat up the rest of the line
-                char stupidBuffer[1000];
-                fgets(stupidBuffer, 1000, file);
-            }
 
+        for (size_t i = 0; i < mesh.vertexCount(); i++) {
+            const float *position = &mesh.positions[3 * i], *normal = &mesh.normals[3 * i];
+            out_vertices.emplace_back(position[0], position[1], position[2]);
+            out_normals.emplace_back(normal[0], normal[1], normal[2]);
         }
 
-        // For each vertex of each triangle
-        for( unsigned int i=0; i<vertexIndices.size(); i++ ){
+        return true;
+    }
 
-            // Get the indices of its attributes
-            unsigned int vertexIndex = vertexIndices[i];
-            unsigned int normalIndex = normalIndices[i];
+void intrinsicsToProjection(const cv::Mat &camera_matrix, const cv::Size &size, const float zNear, const float zFar,
+                            float out[16]) {
+    cv::Mat K;
+    camera_matrix.convertTo(K, CV_64F);
+
+    const double fx = K.at<double>(0, 0), fy = K.at<double>(1, 1);
+    const double cx = K.at<double>(0, 2), cy = K.at<double>(1, 2);
+
+    // Column major, the image origin is top left while NDC y goes up
+    std::fill(out, out + 16, 0.0f);
+    out[0] = (float) (2 * fx / size.width);
+    out[5] = (float) (2 * fy / size.height);
+    out[8] = (float) (1 - 2 * cx / size.width);
+    out[9] = (float) (2 * cy / size.height - 1);
+    out[10] = (zNear + zFar) / (zNear - zFar);
+    out[11] = -1;
+    out[14] = 2 * zNear * zFar / (zNear - zFar);
+}
 
-            // Get the attributes thanks to the index
-            cv::Point3d vertex = temp_vertices[ vertexIndex]; //vertexIndex-1 ];
-            cv::Point3d normal = temp_normals[ normalIndex]; //normalIndex-1 ];
+void poseToModelView(const cv::Mat &Rvec, const cv::Mat &Tvec, const float scale, float out[16]) {
+    cv::Mat rvec, tvec, R;
+    Rvec.convertTo(rvec, CV_64F);
+    Tvec.convertTo(tvec, CV_64F);
+    cv::Rodrigues(rvec, R);
 
-            // Put the attributes in buffers
-            out_vertices.push_back(vertex);
-            out_normals .push_back(normal);
+    // Rows 1 and 2 flip sign: that's the change of frame, y and z axis point the other way in OpenGL
+    static const double changeCoord[3] = {1, -1, -1};
+
+    for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 3; ++col)
+            out[col * 4 + row] = (float) (changeCoord[row] * R.at<double>(row, col) * scale);
+        out[12 + row] = (float) (changeCoord[row] * tvec.at<double>(row));
+        out[row * 4 + 3] = 0;
+    }
+    out[15] = 1;
+}
 
+void pixelRay(const cv::Mat &camera_matrix, const cv::Point2f &pixel, const cv::Mat &Rvec, const cv::Mat &Tvec,
+              const float scale, cv::Point3f &origin, cv::Point3f &direction) {
+    cv::Mat K, rvec, tvec, R;
+    camera_matrix.convertTo(K, CV_64F);
+    Rvec.convertTo(rvec, CV_64F);
+    Tvec.convertTo(tvec, CV_64F);
+    cv::Rodrigues(rvec, R);
+
+    // Camera space direction with z = 1, so the ray's parameter is the depth
+    const double d[3] = {(pixel.x - K.at<double>(0, 2)) / K.at<double>(0, 0),
+                         (pixel.y - K.at<double>(1, 2)) / K.at<double>(1, 1), 1};
+
+    // camera = R * scale * model + t, so model = R^T (camera - t) / scale
+    double o[3] = {0, 0, 0}, dir[3] = {0, 0, 0};
+    for (int row = 0; row < 3; ++row) {
+        for (int k = 0; k < 3; ++k) {
+            o[row] -= R.at<double>(k, row) * tvec.at<double>(k) / scale;
+            dir[row] += R.at<double>(k, row) * d[k] / scale;
         }
+    }
+    origin = cv::Point3f((float) o[0], (float) o[1], (float) o[2]);
+    direction = cv::Point3f((float) dir[0], (float) dir[1], (float) dir[2]);
+}
 
-        fclose(file);
+void computeBounds(const std::vector<cv::Point3d> &vertices, ModelBounds &out) {
+    out = ModelBounds{};
+    if (vertices.empty())
+        return;
 
-        return true;
+    cv::Point3d lo = vertices[0], hi = vertices[0];
+    for (const cv::Point3d &v : vertices) {
+        lo.x = std::min(lo.x, v.x); hi.x = std::max(hi.x, v.x);
+        lo.y = std::min(lo.y, v.y); hi.y = std::max(hi.y, v.y);
+        lo.z = std::min(lo.z, v.z); hi.z = std::max(hi.z, v.z);
     }
 
-// Searches through all already-exported vertices for a similar one.
-// Similar = same position + same normal
-bool getSimilarVertexIndex(
-        cv::Point3d& in_vertex,
-        cv::Point3d& in_normal,
-        std::vector<cv::Point3d> & out_vertices,
-        std::vector<cv::Point3d> & out_normals,
-        unsigned short & result,
-        const float min_distance
-){
-    // Lame linear search
-    for ( unsigned short i=0; i<out_vertices.size(); i++ ){
-        if (
-                fabs( in_vertex.x - out_vertices[i].x )<min_distance &&
-                fabs( in_vertex.y - out_vertices[i].y )<min_distance &&
-                fabs( in_vertex.z - out_vertices[i].z )<min_distance &&
-                fabs( in_normal.x - out_normals [i].x )<min_distance &&
-                fabs( in_normal.y - out_normals [i].y )<min_distance &&
-                fabs( in_normal.z - out_normals [i].z )<min_distance
-                ){
-            result = i;
-            return true;
+    // Not the smallest sphere, but close enough for models that roughly fill their box
+    cv::Point3d center = (lo + hi) * 0.5;
+    double radius = 0;
+    for (const cv::Point3d &v : vertices)
+        radius = std::max(radius, cv::norm(v - center));
+
+    out.center = cv::Point3f(center);
+    out.radius = (float) radius;
+    out.min = cv::Point3f(lo);
+    out.max = cv::Point3f(hi);
+}
+
+void frustumPlanes(const float projection[16], float planes[6][4]) {
+    // Row i of the column major matrix is m[i], m[4 + i], m[8 + i], m[12 + i]
+    const float *m = projection;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int side = 0; side < 2; ++side) {
+            float sign = side == 0 ? 1.0f : -1.0f;
+            float *plane = planes[2 * axis + side];
+            for (int col = 0; col < 4; ++col)
+                plane[col] = m[4 * col + 3] + sign * m[4 * col + axis];
+
+            float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            for (int col = 0; col < 4; ++col)
+                plane[col] /= length;
         }
     }
-    // No other vertex could be used instead.
-    // Looks like we'll have to add it to the VBO.
-    return false;
 }
 
-/**
- * @brief Reduces the normal, vertices size by removing very closely placed ones
- * @param in_vertices
- * @param in_normals
- * @param out_indices
- * @param out_vertices
- * @param out_normals
- * @param min_distance Min Distance to be maintained b/t points
- */
-void indexVBO(std::vector<cv::Point3d> &in_vertices, std::vector<cv::Point3d> &in_normals,
-              std::vector<unsigned short> &out_indices, std::vector<cv::Point3d> &out_vertices,
-              std::vector<cv::Point3d> &out_normals,const float min_distance) {
-
-    // For each input vertex
-    for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-        // Try to find a similar vertex in out_XXXX
-        unsigned short index;
-        bool found = getSimilarVertexIndex(in_vertices[i], in_normals[i], out_vertices, out_normals, index, min_distance);
-
-        if ( found ) // A similar vertex is already in the VBO, use it instead !
-            out_indices.push_back( index );
-        else{ // If not, it needs to be added in the output data.
-            out_vertices.push_back( in_vertices[i]);
-            out_normals .push_back( in_normals[i]);
-            out_indices .push_back(out_vertices.size() - 1);
-        }
+bool boundsVisible(const ModelBounds &bounds, const float modelView[16], const float planes[6][4]) {
+    const float *m = modelView;
+
+    // Sphere center in eye space, the uniform scale is the length of any basis column
+    const cv::Point3f &c = bounds.center;
+    float center[3];
+    for (int row = 0; row < 3; ++row)
+        center[row] = m[row] * c.x + m[4 + row] * c.y + m[8 + row] * c.z + m[12 + row];
+    float scale = std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+    float radius = bounds.radius * scale;
+
+    bool straddling = false;
+    for (int i = 0; i < 6; ++i) {
+        const float *plane = planes[i];
+        float distance = plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3];
+        if (distance < -radius)
+            return false;
+        if (distance < radius)
+            straddling = true;
+    }
+    if (!straddling)
+        return true;
+
+    // The box in eye space: transformed center, half extents through the absolute rotation
+    cv::Point3f boxCenter = (bounds.min + bounds.max) * 0.5f;
+    cv::Point3f half = (bounds.max - bounds.min) * 0.5f;
+    float eyeCenter[3], eyeHalf[3];
+    for (int row = 0; row < 3; ++row) {
+        eyeCenter[row] = m[row] * boxCenter.x + m[4 + row] * boxCenter.y + m[8 + row] * boxCenter.z + m[12 + row];
+        eyeHalf[row] = std::fabs(m[row]) * half.x + std::fabs(m[4 + row]) * half.y + std::fabs(m[8 + row]) * half.z;
+    }
+
+    for (int i = 0; i < 6; ++i) {
+        const float *plane = planes[i];
+        float distance = plane[0] * eyeCenter[0] + plane[1] * eyeCenter[1] + plane[2] * eyeCenter[2] + plane[3];
+        float reach = std::fabs(plane[0]) * eyeHalf[0] + std::fabs(plane[1]) * eyeHalf[1] +
+                      std::fabs(plane[2]) * eyeHalf[2];
+        if (distance < -reach)
+            return false;
     }
+    return true;
 }
@@ -12,15 +12,75 @@ bool loadOBJ(
         std::vector<cv::Point3d> & out_normals
 );
 
-void indexVBO(
-        std::vector<cv::Point3d> & in_vertices,
-        std::vector<cv::Point3d> & in_normals,
+/**
+ * @brief OpenGL projection matrix (column major) reproducing the pinhole camera `camera_matrix`
+ * @param camera_matrix 3x3 intrinsics, as read from calib.yaml
+ * @param size Image size the intrinsics were calibrated for
+ * @param zNear Near clipping plane distance
+ * @param zFar Far clipping plane distance
+ * @param out 16 floats, ready for glUniformMatrix4fv
+ */
+void intrinsicsToProjection(const cv::Mat &camera_matrix, const cv::Size &size, float zNear, float zFar, float out[16]);
 
-        std::vector<unsigned short> & out_indices,
-        std::vector<cv::Point3d> & out_vertices,
-        std::vector<cv::Point3d> & out_normals,
-        float min_distance
-);
+/**
+ * @brief OpenGL model-view matrix (column major) of a marker pose
+ * Converts from OpenCV's camera frame (y down, z forward) to OpenGL's (y up, z backward)
+ * @param Rvec Rodrigues rotation vector of the marker
+ * @param Tvec Translation of the marker
+ * @param scale Uniform scale applied to the model before the pose
+ * @param out 16 floats, ready for glUniformMatrix4fv or an instance buffer
+ */
+void poseToModelView(const cv::Mat &Rvec, const cv::Mat &Tvec, float scale, float out[16]);
+
+/**
+ * @brief Ray through a pixel of the undistorted image, in the model space of a marker pose
+ * The ray's parameter is the camera space depth: origin + z * direction is the point seen at depth z
+ * @param camera_matrix 3x3 intrinsics
+ * @param pixel Image position
+ * @param Rvec Rodrigues rotation of the marker
+ * @param Tvec Translation of the marker
+ * @param scale Uniform scale of the model, as given to poseToModelView()
+ * @param origin The camera's center
+ * @param direction Toward the pixel
+ */
+void pixelRay(const cv::Mat &camera_matrix, const cv::Point2f &pixel, const cv::Mat &Rvec, const cv::Mat &Tvec,
+              float scale, cv::Point3f &origin, cv::Point3f &direction);
+
+/**
+ * Model space bounding volumes, computed once when the model is loaded
+ */
+struct ModelBounds {
+    cv::Point3f center;  // Bounding sphere
+    float radius;
+    cv::Point3f min;     // Axis aligned box
+    cv::Point3f max;
+};
+
+/**
+ * @brief Bounding sphere and AABB of a vertex set. The sphere is centered on the box, not the origin
+ * @param vertices Model space positions
+ * @param out Bounds, all zero if `vertices` is empty
+ */
+void computeBounds(const std::vector<cv::Point3d> &vertices, ModelBounds &out);
+
+/**
+ * @brief Clipping planes of an OpenGL projection matrix, in eye space
+ * Each plane is (a, b, c, d) with a unit normal pointing into the frustum: a point p is inside when
+ * a*p.x + b*p.y + c*p.z + d >= 0. Order is left, right, bottom, top, near, far.
+ * @param projection Column major, as given by intrinsicsToProjection()
+ * @param planes Output planes
+ */
+void frustumPlanes(const float projection[16], float planes[6][4]);
+
+/**
+ * @brief Whether a model may be visible under a model-view matrix
+ * Tests the bounding sphere first, the AABB only settles the spheres straddling a plane.
+ * Conservative: an object reported visible may still end up clipped away entirely.
+ * @param bounds Model space bounds
+ * @param modelView Column major, rotation times a uniform scale plus translation
+ * @param planes As given by frustumPlanes()
+ */
+bool boundsVisible(const ModelBounds &bounds, const float modelView[16], const float planes[6][4]);
 
 
 #endif //IRON_HELMET_RENDER_H
@@ -1,4 +1,5 @@
-#include <GL/glut.h>
+#include <GL/freeglut.h>
+#include "batch.hpp"
 
 GLfloat xRotated, yRotated, zRotated;
 
@@ -18,45 +19,53 @@ void DrawCube() {
     glRotatef(yRotated, 0.0, 1.0, 0.0);
     // rotation about Z axis
     glRotatef(zRotated, 0.0, 0.0, 1.0);
-    glBegin(GL_QUADS);        // Draw The Cube Using quads
-
-    glColor3f(0.0f, 1.0f, 0.0f);    // Color Blue
-    glVertex3f(1.0f, 1.0f, -1.0f);    // Top Right Of The Quad (Top)
-    glVertex3f(-1.0f, 1.0f, -1.0f);    // Top Left Of The Quad (Top)
-    glVertex3f(-1.0f, 1.0f, 1.0f);    // Bottom Left Of The Quad (Top)
-    glVertex3f(1.0f, 1.0f, 1.0f);    // Bottom Right Of The Quad (Top)
-
-    glColor3f(1.0f, 0.5f, 0.0f);    // Color Orange
-    glVertex3f(1.0f, -1.0f, 1.0f);    // Top Right Of The Quad (Bottom)
-    glVertex3f(-1.0f, -1.0f, 1.0f);    // Top Left Of The Quad (Bottom)
-    glVertex3f(-1.0f, -1.0f, -1.0f);    // Bottom Left Of The Quad (Bottom)
-    glVertex3f(1.0f, -1.0f, -1.0f);    // Bottom Right Of The Quad (Bottom)
-
-    glColor3f(1.0f, 0.0f, 0.0f);    // Color Red
-    glVertex3f(1.0f, 1.0f, 1.0f);    // Top Right Of The Quad (Front)
-    glVertex3f(-1.0f, 1.0f, 1.0f);    // Top Left Of The Quad (Front)
-    glVertex3f(-1.0f, -1.0f, 1.0f);    // Bottom Left Of The Quad (Front)
-    glVertex3f(1.0f, -1.0f, 1.0f);    // Bottom Right Of The Quad (Front)
-
-    glColor3f(1.0f, 1.0f, 0.0f);    // Color Yellow
-    glVertex3f(1.0f, -1.0f, -1.0f);    // Top Right Of The Quad (Back)
-    glVertex3f(-1.0f, -1.0f, -1.0f);    // Top Left Of The Quad (Back)
-    glVertex3f(-1.0f, 1.0f, -1.0f);    // Bottom Left Of The Quad (Back)
-    glVertex3f(1.0f, 1.0f, -1.0f);    // Bottom Right Of The Quad (Back)
-
-    glColor3f(0.0f, 0.0f, 1.0f);    // Color Blue
-    glVertex3f(-1.0f, 1.0f, 1.0f);    // Top Right Of The Quad (Left)
-    glVertex3f(-1.0f, 1.0f, -1.0f);    // Top Left Of The Quad (Left)
-    glVertex3f(-1.0f, -1.0f, -1.0f);    // Bottom Left Of The Quad (Left)
-    glVertex3f(-1.0f, -1.0f, 1.0f);    // Bottom Right Of The Quad (Left)
-
-    glColor3f(1.0f, 0.0f, 1.0f);    // Color Violet
-    glVertex3f(1.0f, 1.0f, -1.0f);    // Top Right Of The Quad (Right)
-    glVertex3f(1.0f, 1.0f, 1.0f);    // Top Left Of The Quad (Right)
-    glVertex3f(1.0f, -1.0f, 1.0f);    // Bottom Left Of The Quad (Right)
-    glVertex3f(1.0f, -1.0f, -1.0f);    // Bottom Right Of The Quad (Right)
-
-    glEnd();            // End Drawing The Cube
+
+    // The batch transforms on the CPU, hand it the fixed function matrices
+    GLfloat projection[16], modelView[16];
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelView);
+    batchTransform(projection, modelView);
+
+    batchBegin(BATCH_QUADS);        // Draw The Cube Using quads
+
+    batchColor(0.0f, 1.0f, 0.0f);    // Color Blue
+    batchVertex(1.0f, 1.0f, -1.0f);    // Top Right Of The Quad (Top)
+    batchVertex(-1.0f, 1.0f, -1.0f);    // Top Left Of The Quad (Top)
+    batchVertex(-1.0f, 1.0f, 1.0f);    // Bottom Left Of The Quad (Top)
+    batchVertex(1.0f, 1.0f, 1.0f);    // Bottom Right Of The Quad (Top)
+
+    batchColor(1.0f, 0.5f, 0.0f);    // Color Orange
+    batchVertex(1.0f, -1.0f, 1.0f);    // Top Right Of The Quad (Bottom)
+    batchVertex(-1.0f, -1.0f, 1.0f);    // Top Left Of The Quad (Bottom)
+    batchVertex(-1.0f, -1.0f, -1.0f);    // Bottom Left Of The Quad (Bottom)
+    batchVertex(1.0f, -1.0f, -1.0f);    // Bottom Right Of The Quad (Bottom)
+
+    batchColor(1.0f, 0.0f, 0.0f);    // Color Red
+    batchVertex(1.0f, 1.0f, 1.0f);    // Top Right Of The Quad (Front)
+    batchVertex(-1.0f, 1.0f, 1.0f);    // Top Left Of The Quad (Front)
+    batchVertex(-1.0f, -1.0f, 1.0f);    // Bottom Left Of The Quad (Front)
+    batchVertex(1.0f, -1.0f, 1.0f);    // Bottom Right Of The Quad (Front)
+
+    batchColor(1.0f, 1.0f, 0.0f);    // Color Yellow
+    batchVertex(1.0f, -1.0f, -1.0f);    // Top Right Of The Quad (Back)
+    batchVertex(-1.0f, -1.0f, -1.0f);    // Top Left Of The Quad (Back)
+    batchVertex(-1.0f, 1.0f, -1.0f);    // Bottom Left Of The Quad (Back)
+    batchVertex(1.0f, 1.0f, -1.0f);    // Bottom Right Of The Quad (Back)
+
+    batchColor(0.0f, 0.0f, 1.0f);    // Color Blue
+    batchVertex(-1.0f, 1.0f, 1.0f);    // Top Right Of The Quad (Left)
+    batchVertex(-1.0f, 1.0f, -1.0f);    // Top Left Of The Quad (Left)
+    batchVertex(-1.0f, -1.0f, -1.0f);    // Bottom Left Of The Quad (Left)
+    batchVertex(-1.0f, -1.0f, 1.0f);    // Bottom Right Of The Quad (Left)
+
+    batchColor(1.0f, 0.0f, 1.0f);    // Color Violet
+    batchVertex(1.0f, 1.0f, -1.0f);    // Top Right Of The Quad (Right)
+    batchVertex(1.0f, 1.0f, 1.0f);    // Top Left Of The Quad (Right)
+    batchVertex(1.0f, -1.0f, 1.0f);    // Bottom Left Of The Quad (Right)
+    batchVertex(1.0f, -1.0f, -1.0f);    // Bottom Right Of The Quad (Right)
+
+    batchEnd();            // End Drawing The Cube
+    batchFlush();          // All 6 faces in one draw call
     glFlush();
 }
 
@@ -88,9 +97,14 @@ int main(int argc, char **argv) {
     glutInit(&argc, argv);
 //we initizlilze the glut. functions
     glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
+    // The batch needs GL 3, fixed function is still used for the matrices
+    glutInitContextVersion(3, 3);
+    glutInitContextProfile(GLUT_COMPATIBILITY_PROFILE);
     glutInitWindowPosition(100, 100);
     glutCreateWindow(argv[0]);
     init();
+    if (!batchInit())
+        return -1;
     glutDisplayFunc(DrawCube);
     glutReshapeFunc(reshape);
 //Set the function for the animation.
@@ -1,5 +1,12 @@
-#include <GL/glut.h>
-#include "models.cpp"
+#include <GL/freeglut.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "models.h"
+#include "offscreen.hpp"
+#include "scene.h"
 
 /*
  * Simple program
@@ -7,23 +14,27 @@
  * With only moon, earth, sun
  *
  * Use Models.cpp for creating more planets
+ *
+ * Run with `--stress N` to add N small bodies orbiting the sun
+ * and `--offscreen FRAMES` to render without a window, see offscreen.hpp
  */
 
 GLfloat rotX, rotY;
 Planet earth,sun, moon;
 
-void displayMilkyWay() {
-
-    glMatrixMode(GL_MODELVIEW);
+// Stress mode asteroids, small bodies orbiting the sun
+std::vector<Planet> asteroids;
 
-    // clear the drawing buffer.
-    glClear(GL_COLOR_BUFFER_BIT);
+Scene scene;
+int camera;
 
-    // clear the identity matrix.
+void updateCamera() {
+    // The root of the scene holds the view, only rebuilt when the mouse moves
+    GLfloat view[16];
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
     glLoadIdentity();
 
-    glEnable( GL_TEXTURE_2D );
-
     // traslate the draw by z = -4.0
     // Note this when you decrease z like -8.0 the drawing will looks far , or smaller.
     glTranslatef(0.0, 0.0, -5);
@@ -31,16 +42,74 @@ void displayMilkyWay() {
     glRotatef(rotX,1,0,0);
     glRotatef(rotY,0,1,0);
 
-    // scaling transfomation
-    glScalef(1.0, 1.0, 1.0);
+    glGetFloatv(GL_MODELVIEW_MATRIX, view);
+    glPopMatrix();
+
+    scene.setLocal(camera, view);
+}
+
+void buildMilkyWay() {
+    camera = scene.addBody(-1, &sun);
 
-    sun.draw();
-    earth.revolveAround(sun,1.3, true);
-    earth.draw();
+    // One revolution per minute, moon goes three times faster
+    int earthNode = scene.addBody(camera, &earth);
+    scene.setOrbit(earthNode, 1.3, 60);
 
+    GLfloat tilt[16];
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
     glRotatef(45,1,1,0);
-    moon.revolveAround(earth,0.5, true);
-    moon.draw();
+    glGetFloatv(GL_MODELVIEW_MATRIX, tilt);
+    glPopMatrix();
+
+    int moonFrame = scene.addNode(earthNode);
+    scene.setLocal(moonFrame, tilt);
+    int moonNode = scene.addBody(moonFrame, &moon);
+    scene.setOrbit(moonNode, 0.5, 20);
+
+    for (const Planet &asteroid : asteroids) {
+        int node = scene.addBody(camera, &asteroid);
+        scene.setOrbit(node, 0.7f + 2.0f * rand() / RAND_MAX, 10.0f + 50.0f * rand() / RAND_MAX,
+                       6.283f * rand() / RAND_MAX, 0.3f * rand() / RAND_MAX - 0.15f, false);
+    }
+
+    updateCamera();
+}
+
+void reportFrameRate(int drawCalls, int worldUpdates) {
+    static int frames = 0;
+    static int lastTime = glutGet(GLUT_ELAPSED_TIME);
+
+    frames++;
+    int currentTime = glutGet(GLUT_ELAPSED_TIME);
+    if (currentTime - lastTime >= 1000) {
+        printf("%f ms/frame, %zu bodies in %d draw calls, %d of %zu world matrices updated\n",
+               double(currentTime - lastTime) / frames, asteroids.size() + 3, drawCalls, worldUpdates, scene.size());
+        frames = 0;
+        lastTime = currentTime;
+    }
+}
+
+void displayMilkyWay() {
+
+    glMatrixMode(GL_MODELVIEW);
+
+    // clear the drawing buffer.
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glEnable( GL_TEXTURE_2D );
+
+    // Orbits are a function of time, not of the number of frames drawn
+    double t = offscreenActive() ? offscreenTime() : glutGet(GLUT_ELAPSED_TIME) / 1000.0;
+    int worldUpdates = scene.update(t);
+
+    scene.drawOrbitRings();
+
+    // Every body, one instanced draw per tessellation level
+    scene.queueBodies();
+    int drawCalls = drawQueuedSpheres();
+    reportFrameRate(drawCalls, worldUpdates);
 
     // Flush buffers to screen
     glFlush();
@@ -59,6 +128,7 @@ void reshapeMilkyWay(int x, int y) {
     //Far clipping plane distance: 20.0
 
     gluPerspective(40.0, (GLdouble) x / (GLdouble) y, 0.5, 20.0);
+    setSphereViewport(y, 40.0);
 
     glViewport(0, 0, x, y);  //Use the whole window for rendering
 }
@@ -70,31 +140,65 @@ void idleMilkyWay() {
 void onMotion(int Mx, int My){
     rotX = Mx;
     rotY = My;
+    updateCamera();
 }
 
 int main(int argc, char **argv) {
-    glutInit(&argc, argv);
-
-    //double buffering used to avoid flickering problem in animation
-    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
-    glutInitWindowSize(450, 450);
-
-    // create the window
-    glutCreateWindow("MilkyWay Rotating Animation");
+    bool offscreen = offscreenRequested(argc, argv);
+    if (offscreen) {
+        // No window, same 3.3 compatibility context
+        if (!offscreenInit(450, 450, false))
+            return -1;
+    } else {
+        glutInit(&argc, argv);
+
+        //double buffering used to avoid flickering problem in animation
+        glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
+        glutInitWindowSize(450, 450);
+        // Instancing needs GL 3.3, fixed function is still used for the matrices and orbits
+        glutInitContextVersion(3, 3);
+        glutInitContextProfile(GLUT_COMPATIBILITY_PROFILE);
+
+        // create the window
+        glutCreateWindow("MilkyWay Rotating Animation");
+    }
+    if (!initSphereRenderer())
+        return -1;
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     glClearColor(0.0, 0.0, 0.0, 0.0);
 
+    // Init planets
+    sun = Planet(0.5,60,0xFCCC43);
+    earth = Planet(0.1,20,0x0022EE);
+    moon = Planet(0.05,10,0xCCCCCC);
+
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--stress") != 0)
+            continue;
+        for (int count = atoi(argv[i + 1]); count > 0; count--) {
+            int grey = 0x66 + rand() % 0x66;
+            asteroids.emplace_back(0.01, 8, grey << 16 | grey << 8 | grey);
+        }
+    }
+
+    buildMilkyWay();
+
+    if (offscreen) {
+        reshapeMilkyWay(450, 450);
+        do {
+            offscreenBeginFrame();
+            displayMilkyWay();
+        } while (offscreenEndFrame());
+        offscreenShutdown();
+        return 0;
+    }
+
     //Assign  the function used in events
     glutDisplayFunc(displayMilkyWay);
     glutReshapeFunc(reshapeMilkyWay);
     glutIdleFunc(idleMilkyWay);
     glutMotionFunc(onMotion);
 
-    // Init planets
-    sun = Planet(0.5,60,0xFCCC43);
-    earth = Planet(0.1,20,0x0022EE);
-    moon = Planet(0.05,10,0xCCCCCC);
-
     //Let start glut loop
     glutMainLoop();
 
@@ -1,74 +1,261 @@
+// No GLEW here, GLUT's context exposes the GL 3 entry points directly
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
-#include <GL/glut.h>
+#include <GL/glext.h>
 #include <cmath>
+#include <cstdio>
+#include <map>
 #include <vector>
-#include <iostream>
+#include "models.h"
 
-//static std::vector<int> colors;
+namespace {
 
-class Planet{
-    int stacks;
-    int slices;
-    int pos;
-    GLfloat radius;
-    GLdouble orbitRadius;
+    // A unit sphere, poles on z like glutSolidSphere
+    struct SphereMesh {
+        GLuint vertexbuffer;
+        GLuint elementbuffer;
+        GLsizei indexCount;
+    };
 
-    GLUquadricObj *quadric; // Create pointer for storage space for object
+    // Per instance : model-view columns, then rgb + radius
+    const int InstanceFloats = 20;
 
-    double colorRGB[3];
+    // Detail levels, in slices and stacks
+    const int Tessellations[] = {8, 16, 32, 64};
 
-    void initColor(int hexValue) {
-//        colors.push_back(hexValue);
+    const char *VertexShaderCode =
+            "#version 130\n"
+            "in vec3 vertexPosition_modelspace;\n"
+            "in vec4 instanceModelView0;\n"
+            "in vec4 instanceModelView1;\n"
+            "in vec4 instanceModelView2;\n"
+            "in vec4 instanceModelView3;\n"
+            "in vec4 instanceColorRadius;\n"
+            "out vec3 fragmentColor;\n"
+            "uniform mat4 P;\n"
+            "void main(){\n"
+            "   mat4 modelView = mat4(instanceModelView0, instanceModelView1, instanceModelView2, instanceModelView3);\n"
+            "   gl_Position = P * modelView * vec4(vertexPosition_modelspace * instanceColorRadius.w, 1);\n"
+            "   fragmentColor = instanceColorRadius.rgb;\n"
+            "}\n";
 
-        colorRGB[0] = ((hexValue >> 16) & 0xFF) / 255.0;  // Extract the RR byte
-        colorRGB[1] = ((hexValue >> 8) & 0xFF) / 255.0;   // Extract the GG byte
-        colorRGB[2] = ((hexValue) & 0xFF) / 255.0;        // Extract the BB byte
-    }
+    const char *FragmentShaderCode =
+            "#version 130\n"
+            "in vec3 fragmentColor;\n"
+            "out vec4 color;\n"
+            "void main(){\n"
+            "   color = vec4(fragmentColor, 1);\n"
+            "}\n";
 
-public:
-    Planet() = default;
+    GLuint programID = 0;
+    GLint ProjectionMatrixID = -1;
+    GLuint VertexArrayID = 0;
+    GLuint instancebuffer = 0;
+    GLsizeiptr instanceBufferSize = 0;
 
-    Planet(GLfloat radius, int vertices, int hexColor){
-        this->radius = radius;
-        this->slices = vertices;
-        this->stacks = vertices;
-        pos = 0;
+    // Meshes are built on first use and kept for the lifetime of the program
+    std::map<int, SphereMesh> sphereCache;
 
-        initColor(hexColor);
+    // Queued instances, bucketed by tessellation
+    std::map<int, std::vector<GLfloat>> queued;
 
-        quadric = gluNewQuadric(); // Create our new quadric object
-        gluQuadricDrawStyle( quadric, GLU_FILL); //FILL also can be line(wire)
-        gluQuadricNormals( quadric, GLU_SMOOTH); // For if lighting is to be used.
-        gluQuadricOrientation( quadric,GLU_OUTSIDE);
-        gluQuadricTexture( quadric, GL_TRUE);// if you want to map a texture to it.
-    }
+    int viewportHeight = 1;
+    GLdouble focalLength = 1; // in pixels
+
+    const SphereMesh &getSphereMesh(int tessellation) {
+        auto it = sphereCache.find(tessellation);
+        if (it != sphereCache.end())
+            return it->second;
+
+        const int slices = tessellation, stacks = tessellation;
+
+        std::vector<GLfloat> vertices;
+        vertices.reserve(3 * (slices + 1) * (stacks + 1));
+        for (int stack = 0; stack <= stacks; stack++) {
+            double phi = M_PI * stack / stacks;
+            for (int slice = 0; slice <= slices; slice++) {
+                double theta = 2 * M_PI * slice / slices;
+                vertices.push_back((GLfloat) (sin(phi) * cos(theta)));
+                vertices.push_back((GLfloat) (sin(phi) * sin(theta)));
+                vertices.push_back((GLfloat) cos(phi));
+            }
+        }
+
+        std::vector<GLushort> indices;
+        indices.reserve(6 * slices * stacks);
+        for (int stack = 0; stack < stacks; stack++)
+            for (int slice = 0; slice < slices; slice++) {
+                auto a = (GLushort) (stack * (slices + 1) + slice);
+                auto b = (GLushort) (a + slices + 1);
+                indices.insert(indices.end(), {a, b, (GLushort) (a + 1), (GLushort) (a + 1), b, (GLushort) (b + 1)});
+            }
+
+        SphereMesh mesh{};
+        glGenBuffers(1, &mesh.vertexbuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexbuffer);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &mesh.elementbuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementbuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+        mesh.indexCount = (GLsizei) indices.size();
 
-    void draw(){
-        glColor3d(colorRGB[0],colorRGB[1],colorRGB[2]);
-        glutSolidSphere(radius,slices,stacks);
+        return sphereCache[tessellation] = mesh;
     }
 
     /**
-     * Makes current planet revolve around the other in an orbit
+     * Picks the coarsest level that still looks round on screen
      *
-     * @param host  The Planet about which current planet revolves
-     * @param OR orbitRadius, In metres
-     * @param drawOrbit Boolean, orbit color is green for all
+     * @param projectedRadius In pixels
+     * @param maxTessellation Never go above the detail the body was created with, rounded up to a level
      */
-    void revolveAround(Planet host, double OR, bool drawOrbit){
-        // Note we translate the axis, not object. Object always drawn at origin
-        // While earth revolves, the frame rotates abt z axis
-        pos = (pos + 1)%36000;
-        orbitRadius = OR;
+    int selectTessellation(double projectedRadius, int maxTessellation) {
+        int chosen = Tessellations[0];
+        for (int tessellation : Tessellations) {
+            chosen = tessellation;
+            if (tessellation >= maxTessellation)
+                break;
+            // About 4 pixels per slice along the silhouette is enough
+            if (2 * M_PI * projectedRadius / tessellation <= 4)
+                break;
+        }
+        return chosen;
+    }
+}
+
+void Planet::initColor(int hexValue) {
+    colorRGB[0] = ((hexValue >> 16) & 0xFF) / 255.0f;  // Extract the RR byte
+    colorRGB[1] = ((hexValue >> 8) & 0xFF) / 255.0f;   // Extract the GG byte
+    colorRGB[2] = ((hexValue) & 0xFF) / 255.0f;        // Extract the BB byte
+}
+
+Planet::Planet(GLfloat radius, int vertices, int hexColor) {
+    this->radius = radius;
+    this->slices = vertices;
+
+    initColor(hexColor);
+}
 
-        if (drawOrbit)
-            sketchOrbit();
+void Planet::draw(const GLfloat modelView[16]) const {
+    // Drawn later with every other body sharing the same tessellation
+    queueSphere(modelView, radius, colorRGB, slices);
+}
 
-        glTranslated(orbitRadius*cos(pos*0.000175), orbitRadius*sin(pos*0.000175), 0);
+bool initSphereRenderer() {
+    GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(VertexShaderID, 1, &VertexShaderCode, nullptr);
+    glCompileShader(VertexShaderID);
+
+    GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(FragmentShaderID, 1, &FragmentShaderCode, nullptr);
+    glCompileShader(FragmentShaderID);
+
+    programID = glCreateProgram();
+    glAttachShader(programID, VertexShaderID);
+    glAttachShader(programID, FragmentShaderID);
+    glBindAttribLocation(programID, 0, "vertexPosition_modelspace");
+    glBindAttribLocation(programID, 1, "instanceModelView0");
+    glBindAttribLocation(programID, 2, "instanceModelView1");
+    glBindAttribLocation(programID, 3, "instanceModelView2");
+    glBindAttribLocation(programID, 4, "instanceModelView3");
+    glBindAttribLocation(programID, 5, "instanceColorRadius");
+    glBindFragDataLocation(programID, 0, "color");
+    glLinkProgram(programID);
+    glDeleteShader(VertexShaderID);
+    glDeleteShader(FragmentShaderID);
+
+    GLint Result = GL_FALSE;
+    glGetProgramiv(programID, GL_LINK_STATUS, &Result);
+    if (Result != GL_TRUE) {
+        char log[1024];
+        glGetProgramInfoLog(programID, sizeof(log), nullptr, log);
+        fprintf(stderr, "Failed to link the sphere program\n%s\n", log);
+        return false;
     }
+    ProjectionMatrixID = glGetUniformLocation(programID, "P");
+
+    glGenVertexArrays(1, &VertexArrayID);
+    glGenBuffers(1, &instancebuffer);
+    return true;
+}
 
-    void sketchOrbit(){
-        glColor3f(0.0, 1.0, 0.0); // orbit color
-        gluDisk(quadric,orbitRadius,orbitRadius+0.01,360,1);
+void setSphereViewport(int height, GLdouble fovy) {
+    viewportHeight = height;
+    focalLength = height / (2 * tan(fovy * M_PI / 360));
+}
+
+void queueSphere(const GLfloat modelView[16], GLfloat radius, const GLfloat colorRGB[3], int maxTessellation) {
+    // Distance to the eye is the length of the translation column
+    double distance = sqrt(modelView[12] * modelView[12] + modelView[13] * modelView[13] + modelView[14] * modelView[14]);
+    double scale = sqrt(modelView[0] * modelView[0] + modelView[1] * modelView[1] + modelView[2] * modelView[2]);
+    double projectedRadius = distance > 0 ? focalLength * radius * scale / distance : viewportHeight;
+
+    std::vector<GLfloat> &instances = queued[selectTessellation(projectedRadius, maxTessellation)];
+    instances.insert(instances.end(), modelView, modelView + 16);
+    instances.insert(instances.end(), colorRGB, colorRGB + 3);
+    instances.push_back(radius);
+}
+
+int drawQueuedSpheres() {
+    // Everything goes in one upload, each level then reads its own slice of it
+    size_t total = 0;
+    for (auto &level : queued)
+        total += level.second.size();
+    if (total == 0)
+        return 0;
+
+    auto bytes = (GLsizeiptr) (total * sizeof(GLfloat));
+    glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+    if (bytes > instanceBufferSize)
+        instanceBufferSize = 2 * bytes;
+    glBufferData(GL_ARRAY_BUFFER, instanceBufferSize, nullptr, GL_STREAM_DRAW);
+
+    GLintptr offset = 0;
+    std::vector<GLintptr> offsets;
+    for (auto &level : queued) {
+        auto levelBytes = (GLsizeiptr) (level.second.size() * sizeof(GLfloat));
+        glBufferSubData(GL_ARRAY_BUFFER, offset, levelBytes, level.second.data());
+        offsets.push_back(offset);
+        offset += levelBytes;
     }
-};
\ No newline at end of file
+
+    GLfloat projection[16];
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+
+    glUseProgram(programID);
+    glUniformMatrix4fv(ProjectionMatrixID, 1, GL_FALSE, projection);
+    glBindVertexArray(VertexArrayID);
+
+    int drawCalls = 0;
+    auto levelOffset = offsets.begin();
+    for (auto &level : queued) {
+        auto instanceCount = (GLsizei) (level.second.size() / InstanceFloats);
+        GLintptr base = *levelOffset++;
+        if (instanceCount == 0)
+            continue;
+
+        const SphereMesh &mesh = getSphereMesh(level.first);
+
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexbuffer);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+        glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+        for (GLuint attribute = 1; attribute <= 5; attribute++) {
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, InstanceFloats * sizeof(GLfloat),
+                                  (void *) (base + (attribute - 1) * 4 * sizeof(GLfloat)));
+            glVertexAttribDivisor(attribute, 1);
+        }
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementbuffer);
+        glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_SHORT, nullptr, instanceCount);
+        drawCalls++;
+
+        level.second.clear();
+    }
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    return drawCalls;
+}
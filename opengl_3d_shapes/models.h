@@ -0,0 +1,35 @@
+#ifndef OPENGL_EXAMPLES_MODELS_H
+#define OPENGL_EXAMPLES_MODELS_H
+
+#include <GL/gl.h>
+
+class Planet{
+    int slices;
+    GLfloat radius;
+
+    GLfloat colorRGB[3];
+
+    void initColor(int hexValue);
+
+public:
+    Planet() = default;
+
+    Planet(GLfloat radius, int vertices, int hexColor);
+
+    // Orbits and placement are handled by the Scene, see scene.h
+    void draw(const GLfloat modelView[16]) const;
+};
+
+/*
+ * Sphere renderer shared by every Planet
+ *
+ * Tessellated spheres are generated once per detail level and cached on the GPU.
+ * Bodies are queued with their model-view, a detail level is picked from their
+ * projected size, and each level is drawn with a single instanced call.
+ */
+bool initSphereRenderer();
+void setSphereViewport(int height, GLdouble fovy);
+void queueSphere(const GLfloat modelView[16], GLfloat radius, const GLfloat colorRGB[3], int maxTessellation);
+int drawQueuedSpheres(); // returns the number of draw calls issued
+
+#endif //OPENGL_EXAMPLES_MODELS_H
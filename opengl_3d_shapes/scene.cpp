@@ -0,0 +1,139 @@
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <algorithm>
+#include <cmath>
+#include "scene.h"
+
+namespace {
+
+    // Vertices of the unit circle drawn for every orbit
+    const int RingVertices = 360;
+    GLuint ringbuffer = 0;
+
+    // out = a * b, column major. out must not alias a or b
+    void multiply(const GLfloat a[16], const GLfloat b[16], GLfloat out[16]) {
+        for (int col = 0; col < 4; col++)
+            for (int row = 0; row < 4; row++)
+                out[col * 4 + row] = a[row] * b[col * 4] + a[4 + row] * b[col * 4 + 1] +
+                                     a[8 + row] * b[col * 4 + 2] + a[12 + row] * b[col * 4 + 3];
+    }
+
+    const Scene::Matrix Identity = {{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}};
+}
+
+int Scene::addNode(int parent) {
+    parents.push_back(parent);
+    localMatrices.push_back(Identity);
+    worldMatrices.push_back(Identity);
+    dirty.push_back(1);
+    return (int) parents.size() - 1;
+}
+
+int Scene::addBody(int parent, const Planet *body) {
+    int node = addNode(parent);
+    if (body != nullptr)
+        bodies.emplace_back(node, body);
+    return node;
+}
+
+void Scene::setLocal(int node, const GLfloat local[16]) {
+    std::copy(local, local + 16, localMatrices[node].m);
+    dirty[node] = 1;
+}
+
+void Scene::setOrbit(int node, GLfloat radius, GLfloat period, GLfloat phase, GLfloat inclination, bool drawRing) {
+    orbits.push_back({node, radius, period != 0 ? GLfloat(2 * M_PI / period) : 0, phase, inclination, drawRing});
+    ringMatrices.push_back(Identity);
+    dirty[node] = 1;
+}
+
+int Scene::update(double t) {
+    // Orbits only move their own node, the pass below takes care of the children
+    for (const Orbit &orbit : orbits) {
+        if (orbit.angularSpeed == 0 && !dirty[orbit.node])
+            continue;
+
+        double angle = orbit.phase + orbit.angularSpeed * t;
+        auto x = GLfloat(orbit.radius * cos(angle)), y = GLfloat(orbit.radius * sin(angle));
+        auto c = GLfloat(cos(orbit.inclination)), s = GLfloat(sin(orbit.inclination));
+
+        // rotateX(inclination) * translate(x, y, 0)
+        GLfloat *m = localMatrices[orbit.node].m;
+        m[0] = 1; m[4] = 0; m[8] = 0;  m[12] = x;
+        m[1] = 0; m[5] = c; m[9] = -s; m[13] = y * c;
+        m[2] = 0; m[6] = s; m[10] = c; m[14] = y * s;
+        m[3] = 0; m[7] = 0; m[11] = 0; m[15] = 1;
+        dirty[orbit.node] = 1;
+    }
+
+    // Parents come first, so one pass in storage order sees every parent up to date
+    int updated = 0;
+    for (size_t i = 0; i < parents.size(); i++) {
+        int parent = parents[i];
+        if (parent >= 0 && dirty[parent])
+            dirty[i] = 1;
+        if (!dirty[i])
+            continue;
+
+        if (parent >= 0)
+            multiply(worldMatrices[parent].m, localMatrices[i].m, worldMatrices[i].m);
+        else
+            worldMatrices[i] = localMatrices[i];
+        updated++;
+    }
+
+    // A ring follows the orbit's parent frame
+    for (size_t i = 0; i < orbits.size(); i++) {
+        const Orbit &orbit = orbits[i];
+        int parent = parents[orbit.node];
+        if (!orbit.drawRing || !dirty[orbit.node])
+            continue;
+
+        auto c = GLfloat(cos(orbit.inclination)), s = GLfloat(sin(orbit.inclination));
+        const Matrix tiltScale = {{orbit.radius, 0, 0, 0,
+                                   0, orbit.radius * c, orbit.radius * s, 0,
+                                   0, -s, c, 0,
+                                   0, 0, 0, 1}};
+        multiply(parent >= 0 ? worldMatrices[parent].m : Identity.m, tiltScale.m, ringMatrices[i].m);
+    }
+
+    std::fill(dirty.begin(), dirty.end(), 0);
+    return updated;
+}
+
+void Scene::queueBodies() const {
+    for (const auto &body : bodies)
+        body.second->draw(worldMatrices[body.first].m);
+}
+
+void Scene::drawOrbitRings() const {
+    if (ringbuffer == 0) {
+        GLfloat circle[2 * RingVertices];
+        for (int i = 0; i < RingVertices; i++) {
+            circle[2 * i] = (GLfloat) cos(2 * M_PI * i / RingVertices);
+            circle[2 * i + 1] = (GLfloat) sin(2 * M_PI * i / RingVertices);
+        }
+        glGenBuffers(1, &ringbuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, ringbuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(circle), circle, GL_STATIC_DRAW);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, ringbuffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, nullptr);
+
+    glColor3f(0.0, 1.0, 0.0); // orbit color
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    for (size_t i = 0; i < orbits.size(); i++) {
+        if (!orbits[i].drawRing)
+            continue;
+        glLoadMatrixf(ringMatrices[i].m);
+        glDrawArrays(GL_LINE_LOOP, 0, RingVertices);
+    }
+    glPopMatrix();
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
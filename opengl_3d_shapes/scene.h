@@ -0,0 +1,77 @@
+#ifndef OPENGL_EXAMPLES_SCENE_H
+#define OPENGL_EXAMPLES_SCENE_H
+
+#include <GL/gl.h>
+#include <cstddef>
+#include <vector>
+#include "models.h"
+
+/*
+ * A flat transform hierarchy
+ *
+ * Nodes live in one array and a parent is always added before its children,
+ * so world matrices are computed in a single forward pass. A node's world
+ * matrix is only recomputed when its local matrix or one of its ancestors
+ * changed since the last update.
+ *
+ * The root's local matrix is the view, which makes every world matrix a
+ * model-view matrix ready to be drawn with.
+ */
+class Scene {
+public:
+    struct Matrix {
+        GLfloat m[16];
+    };
+
+    // Circular orbit in the parent's xy plane, tilted about the parent's x axis
+    struct Orbit {
+        int node;
+        GLfloat radius;
+        GLfloat angularSpeed; // radians per second
+        GLfloat phase;
+        GLfloat inclination;
+        bool drawRing;
+    };
+
+    int addNode(int parent);
+
+    // Body drawn at the node's origin, nullptr for pure transform nodes
+    int addBody(int parent, const Planet *body);
+
+    void setLocal(int node, const GLfloat local[16]);
+
+    void setOrbit(int node, GLfloat radius, GLfloat period, GLfloat phase = 0, GLfloat inclination = 0,
+                  bool drawRing = true);
+
+    const GLfloat *world(int node) const { return worldMatrices[node].m; }
+
+    /**
+     * Places the orbiting nodes at time t and refreshes the world matrices
+     *
+     * @param t In seconds
+     * @return The number of world matrices recomputed
+     */
+    int update(double t);
+
+    // Queues every body for drawQueuedSpheres()
+    void queueBodies() const;
+
+    // Needs a current GL context, the ring is baked on first use
+    void drawOrbitRings() const;
+
+    std::size_t size() const { return parents.size(); }
+
+private:
+    // Hot data for the world pass, one entry per node
+    std::vector<int> parents;
+    std::vector<Matrix> localMatrices;
+    std::vector<Matrix> worldMatrices;
+    std::vector<unsigned char> dirty;
+
+    std::vector<Orbit> orbits;
+    std::vector<Matrix> ringMatrices; // parent world * tilt * scale(radius), one per orbit
+
+    std::vector<std::pair<int, const Planet *>> bodies;
+};
+
+#endif //OPENGL_EXAMPLES_SCENE_H
@@ -0,0 +1,34 @@
+#ifndef MESHNORMALS_HPP
+#define MESHNORMALS_HPP
+
+#include <cstddef>
+
+// Normals and tangents of indexed triangle meshes. Triangles are split into
+// chunks handled side by side, each one adding its share straight into the
+// shared per vertex sums. The sums are 64 bit fixed point updated with atomic
+// adds: no locks, and the same result whichever thread gets there first.
+//
+// objParse() uses the normals for files without vn, indexVBO_TBN() the
+// tangents. They follow the MikkTSpace conventions, so normal maps baked by
+// the usual tools line up:
+//
+//	std::vector<float> tangents(4 * vertexCount);
+//	meshTangents(&indexed_vertices[0].x, &indexed_uvs[0].x, &indexed_normals[0].x, vertexCount,
+//	             indices, indexCount, tangents.data());
+//	// bitangent = tangent.w * cross(normal, tangent.xyz)
+
+// Area weighted vertex normals: every triangle adds its unnormalized face
+// normal to its corners. 3 floats a vertex, unit length, 0 for vertices no
+// triangle uses.
+void meshSmoothNormals(const float *positions, size_t vertexCount, const unsigned int *indices, size_t indexCount,
+                       float *normals);
+
+// Per vertex tangents for normal mapping, 4 floats a vertex: the tangent,
+// orthogonal to the normal, then the handedness of the UV mapping in w (+1 or
+// -1). Each triangle's UV gradient is projected on the corner's normal plane
+// and weighted by the corner's angle. Vertices mirrored across a UV seam
+// need to be separate vertices, as indexVBO() leaves them.
+void meshTangents(const float *positions, const float *uvs, const float *normals, size_t vertexCount,
+                  const unsigned int *indices, size_t indexCount, float *tangents);
+
+#endif
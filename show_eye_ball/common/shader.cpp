@@ -5,104 +5,252 @@
 #include <fstream>
 #include <algorithm>
 #include <sstream>
+#include <chrono>
+#include <sys/stat.h>
 using namespace std;
 
 #include <cstring>
 #include <GL/glew.h>
 #include "shader.hpp"
+#include "bundle.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+namespace {
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+	// Binaries are only valid for the driver that wrote them
+	const char *CacheDirectory = "shadercache";
+	const unsigned int CacheMagic = 0x53484243; // "SHBC"
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
-		return 0;
-	}
+	struct CacheHeader {
+		unsigned int magic;
+		unsigned long long key;
+		GLenum format;
+		GLint length;
+	};
+
+	struct PendingProgram {
+		int index;
+		unsigned long long key;
+		GLuint vertexShader, fragmentShader;
+	};
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
+	bool readFile(const char *path, std::string &out) {
+		BundleView view;
+		if (bundleFind(path, view) && view.kind == BUNDLE_RAW) {
+			out.assign((const char *) view.data, view.size);
+			return true;
+		}
+
+		std::ifstream stream(path, std::ios::in | std::ios::binary);
+		if (!stream.is_open())
+			return false;
 		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+		sstr << stream.rdbuf();
+		out = sstr.str();
+		return true;
 	}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	// FNV-1a, chained so the key covers both sources and the driver
+	unsigned long long hashString(const std::string &text, unsigned long long hash = 14695981039346656037ULL) {
+		for (unsigned char c : text) {
+			hash ^= c;
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
 
+	std::string driverString() {
+		std::string driver;
+		const GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+		for (GLenum name : names) {
+			const GLubyte *value = glGetString(name);
+			if (value != nullptr)
+				driver += (const char *) value;
+			driver += '\n';
+		}
+		return driver;
+	}
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
+	std::string cachePath(unsigned long long key) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s/%016llx.bin", CacheDirectory, key);
+		return name;
+	}
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
+	bool binariesSupported() {
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
 	}
 
+	// Returns 0 if there is no usable binary, a stale one is simply recompiled and overwritten
+	GLuint loadCachedProgram(unsigned long long key) {
+		FILE *file = fopen(cachePath(key).c_str(), "rb");
+		if (file == nullptr)
+			return 0;
 
+		CacheHeader header;
+		std::vector<char> binary;
+		bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == CacheMagic &&
+		             header.key == key && header.length > 0;
+		if (valid) {
+			binary.resize((size_t) header.length);
+			valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+		}
+		fclose(file);
+		if (!valid)
+			return 0;
 
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
+		GLuint ProgramID = glCreateProgram();
+		glProgramBinary(ProgramID, header.format, binary.data(), header.length);
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
+		// A driver update can refuse the binary even though the version string didn't change
+		GLint Result = GL_FALSE;
+		glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+		if (Result != GL_TRUE) {
+			glDeleteProgram(ProgramID);
+			return 0;
+		}
+		return ProgramID;
 	}
 
+	void storeCachedProgram(GLuint ProgramID, unsigned long long key) {
+		CacheHeader header = {CacheMagic, key, 0, 0};
+		glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &header.length);
+		if (header.length <= 0)
+			return;
 
+		std::vector<char> binary((size_t) header.length);
+		glGetProgramBinary(ProgramID, header.length, &header.length, &header.format, binary.data());
 
-	// Link the program
-	printf("Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+		mkdir(CacheDirectory, 0755);
+		FILE *file = fopen(cachePath(key).c_str(), "wb");
+		if (file == nullptr) {
+			fprintf(stderr, "Could not write the shader cache in %s\n", CacheDirectory);
+			return;
+		}
+		fwrite(&header, sizeof(header), 1, file);
+		fwrite(binary.data(), 1, (size_t) header.length, file);
+		fclose(file);
+	}
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
-		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-		printf("%s\n", &ProgramErrorMessage[0]);
+	GLuint createShader(GLenum type, const std::string &code) {
+		GLuint ShaderID = glCreateShader(type);
+		char const *SourcePointer = code.c_str();
+		glShaderSource(ShaderID, 1, &SourcePointer, NULL);
+		glCompileShader(ShaderID);
+		return ShaderID;
 	}
 
-	
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-	
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	// What errors call a shader, its file or the program's name
+	std::string shaderLabel(const ShaderProgramSource &source, bool fragment) {
+		if (source.kind == SHADER_FILES)
+			return fragment ? source.fragment : source.vertex;
+		return std::string(source.name != nullptr ? source.name : "built in") +
+		       (fragment ? " fragment shader" : " vertex shader");
+	}
 
-	return ProgramID;
+	void printShaderLog(GLuint ShaderID, const std::string &label) {
+		GLint Result = GL_FALSE;
+		int InfoLogLength;
+		glGetShaderiv(ShaderID, GL_COMPILE_STATUS, &Result);
+		glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if (Result != GL_TRUE && InfoLogLength > 0) {
+			std::vector<char> ShaderErrorMessage(InfoLogLength + 1);
+			glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+			fprintf(stderr, "%s :\n%s\n", label.c_str(), &ShaderErrorMessage[0]);
+		}
+	}
 }
 
+bool LoadShaderPrograms(const ShaderProgramSource *sources, GLuint *programs, int count) {
+	auto start = std::chrono::steady_clock::now();
+
+	bool useCache = binariesSupported();
+	unsigned long long driverHash = hashString(driverString());
+
+	std::vector<PendingProgram> pending;
+	std::vector<std::string> code(2 * count);
+	int cached = 0;
+	bool ok = true;
 
+	for (int i = 0; i < count; i++) {
+		programs[i] = 0;
+		const ShaderProgramSource &source = sources[i];
+		if (source.kind == SHADER_CODE) {
+			code[2 * i] = source.vertex;
+			code[2 * i + 1] = source.fragment;
+		} else if (!readFile(source.vertex, code[2 * i]) || !readFile(source.fragment, code[2 * i + 1])) {
+			fprintf(stderr, "Impossible to open %s or %s. Are you in the right directory ?\n", source.vertex,
+			        source.fragment);
+			ok = false;
+			continue;
+		}
+
+		unsigned long long key = hashString(code[2 * i + 1], hashString(code[2 * i], driverHash));
+		if (useCache && (programs[i] = loadCachedProgram(key)) != 0) {
+			cached++;
+			continue;
+		}
+		pending.push_back({i, key, 0, 0});
+	}
+
+	if (!pending.empty()) {
+		// Let the driver spread the compiles over all its threads
+		if (GLEW_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+
+		// Issue every compile and link before asking for any result, asking is what waits
+		for (PendingProgram &program : pending) {
+			program.vertexShader = createShader(GL_VERTEX_SHADER, code[2 * program.index]);
+			program.fragmentShader = createShader(GL_FRAGMENT_SHADER, code[2 * program.index + 1]);
+		}
+		for (PendingProgram &program : pending) {
+			GLuint ProgramID = glCreateProgram();
+			glAttachShader(ProgramID, program.vertexShader);
+			glAttachShader(ProgramID, program.fragmentShader);
+			if (useCache)
+				glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			glLinkProgram(ProgramID);
+			programs[program.index] = ProgramID;
+		}
+
+		for (PendingProgram &program : pending) {
+			GLuint ProgramID = programs[program.index];
+			GLint Result = GL_FALSE;
+			glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+			glDetachShader(ProgramID, program.vertexShader);
+			glDetachShader(ProgramID, program.fragmentShader);
+			if (Result != GL_TRUE) {
+				printShaderLog(program.vertexShader, shaderLabel(sources[program.index], false));
+				printShaderLog(program.fragmentShader, shaderLabel(sources[program.index], true));
+
+				int InfoLogLength;
+				glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+				if (InfoLogLength > 0) {
+					std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
+					glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+					fprintf(stderr, "%s\n", &ProgramErrorMessage[0]);
+				}
+				glDeleteProgram(ProgramID);
+				programs[program.index] = 0;
+				ok = false;
+			} else if (useCache) {
+				storeCachedProgram(ProgramID, program.key);
+			}
+
+			glDeleteShader(program.vertexShader);
+			glDeleteShader(program.fragmentShader);
+		}
+	}
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("%d shader programs ready in %.1f ms, %d from the cache\n", count, elapsed, cached);
+	return ok;
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+	const ShaderProgramSource source = {SHADER_FILES, vertex_file_path, fragment_file_path, nullptr};
+	GLuint ProgramID = 0;
+	LoadShaderPrograms(&source, &ProgramID, 1);
+	return ProgramID;
+}
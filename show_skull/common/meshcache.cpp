@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <GL/glew.h>
+
+#include "meshcache.hpp"
+
+namespace {
+
+	const uint32_t MeshCacheMagic = 0x4853454d; // "MESH"
+	const uint32_t MeshCacheVersion = 3; // 2: triangles and vertices reordered by meshorder, 3: vertices stored packed
+	const uint32_t MESH_CACHE_UVS = 1;
+	const size_t MeshCacheAlignment = 64;
+
+	struct MeshCacheHeader {
+		uint32_t magic, version;
+		uint64_t sourceHash;
+		uint32_t vertexCount, indexCount, indexSize, flags;
+		uint32_t vertexFormat, stride; // MeshVertexFormat of the vertices and bytes per vertex
+		float positionScale[3], positionOffset[3];
+		uint64_t vertexOffset, indexOffset;
+	};
+
+	struct MappedFile {
+		void *data = MAP_FAILED;
+		size_t size = 0;
+
+		explicit MappedFile(const char *path) {
+			int fd = open(path, O_RDONLY);
+			if (fd < 0)
+				return;
+			struct stat info;
+			if (fstat(fd, &info) == 0 && info.st_size > 0) {
+				size = (size_t) info.st_size;
+				data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			}
+			close(fd);
+		}
+
+		~MappedFile() {
+			if (data != MAP_FAILED)
+				munmap(data, size);
+		}
+
+		bool valid() const { return data != MAP_FAILED; }
+		const unsigned char *bytes() const { return (const unsigned char *) data; }
+	};
+
+	// skull.obj -> skull.mesh
+	std::string cachePath(const char *objPath) {
+		std::string path = objPath;
+		size_t dot = path.find_last_of('.');
+		if (dot != std::string::npos && path.find('/', dot) == std::string::npos)
+			path.erase(dot);
+		return path + ".mesh";
+	}
+
+	// FNV-1a over the OBJ contents, a word at a time
+	bool sourceHash(const char *objPath, uint64_t &hash) {
+		MappedFile source(objPath);
+		if (!source.valid())
+			return false;
+
+		hash = 14695981039346656037ULL;
+		size_t i = 0;
+		for (; i + 8 <= source.size; i += 8) {
+			uint64_t word;
+			memcpy(&word, source.bytes() + i, sizeof(word));
+			hash = (hash ^ word) * 1099511628211ULL;
+		}
+		for (; i < source.size; i++)
+			hash = (hash ^ source.bytes()[i]) * 1099511628211ULL;
+		hash = (hash ^ source.size) * 1099511628211ULL;
+		return true;
+	}
+
+	size_t alignUp(size_t offset) {
+		return (offset + MeshCacheAlignment - 1) / MeshCacheAlignment * MeshCacheAlignment;
+	}
+
+	bool fits(uint64_t offset, size_t length, size_t fileSize) {
+		return offset % MeshCacheAlignment == 0 && offset <= fileSize && length <= fileSize - offset;
+	}
+
+	const char *const FormatNames[] = {"float", "half", "snorm16"};
+
+	// Round to nearest even, like the GPU's own conversions
+	uint16_t toHalf(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		auto sign = (uint16_t) ((bits >> 16) & 0x8000);
+		uint32_t magnitude = bits & 0x7fffffff;
+		if (magnitude >= 0x47800000) // Out of range, infinity or NaN
+			return sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00);
+		if (magnitude < 0x38800000) { // Subnormal as a half, a multiple of 2^-24 then
+			float absolute;
+			memcpy(&absolute, &magnitude, sizeof(absolute));
+			return sign | (uint16_t) std::nearbyint(absolute * 16777216.0f);
+		}
+		magnitude -= 0x38000000; // Exponent bias 127 -> 15
+		magnitude += 0xfff + ((magnitude >> 13) & 1);
+		return sign | (uint16_t) (magnitude >> 13);
+	}
+
+	// 10 bits a component, w left at 0
+	uint32_t packNormal(const float *normal) {
+		uint32_t packed = 0;
+		for (int i = 0; i < 3; i++) {
+			float component = std::max(-1.0f, std::min(1.0f, normal[i]));
+			packed |= ((uint32_t) std::lround(component * 511.0f) & 0x3ff) << (10 * i);
+		}
+		return packed;
+	}
+
+	// Attribute offsets inside a vertex
+	size_t normalOffset(MeshVertexFormat format) { return format == MESH_VERTEX_FLOAT ? 12 : 8; }
+	size_t uvOffset(MeshVertexFormat format) { return format == MESH_VERTEX_FLOAT ? 24 : 12; }
+
+	GLsizei vertexStride(MeshVertexFormat format, bool hasUVs) {
+		if (format == MESH_VERTEX_FLOAT)
+			return hasUVs ? 32 : 24;
+		return hasUVs ? 16 : 12;
+	}
+
+	// Interleaves and quantizes the arrays, and fills in the layout of buffers to match
+	void packVertices(const MeshData &data, MeshVertexFormat format, MeshBuffers &buffers,
+	                  std::vector<unsigned char> &vertices) {
+		buffers.format = format;
+		buffers.hasUVs = data.uvs != nullptr;
+		buffers.stride = vertexStride(format, buffers.hasUVs);
+
+		// Positions are stored relative to the bounding box, [-1, 1] on every axis for HALF.
+		// SNORM16 keeps the raw integers, the shader's scale divides by 32767 too.
+		float low[3] = {0, 0, 0}, high[3] = {0, 0, 0};
+		for (size_t i = 0; i < data.vertexCount; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				float value = data.positions[3 * i + axis];
+				low[axis] = i == 0 ? value : std::min(low[axis], value);
+				high[axis] = i == 0 ? value : std::max(high[axis], value);
+			}
+		}
+		float extent[3];
+		for (int axis = 0; axis < 3; axis++) {
+			extent[axis] = high[axis] > low[axis] ? (high[axis] - low[axis]) / 2 : 1;
+			bool quantized = format != MESH_VERTEX_FLOAT;
+			buffers.positionOffset[axis] = quantized ? (low[axis] + high[axis]) / 2 : 0;
+			buffers.positionScale[axis] = quantized ? extent[axis] : 1;
+			if (format == MESH_VERTEX_SNORM16)
+				buffers.positionScale[axis] /= 32767;
+		}
+
+		vertices.assign(data.vertexCount * buffers.stride, 0);
+		for (size_t i = 0; i < data.vertexCount; i++) {
+			unsigned char *vertex = &vertices[i * buffers.stride];
+			const float *position = data.positions + 3 * i, *normal = data.normals + 3 * i;
+			const float *uv = buffers.hasUVs ? data.uvs + 2 * i : nullptr;
+
+			if (format == MESH_VERTEX_FLOAT) {
+				memcpy(vertex, position, 3 * sizeof(float));
+				memcpy(vertex + normalOffset(format), normal, 3 * sizeof(float));
+				if (uv != nullptr)
+					memcpy(vertex + uvOffset(format), uv, 2 * sizeof(float));
+				continue;
+			}
+
+			// 4 components, the last one pads to 8 bytes
+			uint16_t packed[4] = {0, 0, 0, 0};
+			for (int axis = 0; axis < 3; axis++) {
+				float unit = (position[axis] - buffers.positionOffset[axis]) / extent[axis];
+				unit = std::max(-1.0f, std::min(1.0f, unit));
+				packed[axis] = format == MESH_VERTEX_HALF ? toHalf(unit) : (uint16_t) (int16_t) std::lround(unit * 32767);
+			}
+			memcpy(vertex, packed, sizeof(packed));
+
+			uint32_t packedNormal = packNormal(normal);
+			memcpy(vertex + normalOffset(format), &packedNormal, sizeof(packedNormal));
+			if (uv != nullptr) {
+				uint16_t packedUV[2] = {toHalf(uv[0]), toHalf(uv[1])};
+				memcpy(vertex + uvOffset(format), packedUV, sizeof(packedUV));
+			}
+		}
+	}
+
+	// Vertices already in the layout buffers describes
+	void upload(MeshBuffers &buffers, const void *vertices, size_t vertexCount, const void *indices, size_t indexCount,
+	            unsigned int indexSize) {
+		glGenBuffers(1, &buffers.vertexbuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexbuffer);
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * buffers.stride, vertices, GL_STATIC_DRAW);
+
+		glGenBuffers(1, &buffers.elementbuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.elementbuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * indexSize, indices, GL_STATIC_DRAW);
+
+		buffers.indexCount = (GLsizei) indexCount;
+		buffers.indexType = indexSize == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+
+		// Against one float buffer per attribute
+		size_t unpacked = vertexStride(MESH_VERTEX_FLOAT, buffers.hasUVs);
+		printf("%zu vertices as %s, %d bytes each instead of %zu, %.1f KB saved\n", vertexCount,
+		       FormatNames[buffers.format], buffers.stride, unpacked, (unpacked - buffers.stride) * vertexCount / 1024.0);
+	}
+}
+
+MeshVertexFormat meshVertexFormatRequested(int argc, char **argv) {
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--vertex-format") != 0)
+			continue;
+		for (int format = MESH_VERTEX_FLOAT; format <= MESH_VERTEX_SNORM16; format++)
+			if (strcmp(argv[i + 1], FormatNames[format]) == 0)
+				return (MeshVertexFormat) format;
+		printf("Unknown vertex format %s, using snorm16\n", argv[i + 1]);
+	}
+	return MESH_VERTEX_SNORM16;
+}
+
+bool meshCacheLoad(const char *objPath, bool withUVs, MeshVertexFormat format, MeshBuffers &buffers) {
+	auto start = std::chrono::steady_clock::now();
+
+	std::string path = cachePath(objPath);
+	MappedFile cache(path.c_str());
+	if (!cache.valid() || cache.size < sizeof(MeshCacheHeader))
+		return false;
+
+	auto *header = (const MeshCacheHeader *) cache.data;
+	if (header->magic != MeshCacheMagic || header->version != MeshCacheVersion ||
+	    (header->indexSize != 2 && header->indexSize != 4) || (withUVs && !(header->flags & MESH_CACHE_UVS)))
+		return false;
+
+	if (header->vertexFormat != (uint32_t) format) {
+		const char *stored = header->vertexFormat <= MESH_VERTEX_SNORM16 ? FormatNames[header->vertexFormat] : "unknown";
+		printf("%s holds %s vertices, rebuilding it as %s\n", path.c_str(), stored, FormatNames[format]);
+		return false;
+	}
+
+	size_t vertexCount = header->vertexCount, indexCount = header->indexCount;
+	bool hasUVs = (header->flags & MESH_CACHE_UVS) != 0;
+	if (header->stride != (uint32_t) vertexStride(format, hasUVs) ||
+	    !fits(header->vertexOffset, vertexCount * header->stride, cache.size) ||
+	    !fits(header->indexOffset, indexCount * header->indexSize, cache.size)) {
+		printf("%s is damaged, rebuilding it\n", path.c_str());
+		return false;
+	}
+
+	// Without the OBJ around, as in a build that only ships the caches, the cache is all there is
+	uint64_t hash;
+	if (sourceHash(objPath, hash) && hash != header->sourceHash) {
+		printf("%s changed, rebuilding %s\n", objPath, path.c_str());
+		return false;
+	}
+
+	buffers.format = format;
+	buffers.hasUVs = hasUVs;
+	buffers.stride = (GLsizei) header->stride;
+	memcpy(buffers.positionScale, header->positionScale, sizeof(buffers.positionScale));
+	memcpy(buffers.positionOffset, header->positionOffset, sizeof(buffers.positionOffset));
+
+	// Straight from the mapping to the driver
+	madvise(cache.data, cache.size, MADV_WILLNEED);
+	upload(buffers, cache.bytes() + header->vertexOffset, vertexCount, cache.bytes() + header->indexOffset, indexCount,
+	       header->indexSize);
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("Loaded %s from %s, %zu vertices and %zu indices in %.1f ms\n", objPath, path.c_str(), vertexCount,
+	       indexCount, elapsed);
+	return true;
+}
+
+bool meshCacheStore(const char *objPath, const MeshData &data, MeshVertexFormat format, MeshBuffers &buffers) {
+	std::vector<unsigned char> vertices;
+	packVertices(data, format, buffers, vertices);
+	upload(buffers, vertices.data(), data.vertexCount, data.indices, data.indexCount, data.indexSize);
+
+	MeshCacheHeader header{};
+	if (!sourceHash(objPath, header.sourceHash))
+		return false;
+
+	header.magic = MeshCacheMagic;
+	header.version = MeshCacheVersion;
+	header.vertexCount = (uint32_t) data.vertexCount;
+	header.indexCount = (uint32_t) data.indexCount;
+	header.indexSize = data.indexSize;
+	header.flags = buffers.hasUVs ? MESH_CACHE_UVS : 0;
+	header.vertexFormat = (uint32_t) format;
+	header.stride = (uint32_t) buffers.stride;
+	memcpy(header.positionScale, buffers.positionScale, sizeof(header.positionScale));
+	memcpy(header.positionOffset, buffers.positionOffset, sizeof(header.positionOffset));
+
+	const size_t indexSize = data.indexCount * data.indexSize;
+	header.vertexOffset = alignUp(sizeof(header));
+	header.indexOffset = alignUp(header.vertexOffset + vertices.size());
+
+	std::string path = cachePath(objPath);
+	FILE *file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		printf("Could not write the mesh cache %s\n", path.c_str());
+		return false;
+	}
+
+	// Zero padding up to each array's offset
+	static const char padding[MeshCacheAlignment] = {};
+	auto writeAt = [file](uint64_t offset, const void *bytes, size_t size) {
+		long position = ftell(file);
+		return position >= 0 && fwrite(padding, 1, offset - (uint64_t) position, file) == offset - (uint64_t) position &&
+		       fwrite(bytes, 1, size, file) == size;
+	};
+	bool written = writeAt(0, &header, sizeof(header)) &&
+	               writeAt(header.vertexOffset, vertices.data(), vertices.size()) &&
+	               writeAt(header.indexOffset, data.indices, indexSize);
+	written &= fclose(file) == 0;
+	if (!written) {
+		printf("Could not write the mesh cache %s\n", path.c_str());
+		remove(path.c_str());
+	}
+	return written;
+}
+
+void meshSetDequantization(const MeshBuffers &buffers, GLuint programID) {
+	glUseProgram(programID);
+	glUniform3fv(glGetUniformLocation(programID, "PositionScale"), 1, buffers.positionScale);
+	glUniform3fv(glGetUniformLocation(programID, "PositionOffset"), 1, buffers.positionOffset);
+}
+
+void meshBind(const MeshBuffers &buffers) {
+	glBindBuffer(GL_ARRAY_BUFFER, buffers.vertexbuffer);
+	bool packed = buffers.format != MESH_VERTEX_FLOAT;
+
+	// Shorts go in as plain integers, the shader applies the scale
+	glEnableVertexAttribArray(0);
+	GLenum positionType = buffers.format == MESH_VERTEX_SNORM16 ? GL_SHORT
+	                    : buffers.format == MESH_VERTEX_HALF ? GL_HALF_FLOAT : GL_FLOAT;
+	glVertexAttribPointer(0, 3, positionType, GL_FALSE, buffers.stride, nullptr);
+
+	if (buffers.hasUVs) {
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, packed ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, buffers.stride,
+		                      (void *) uvOffset(buffers.format));
+	}
+
+	glEnableVertexAttribArray(2);
+	if (packed)
+		glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, buffers.stride, (void *) normalOffset(buffers.format));
+	else
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, buffers.stride, (void *) normalOffset(buffers.format));
+}
+
+void meshRelease(MeshBuffers &buffers) {
+	GLuint names[] = {buffers.vertexbuffer, buffers.elementbuffer};
+	glDeleteBuffers(2, names);
+	buffers = MeshBuffers();
+}
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include <glm.hpp>
+
+#include "vboindexer.hpp"
+#include "meshorder.hpp"
+
+namespace {
+
+	// Size the FIFO simulation assumes, about what current GPUs keep per batch
+	const unsigned int FifoSize = 16;
+
+	// Forsyth's scoring model, an LRU cache of this size with his published constants
+	const int ModelCacheSize = 32;
+	const float CacheDecayPower = 1.5f;
+	const float LastTriangleScore = 0.75f;
+	const float ValenceBoostScale = 2.0f;
+	const float ValenceBoostPower = 0.5f;
+
+	// A cluster is cut off once its own ACMR is within this factor of the whole run's
+	const float OverdrawThreshold = 1.05f;
+
+	std::vector<unsigned int> expand(const VertexIndices & indices){
+		if (!indices.wide.empty())
+			return indices.wide;
+		return std::vector<unsigned int>(indices.narrow.begin(), indices.narrow.end());
+	}
+
+	// Back into the width the indices came in
+	void store(const std::vector<unsigned int> & source, VertexIndices & indices){
+		if (!indices.wide.empty())
+			indices.wide = source;
+		else
+			indices.narrow.assign(source.begin(), source.end());
+	}
+
+	// FIFO simulation by timestamps: a vertex is cached if it went in during the last FifoSize misses
+	struct FifoCache{
+		std::vector<unsigned int> stamps;
+		unsigned int time;
+
+		explicit FifoCache(size_t vertexCount) : stamps(vertexCount, 0), time(FifoSize + 1) {}
+
+		unsigned int access(unsigned int vertex){
+			if (time - stamps[vertex] <= FifoSize)
+				return 0;
+			stamps[vertex] = time++;
+			return 1;
+		}
+
+		unsigned int triangle(const unsigned int * corners){
+			return access(corners[0]) + access(corners[1]) + access(corners[2]);
+		}
+
+		void flush(){
+			time += FifoSize + 1;
+		}
+	};
+
+	float vertexScore(int cachePosition, unsigned int remaining){
+		if (remaining == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0){
+			if (cachePosition < 3)
+				score = LastTriangleScore; // Used by the last triangle, no bonus for using it again
+			else
+				score = std::pow(1.0f - float(cachePosition - 3) / (ModelCacheSize - 3), CacheDecayPower);
+		}
+		// Vertices with few triangles left get them out of the way
+		return score + ValenceBoostScale * std::pow(float(remaining), -ValenceBoostPower);
+	}
+
+	void optimizeVertexCache(std::vector<unsigned int> & indices, size_t vertexCount){
+		size_t triangleCount = indices.size() / 3;
+
+		// Triangles of each vertex, the live ones first in each range
+		std::vector<unsigned int> offsets(vertexCount + 1, 0), remaining(vertexCount, 0);
+		for (unsigned int index : indices)
+			remaining[index]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] = offsets[v] + remaining[v];
+		std::vector<unsigned int> triangles(indices.size()), fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			triangles[fill[indices[i]]++] = (unsigned int) (i / 3);
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> scores(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+			scores[v] = vertexScore(-1, remaining[v]);
+
+		// Start from the best scoring triangle
+		std::vector<char> emitted(triangleCount, 0);
+		long best = -1;
+		float bestScore = -1.0f;
+		for (size_t t = 0; t < triangleCount; t++){
+			float score = scores[indices[3 * t]] + scores[indices[3 * t + 1]] + scores[indices[3 * t + 2]];
+			if (score > bestScore){
+				bestScore = score;
+				best = (long) t;
+			}
+		}
+
+		std::vector<unsigned int> cache, newCache, result;
+		result.reserve(indices.size());
+		size_t cursor = 0;
+
+		while (result.size() < indices.size()){
+			// Nothing left around the cache, carry on from the first triangle not drawn yet
+			if (best < 0){
+				while (emitted[cursor])
+					cursor++;
+				best = (long) cursor;
+			}
+
+			const unsigned int * corners = &indices[3 * best];
+			result.insert(result.end(), corners, corners + 3);
+			emitted[best] = 1;
+
+			// Take the triangle out of its vertices' live ranges
+			for (int c = 0; c < 3; c++){
+				unsigned int v = corners[c];
+				unsigned int * begin = &triangles[offsets[v]], * end = begin + remaining[v];
+				std::iter_swap(std::find(begin, end, (unsigned int) best), end - 1);
+				remaining[v]--;
+			}
+
+			// Its vertices move to the front of the cache, the rest shift back
+			newCache.assign(corners, corners + 3);
+			for (unsigned int v : cache)
+				if (v != corners[0] && v != corners[1] && v != corners[2])
+					newCache.push_back(v);
+			cache.swap(newCache);
+
+			for (size_t i = 0; i < cache.size(); i++){
+				unsigned int v = cache[i];
+				cachePosition[v] = i < (size_t) ModelCacheSize ? (int) i : -1;
+				scores[v] = vertexScore(cachePosition[v], remaining[v]);
+			}
+
+			// The best triangle around the cache is next
+			best = -1;
+			bestScore = -1.0f;
+			for (unsigned int v : cache){
+				for (unsigned int k = 0; k < remaining[v]; k++){
+					unsigned int t = triangles[offsets[v] + k];
+					float score = scores[indices[3 * t]] + scores[indices[3 * t + 1]] + scores[indices[3 * t + 2]];
+					if (score > bestScore){
+						bestScore = score;
+						best = t;
+					}
+				}
+			}
+			if (cache.size() > (size_t) ModelCacheSize)
+				cache.resize(ModelCacheSize);
+		}
+		indices.swap(result);
+	}
+
+	// Sander, Nehab and Barczak's linear-speed overdraw pass over a cache optimized order
+	void optimizeOverdraw(std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices){
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		// Hard boundaries: the cache optimizer jumped somewhere new, every vertex missed
+		std::vector<size_t> hard;
+		FifoCache cache(vertices.size());
+		for (size_t t = 0; t < triangleCount; t++)
+			if (cache.triangle(&indices[3 * t]) == 3)
+				hard.push_back(t);
+		if (hard.empty() || hard[0] != 0)
+			hard.insert(hard.begin(), 0);
+		hard.push_back(triangleCount);
+
+		// Soft boundaries inside each: restarting costs a full cache reload, so cut only
+		// where the cluster so far is already as cache efficient as the whole run
+		std::vector<size_t> clusters;
+		for (size_t h = 0; h + 1 < hard.size(); h++){
+			size_t start = hard[h], end = hard[h + 1];
+			cache.flush();
+			unsigned int runMisses = 0;
+			for (size_t t = start; t < end; t++)
+				runMisses += cache.triangle(&indices[3 * t]);
+			float threshold = OverdrawThreshold * runMisses / float(end - start);
+
+			cache.flush();
+			clusters.push_back(start);
+			unsigned int misses = 0;
+			for (size_t t = start; t < end; t++){
+				misses += cache.triangle(&indices[3 * t]);
+				size_t count = t + 1 - clusters.back();
+				if (t + 1 < end && misses <= threshold * count){
+					clusters.push_back(t + 1);
+					cache.flush();
+					misses = 0;
+				}
+			}
+		}
+		clusters.push_back(triangleCount);
+
+		// Clusters facing away from the mesh centre go first, they are the likely occluders
+		glm::vec3 meshCentre(0.0f);
+		float meshArea = 0.0f;
+		std::vector<glm::vec3> centres, normals;
+		for (size_t c = 0; c + 1 < clusters.size(); c++){
+			glm::vec3 centre(0.0f), normal(0.0f);
+			float area = 0.0f;
+			for (size_t t = clusters[c]; t < clusters[c + 1]; t++){
+				const glm::vec3 & a = vertices[indices[3 * t]], & b = vertices[indices[3 * t + 1]],
+				                & d = vertices[indices[3 * t + 2]];
+				glm::vec3 n = glm::cross(b - a, d - a);
+				float triangleArea = glm::length(n);
+				centre += (a + b + d) * (triangleArea / 3.0f);
+				normal += n;
+				area += triangleArea;
+			}
+			meshCentre += centre;
+			meshArea += area;
+			centres.push_back(area > 0.0f ? centre / area : vertices[indices[3 * clusters[c]]]);
+			normals.push_back(normal);
+		}
+		if (meshArea > 0.0f)
+			meshCentre /= meshArea;
+
+		std::vector<float> keys(centres.size());
+		std::vector<size_t> order(centres.size());
+		for (size_t c = 0; c < centres.size(); c++){
+			float length = glm::length(normals[c]);
+			keys[c] = length > 0.0f ? glm::dot(centres[c] - meshCentre, normals[c] / length) : 0.0f;
+			order[c] = c;
+		}
+		std::stable_sort(order.begin(), order.end(), [&keys](size_t a, size_t b){ return keys[a] > keys[b]; });
+
+		std::vector<unsigned int> result;
+		result.reserve(indices.size());
+		for (size_t c : order)
+			result.insert(result.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * clusters[c + 1]);
+		indices.swap(result);
+	}
+
+	template<typename T>
+	void permute(std::vector<T> & attribute, const std::vector<unsigned int> & remap){
+		std::vector<T> result(attribute.size());
+		for (size_t v = 0; v < attribute.size(); v++)
+			result[remap[v]] = attribute[v];
+		attribute.swap(result);
+	}
+
+	// New vertex numbers in order of first use, unused vertices last
+	std::vector<unsigned int> fetchOrder(std::vector<unsigned int> & indices, size_t vertexCount){
+		const unsigned int Unused = 0xffffffffu;
+		std::vector<unsigned int> remap(vertexCount, Unused);
+		unsigned int next = 0;
+		for (unsigned int & index : indices){
+			if (remap[index] == Unused)
+				remap[index] = next++;
+			index = remap[index];
+		}
+		for (unsigned int & slot : remap)
+			if (slot == Unused)
+				slot = next++;
+		return remap;
+	}
+
+	VertexCacheStats analyze(const std::vector<unsigned int> & indices, size_t vertexCount){
+		FifoCache cache(vertexCount);
+		unsigned int misses = 0;
+		for (unsigned int index : indices)
+			misses += cache.access(index);
+
+		VertexCacheStats stats;
+		stats.acmr = indices.empty() ? 0.0f : misses / float(indices.size() / 3);
+		stats.atvr = vertexCount == 0 ? 0.0f : misses / float(vertexCount);
+		return stats;
+	}
+}
+
+VertexCacheStats analyzeVertexCache(const VertexIndices & indices, size_t vertexCount){
+	return analyze(expand(indices), vertexCount);
+}
+
+void optimizeMeshOrder(
+	const char * name,
+	VertexIndices & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> * uvs,
+	std::vector<glm::vec3> & normals
+){
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<unsigned int> order = expand(indices);
+	VertexCacheStats before = analyze(order, vertices.size());
+
+	optimizeVertexCache(order, vertices.size());
+	optimizeOverdraw(order, vertices);
+
+	std::vector<unsigned int> remap = fetchOrder(order, vertices.size());
+	permute(vertices, remap);
+	permute(normals, remap);
+	if (uvs != nullptr)
+		permute(*uvs, remap);
+
+	VertexCacheStats after = analyze(order, vertices.size());
+	store(order, indices);
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("%s: %zu triangles reordered in %.1f ms, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name, order.size() / 3,
+	       elapsed, before.acmr, after.acmr, before.atvr, after.atvr);
+}
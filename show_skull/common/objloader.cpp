@@ -6,6 +6,8 @@
 #include <glm.hpp>
 
 #include "objloader.hpp"
+#include "bundle.hpp"
+#include "objparser.hpp"
 
 // Very, VERY simple OBJ loader.
 // Here is a short list of features a real function would provide : 
@@ -21,80 +23,25 @@ bool loadOBJ(
 	std::vector<glm::vec3> & out_vertices, 
 	std::vector<glm::vec3> & out_normals
 ){
-	printf("Loading OBJ file %s...\n", path);
-
-	std::vector<unsigned int> vertexIndices, normalIndices;
-	std::vector<glm::vec3> temp_vertices; 
-	std::vector<glm::vec3> temp_normals;
-
-
-	FILE * file = fopen(path, "r");
-	if( file == nullptr ){
-		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-		getchar();
-		return false;
+	// Preprocessed by packbundle, the triangle soup only needs copying
+	uint32_t vertexCount;
+	const float *positions, *uvs, *normals;
+	if (bundleFindMesh(path, vertexCount, positions, uvs, normals)){
+		out_vertices.assign((const glm::vec3 *) positions, (const glm::vec3 *) positions + vertexCount);
+		out_normals.assign((const glm::vec3 *) normals, (const glm::vec3 *) normals + vertexCount);
+		return true;
 	}
 
-	while( true ){
-
-		char lineHeader[128];
-
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
-
-		// else : parse lineHeader
-		
-		if ( strcmp( lineHeader, "v" ) == 0 ) {
-			glm::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
-			temp_vertices.push_back(vertex);
-		}else if ( strcmp( lineHeader, "vn" ) == 0 ){
-			glm::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-			temp_normals.push_back(normal);
-		}else if ( strcmp( lineHeader, "f" ) == 0 ){
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d//%d %d//%d %d//%d\n", &vertexIndex[0], &normalIndex[0], &vertexIndex[1], &normalIndex[1], &vertexIndex[2], &normalIndex[2] );
-			if (matches != 6){
-				printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-				fclose(file);
-				return false;
-			}
-			vertexIndices.push_back(temp_vertices.size() + vertexIndex[0]);
-			vertexIndices.push_back(temp_vertices.size() + vertexIndex[1]);
-			vertexIndices.push_back(temp_vertices.size() + vertexIndex[2]);
-			normalIndices.push_back(temp_normals.size() + normalIndex[0]);
-			normalIndices.push_back(temp_normals.size() + normalIndex[1]);
-			normalIndices.push_back(temp_normals.size() + normalIndex[2]);
-		}else{
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
-		}
-
-	}
+	printf("Loading OBJ file %s...\n", path);
 
-	// For each vertex of each triangle
-	for( unsigned int i=0; i<vertexIndices.size(); i++ ){
-
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int normalIndex = normalIndices[i];
-		
-		// Get the attributes thanks to the index
-		glm::vec3 vertex = temp_vertices[ vertexIndex]; //vertexIndex-1 ];
-		glm::vec3 normal = temp_normals[ normalIndex]; //normalIndex-1 ];
-		
-		// Put the attributes in buffers
-		out_vertices.push_back(vertex);
-		out_normals .push_back(normal);
-	
-	}
+	ObjMesh mesh;
+	if (!objParse(path, mesh))
+		return false;
 
-	fclose(file);
+	const glm::vec3 *soupVertices = (const glm::vec3 *) mesh.positions.data();
+	const glm::vec3 *soupNormals = (const glm::vec3 *) mesh.normals.data();
+	out_vertices.assign(soupVertices, soupVertices + mesh.vertexCount());
+	out_normals.assign(soupNormals, soupNormals + mesh.vertexCount());
 
 	return true;
 }
@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "profiler.hpp"
+
+namespace {
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Results are read when the slot comes around again, this many frames later
+	const int RingFrames = 4;
+	const int MaxPasses = 8;
+
+	// Frames shown in the graph and kept in the history ring, its height in milliseconds.
+	// Deeper than the query ring, a frame is still in the history when its GPU times come back
+	const int GraphFrames = 120;
+	const double GraphRangeMs = 50.0;
+
+	struct FrameRecord {
+		double cpu;      // from profilerBeginFrame() to profilerBeforeSwap()
+		double swap;
+		double interval; // between the end of two swaps
+		double gpu[MaxPasses];
+		bool gpuReady;
+		bool missed;
+	};
+
+	struct GraphVertex {
+		GLfloat x, y;
+		GLfloat r, g, b;
+	};
+
+	const char *VertexShaderCode =
+		"#version 330 core\n"
+		"layout(location = 0) in vec2 vertexPosition;\n"
+		"layout(location = 1) in vec3 vertexColor;\n"
+		"out vec3 fragmentColor;\n"
+		"void main(){\n"
+		"	gl_Position = vec4(vertexPosition, 0, 1);\n"
+		"	fragmentColor = vertexColor;\n"
+		"}\n";
+
+	const char *FragmentShaderCode =
+		"#version 330 core\n"
+		"in vec3 fragmentColor;\n"
+		"out vec3 color;\n"
+		"void main(){\n"
+		"	color = fragmentColor;\n"
+		"}\n";
+
+	bool enabled = false;
+	bool showGraph = true;
+	double refreshIntervalMs = 1000.0 / 60;
+
+	GLuint queries[RingFrames][MaxPasses];
+	int slotFrames[RingFrames];             // frame recorded in the slot, -1 when free
+	std::vector<int> slotPasses[RingFrames]; // passes queried in that frame
+
+	std::vector<std::string> passNames;
+	FrameRecord history[GraphFrames]; // frame n in history[n % GraphFrames]
+	int frameCount = 0;
+	int activePass = -1;
+	int stalls = 0; // times a query was still in flight when its slot came around
+
+	Clock::time_point frameStart, swapStart, lastSwapEnd;
+	bool hasSwapped = false;
+
+	// Sums since the last profilerSummary()
+	double cpuSum = 0, swapSum = 0, gpuSum = 0;
+	int summaryFrames = 0, gpuSummaryFrames = 0, missedSum = 0;
+
+	// --profile CSV, a row is written once the GPU times of its frame are in
+	FILE *logFile = nullptr;
+	size_t logPasses = 0; // columns in the header, passes seen later aren't logged
+	int loggedFrames = 0;
+
+	GLuint graphProgram = 0;
+	GLuint graphVertexArray = 0;
+	GLuint graphBuffer = 0;
+	std::vector<GraphVertex> graphVertices;
+
+	double milliseconds(Clock::duration duration) {
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+
+	FrameRecord &record(int frame) {
+		return history[frame % GraphFrames];
+	}
+
+	double gpuTotal(const FrameRecord &record) {
+		double total = 0;
+		for (size_t pass = 0; pass < passNames.size(); pass++)
+			total += record.gpu[pass];
+		return total;
+	}
+
+	void logFrame(int frame, const FrameRecord &record) {
+		if (logFile == nullptr)
+			return;
+
+		if (loggedFrames == 0) {
+			logPasses = passNames.size();
+			fprintf(logFile, "frame,cpu_ms");
+			for (size_t pass = 0; pass < logPasses; pass++)
+				fprintf(logFile, ",%s_gpu_ms", passNames[pass].c_str());
+			fprintf(logFile, ",swap_ms,interval_ms,missed\n");
+		}
+
+		fprintf(logFile, "%d,%.3f", frame, record.cpu);
+		for (size_t pass = 0; pass < logPasses; pass++)
+			fprintf(logFile, ",%.3f", record.gpu[pass]);
+		fprintf(logFile, ",%.3f,%.3f,%d\n", record.swap, record.interval, record.missed ? 1 : 0);
+		loggedFrames++;
+	}
+
+	void collect(int slot) {
+		int frame = slotFrames[slot];
+		if (frame < 0)
+			return;
+
+		FrameRecord &collected = record(frame);
+
+		for (int pass : slotPasses[slot]) {
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(queries[slot][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				stalls++;
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[slot][pass], GL_QUERY_RESULT, &elapsed);
+			// The first frame compiles shaders and uploads everything, some drivers report nonsense for it too
+			collected.gpu[pass] = frame > 0 ? elapsed / 1e6 : 0;
+		}
+		collected.gpuReady = true;
+		gpuSum += gpuTotal(collected);
+		gpuSummaryFrames++;
+		logFrame(frame, collected);
+
+		slotFrames[slot] = -1;
+		slotPasses[slot].clear();
+	}
+
+	void collectAll() {
+		for (int slot = 0; slot < RingFrames; slot++)
+			collect(slot);
+	}
+
+	void addBar(GLfloat x, double fromMs, double toMs, GLfloat r, GLfloat g, GLfloat b) {
+		const GLfloat bottom = -0.95f, height = 0.4f;
+		auto y0 = GLfloat(bottom + height * std::min(fromMs / GraphRangeMs, 1.0));
+		auto y1 = GLfloat(bottom + height * std::min(toMs / GraphRangeMs, 1.0));
+		graphVertices.push_back({x, y0, r, g, b});
+		graphVertices.push_back({x, y1, r, g, b});
+	}
+}
+
+ShaderProgramSource profilerShaderSource() {
+	return {SHADER_CODE, VertexShaderCode, FragmentShaderCode, "frame graph"};
+}
+
+bool profilerInit(GLuint program, int refreshRate) {
+	if (program == 0) {
+		fprintf(stderr, "No frame graph program\n");
+		return false;
+	}
+	graphProgram = program;
+
+	if (refreshRate > 0)
+		refreshIntervalMs = 1000.0 / refreshRate;
+
+	glGenQueries(RingFrames * MaxPasses, &queries[0][0]);
+	for (int slot = 0; slot < RingFrames; slot++)
+		slotFrames[slot] = -1;
+
+	GLint previousVertexArray = 0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+
+	glGenVertexArrays(1, &graphVertexArray);
+	glBindVertexArray(graphVertexArray);
+	glGenBuffers(1, &graphBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, graphBuffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(GraphVertex), (void *) 0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(GraphVertex), (void *) (2 * sizeof(GLfloat)));
+	glBindVertexArray((GLuint) previousVertexArray);
+
+	enabled = true;
+	return true;
+}
+
+void profilerShutdown() {
+	if (!enabled)
+		return;
+
+	collectAll();
+	if (logFile != nullptr) {
+		fclose(logFile);
+		logFile = nullptr;
+		printf("%d frames written, %d GPU queries were not ready in time\n", loggedFrames, stalls);
+	}
+
+	glDeleteQueries(RingFrames * MaxPasses, &queries[0][0]);
+	glDeleteBuffers(1, &graphBuffer);
+	glDeleteVertexArrays(1, &graphVertexArray);
+	glDeleteProgram(graphProgram);
+	enabled = false;
+}
+
+void profilerBeginFrame() {
+	if (!enabled)
+		return;
+
+	int frame = frameCount++;
+
+	// The slot was last used RingFrames ago, its queries are normally done by now
+	int slot = frame % RingFrames;
+	collect(slot);
+	slotFrames[slot] = frame;
+	record(frame) = FrameRecord{};
+
+	frameStart = Clock::now();
+}
+
+void profilerBeginPass(const char *name) {
+	if (!enabled || frameCount == 0)
+		return;
+
+	int pass = 0;
+	while (pass < (int) passNames.size() && passNames[pass] != name)
+		pass++;
+	if (pass == (int) passNames.size()) {
+		if (pass == MaxPasses)
+			return;
+		passNames.push_back(name);
+	}
+
+	int slot = (frameCount - 1) % RingFrames;
+	glBeginQuery(GL_TIME_ELAPSED, queries[slot][pass]);
+	slotPasses[slot].push_back(pass);
+	activePass = pass;
+}
+
+void profilerEndPass() {
+	if (!enabled || activePass < 0)
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	activePass = -1;
+}
+
+void profilerBeforeSwap() {
+	if (!enabled || frameCount == 0)
+		return;
+	swapStart = Clock::now();
+	record(frameCount - 1).cpu = milliseconds(swapStart - frameStart);
+}
+
+void profilerAfterSwap() {
+	if (!enabled || frameCount == 0)
+		return;
+
+	Clock::time_point swapEnd = Clock::now();
+	FrameRecord &swapped = record(frameCount - 1);
+	swapped.swap = milliseconds(swapEnd - swapStart);
+	if (hasSwapped) {
+		swapped.interval = milliseconds(swapEnd - lastSwapEnd);
+		// Half an interval of slack, anything later waited for the next vblank
+		swapped.missed = swapped.interval > 1.5 * refreshIntervalMs;
+	}
+	lastSwapEnd = swapEnd;
+	hasSwapped = true;
+
+	cpuSum += swapped.cpu;
+	swapSum += swapped.swap;
+	missedSum += swapped.missed;
+	summaryFrames++;
+}
+
+void profilerDrawGraph() {
+	if (!enabled || !showGraph)
+		return;
+
+	graphVertices.clear();
+	const GLfloat left = -0.95f, width = 0.6f;
+	const GLfloat step = width / GraphFrames;
+
+	int first = frameCount > GraphFrames ? frameCount - GraphFrames : 0;
+	for (int frame = first; frame < frameCount; frame++) {
+		const FrameRecord &shown = record(frame);
+		GLfloat x = left + step * (frame - first);
+
+		// CPU with the swap stacked on top, GPU right next to it once it is known
+		addBar(x, 0, shown.cpu, 0, 1, 0);
+		addBar(x, shown.cpu, shown.cpu + shown.swap, 1, 1, 0);
+		if (shown.gpuReady)
+			addBar(x + step / 2, 0, gpuTotal(shown), 1, 0, 0);
+	}
+
+	// Refresh interval
+	auto budget = GLfloat(-0.95f + 0.4f * std::min(refreshIntervalMs / GraphRangeMs, 1.0));
+	graphVertices.push_back({left, budget, 1, 1, 1});
+	graphVertices.push_back({left + width, budget, 1, 1, 1});
+
+	// Leave the caller's state as we found it
+	GLint previousProgram = 0, previousVertexArray = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	glDisable(GL_DEPTH_TEST);
+
+	glUseProgram(graphProgram);
+	glBindVertexArray(graphVertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, graphBuffer);
+	glBufferData(GL_ARRAY_BUFFER, graphVertices.size() * sizeof(GraphVertex), graphVertices.data(), GL_STREAM_DRAW);
+	glDrawArrays(GL_LINES, 0, (GLsizei) graphVertices.size());
+
+	glBindVertexArray((GLuint) previousVertexArray);
+	glUseProgram((GLuint) previousProgram);
+	if (depthTest)
+		glEnable(GL_DEPTH_TEST);
+}
+
+void profilerToggleGraph() {
+	showGraph = !showGraph;
+}
+
+void profilerSummary(double &cpuMs, double &gpuMs, double &swapMs, int &missedSwaps) {
+	// GPU results lag, the frames still in flight are averaged next time
+	cpuMs = summaryFrames > 0 ? cpuSum / summaryFrames : 0;
+	swapMs = summaryFrames > 0 ? swapSum / summaryFrames : 0;
+	gpuMs = gpuSummaryFrames > 0 ? gpuSum / gpuSummaryFrames : 0;
+	missedSwaps = missedSum;
+
+	cpuSum = swapSum = gpuSum = 0;
+	summaryFrames = gpuSummaryFrames = missedSum = 0;
+}
+
+bool profilerLog(const char *path) {
+	if (!enabled)
+		return false;
+
+	logFile = fopen(path, "w");
+	if (logFile == nullptr) {
+		fprintf(stderr, "Could not write %s\n", path);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,55 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <GL/glew.h>
+
+#include "shader.hpp"
+
+// Frame instrumentation for the render loop. Every pass is wrapped in a
+// GL_TIME_ELAPSED query. Queries live in a ring a few frames deep and are
+// read back once their frame has retired, so the CPU never waits on them.
+// The swap is timed separately, and frames that took longer than one refresh
+// interval are counted as missed swaps.
+//
+//	profilerBeginFrame();
+//	profilerBeginPass("scene");
+//	... draw ...
+//	profilerEndPass();
+//	profilerDrawGraph();
+//	profilerBeforeSwap();
+//	glfwSwapBuffers(window);
+//	profilerAfterSwap();
+//
+// Everything is a no-op until profilerInit() succeeded.
+
+// The graph program, to be loaded with the others through LoadShaderPrograms()
+ShaderProgramSource profilerShaderSource();
+
+// Needs a current 3.3 context and the linked graph program. refreshRate in Hz,
+// from the monitor the window is on
+bool profilerInit(GLuint program, int refreshRate);
+void profilerShutdown();
+
+void profilerBeginFrame();
+
+// Passes can't nest, GL allows one GL_TIME_ELAPSED query at a time
+void profilerBeginPass(const char *name);
+void profilerEndPass();
+
+void profilerBeforeSwap();
+void profilerAfterSwap();
+
+// Bar graph of the last frames in the bottom left corner. Green is CPU time,
+// red GPU time, yellow the swap, the white line is the refresh interval.
+void profilerDrawGraph();
+void profilerToggleGraph();
+
+// Averages over the frames since the last call, for the once a second printf
+void profilerSummary(double &cpuMs, double &gpuMs, double &swapMs, int &missedSwaps);
+
+// Writes one CSV line per frame to path : cpu, gpu per pass, swap, interval
+// and missed flag. Lines go out as the GPU times come back, the file is
+// closed by profilerShutdown()
+bool profilerLog(const char *path);
+
+#endif
@@ -1,6 +1,28 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+// Linked programs are kept in ./shadercache with glGetProgramBinary, keyed by
+// a hash of both sources and the driver strings. A later start reloads them
+// with glProgramBinary and only compiles what changed.
+
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
 
+enum ShaderSourceKind {
+	SHADER_FILES, // vertex and fragment are paths, read like LoadShaders() does
+	SHADER_CODE   // vertex and fragment are the GLSL itself, for programs built into a module
+};
+
+struct ShaderProgramSource {
+	ShaderSourceKind kind;
+	const char *vertex;
+	const char *fragment;
+	const char *name; // shown in the errors of SHADER_CODE programs
+};
+
+// Loads count programs at once, from files and code alike. The misses are all
+// compiled and linked before any result is read back, so a driver with
+// GL_KHR_parallel_shader_compile works on them side by side. Both kinds go
+// through the cache. programs[i] is 0 for each program that failed.
+bool LoadShaderPrograms(const ShaderProgramSource *sources, GLuint *programs, int count);
+
 #endif
@@ -1,7 +1,10 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
-// Load a .BMP file using our custom loader
+// Load a 24 or 32 bit .BMP file using our custom loader. The first load
+// encodes it with its mip chain to BC1, or BC3 if it has alpha, and keeps
+// the result in ./texturecache as a DDS file. Later loads go through
+// loadDDS() on that file until the BMP changes.
 GLuint loadBMP_custom(const char * imagepath);
 
 //// Since GLFW 3, glfwLoadTexture2D() has been removed. You have to use another texture loading library, 
@@ -9,8 +12,27 @@ GLuint loadBMP_custom(const char * imagepath);
 //// Load a .TGA file using GLFW's own loader
 //GLuint loadTGA_glfw(const char * imagepath);
 
-// Load a .DDS file using GLFW's own loader
+// DDS and KTX files are memory mapped and their levels uploaded straight from
+// the mapped pages. Levels up to 128x128 are uploaded right away, so the
+// texture can be drawn from the first frame. The larger ones are streamed in
+// by textureStreamUpdate() from the render loop.
+
+// Load a DXT1/3/5 compressed .DDS file
 GLuint loadDDS(const char * imagepath);
 
+// Load a little endian, 2D .KTX (version 1) file, compressed or not
+GLuint loadKTX(const char * imagepath);
+
+// Uploads pending mip levels, about budgetBytes per call and at least one level.
+// Returns true while levels are still waiting.
+bool textureStreamUpdate(size_t budgetBytes = 1 << 20);
+
+// Stops streaming a texture and releases its mapping. Call it before deleting
+// a texture that may still be streaming, GL hands its name out again.
+void textureStreamCancel(GLuint textureID);
+
+// Releases the mappings of textures that didn't finish streaming
+void textureStreamShutdown();
+
 
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <cstring>
 #include <vector>
 
 // Include GLEW
@@ -17,35 +18,63 @@ using namespace glm;
 #include "common/controls.hpp"
 #include "common/objloader.hpp"
 #include "common/vboindexer.hpp"
+#include "common/meshorder.hpp"
 #include "common/shader.hpp"
 #include "common/texture.hpp"
+#include "common/offscreen.hpp"
+#include "common/bundle.hpp"
+#include "common/meshcache.hpp"
+#include "common/profiler.hpp"
 
 int glfw_init();
 int gl_init();
 void glfw_exit();
 
 // IDs need to free up resources
-GLuint vertexbuffer;
-GLuint normalbuffer;
-GLuint elementbuffer;
+MeshBuffers mesh;
 GLuint programID;
 GLuint Texture;
 GLuint VertexArrayID;
 
-int main() {
+int main(int argc, char **argv) {
+    // Shaders, textures and meshes come from the bundle when there is one, see common/bundle.hpp
+    bundleOpen("assets.bundle");
 
-    if (glfw_init()==-1)
+    // --offscreen FRAMES renders into an FBO without a window, see common/offscreen.hpp
+    bool offscreen = offscreenRequested(argc, argv);
+    if (offscreen ? !offscreenInit(1024, 768, true) : glfw_init()==-1)
         return -1;
 
     if (gl_init()==-1)
         return -1;
 
+    // Create and compile our GLSL programs together, the frame graph's included, see common/shader.hpp
+    const ShaderProgramSource shaderSources[] = {
+            {SHADER_FILES, "StandardShading.vertexshader", "StandardShading.fragmentshader", nullptr},
+            profilerShaderSource()
+    };
+    // Offscreen runs time the whole frame already, and GL_TIME_ELAPSED queries can't nest
+    GLuint programs[2] = {0, 0};
+    bool programsLoaded = LoadShaderPrograms(shaderSources, programs, offscreen ? 1 : 2);
+    programID = programs[0];
+    if (!programsLoaded) {
+        glDeleteProgram(programs[1]);
+        glfw_exit();
+        return -1;
+    }
+
+    if (!offscreen) {
+        const GLFWvidmode *mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        profilerInit(programs[1], mode != nullptr ? mode->refreshRate : 60);
+        // --profile FILE streams the per frame timings as CSV
+        for (int i = 1; i + 1 < argc; i++)
+            if (strcmp(argv[i], "--profile") == 0)
+                profilerLog(argv[i + 1]);
+    }
+
     glGenVertexArrays(1, &VertexArrayID);
     glBindVertexArray(VertexArrayID);
 
-    // Create and compile our GLSL program from the shaders
-    programID = LoadShaders("StandardShading.vertexshader", "StandardShading.fragmentshader");
-
     // Get a handle for our "MVP" uniform
     auto MatrixID = (GLuint) glGetUniformLocation(programID, "MVP");
     auto ViewMatrixID = (GLuint) glGetUniformLocation(programID, "V");
@@ -57,32 +86,31 @@ int main() {
     // Get a handle for our "myTextureSampler" uniform
     auto TextureID = (GLuint) glGetUniformLocation(programID, "myTextureSampler");
 
-    std::vector<unsigned short> indices;
-    std::vector<glm::vec3> indexed_vertices;
-    std::vector<glm::vec3> indexed_normals;
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec3> normals;
-
-    // Read our .obj file
-    if (!loadOBJ("skull.obj", vertices, normals))
-        return -2;
-
-    indexVBO(vertices, normals, indices, indexed_vertices, indexed_normals);
-
-    // Load it into a VBO
-
-    glGenBuffers(1, &vertexbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
-
-    glGenBuffers(1, &normalbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
-
-    // Generate a buffer for the indices as well
-    glGenBuffers(1, &elementbuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+    // The indexed mesh is read back from the cache next to the OBJ after the first run, see common/meshcache.hpp
+    // --vertex-format picks how the vertices are packed on the GPU
+    MeshVertexFormat vertexFormat = meshVertexFormatRequested(argc, argv);
+    if (!meshCacheLoad("skull.obj", false, vertexFormat, mesh)) {
+        VertexIndices indices;
+        std::vector<glm::vec3> indexed_vertices;
+        std::vector<glm::vec3> indexed_normals;
+        std::vector<glm::vec3> vertices;
+        std::vector<glm::vec3> normals;
+
+        // Read our .obj file
+        if (!loadOBJ("skull.obj", vertices, normals))
+            return -2;
+
+        indexVBO(vertices, normals, indices, indexed_vertices, indexed_normals);
+
+        // Triangle and vertex order for the vertex cache, early-z and vertex fetch
+        optimizeMeshOrder("skull.obj", indices, indexed_vertices, nullptr, indexed_normals);
+
+        // Keep it for the next run and load it into VBOs
+        MeshData data = {&indexed_vertices[0].x, nullptr, &indexed_normals[0].x, indexed_vertices.size(),
+                         indices.data(), indices.size(), indices.elementSize()};
+        meshCacheStore("skull.obj", data, vertexFormat, mesh);
+    }
+    meshSetDequantization(mesh, programID);
 
     // Get a handle for our "LightPosition" uniform
     glUseProgram(programID);
@@ -92,14 +120,23 @@ int main() {
     double lastTime = glfwGetTime();
     int nbFrames = 0;
 
+    bool running;
+    bool graphKeyDown = false;
     do {
+        if (offscreen)
+            offscreenBeginFrame();
+        profilerBeginFrame();
 
         // Measure speed
         double currentTime = glfwGetTime();
         nbFrames++;
-        if (currentTime - lastTime >= 1.0) { // If last prinf() was more than 1sec ago
+        if (!offscreen && currentTime - lastTime >= 1.0) { // If last prinf() was more than 1sec ago
             // printf and reset
-            printf("%f ms/frame\n", 1000.0 / double(nbFrames));
+            double cpuMs, gpuMs, swapMs;
+            int missedSwaps;
+            profilerSummary(cpuMs, gpuMs, swapMs, missedSwaps);
+            printf("%f ms/frame, cpu %.3f ms, gpu %.3f ms, swap %.3f ms, %d missed swaps\n", 1000.0 / double(nbFrames),
+                   cpuMs, gpuMs, swapMs, missedSwaps);
             nbFrames = 0;
             lastTime += 1.0;
 
@@ -108,6 +145,8 @@ int main() {
             printf("%f %f %f %f \n", mat41[0],mat41[1],mat41[2],mat41[3]);
         }
 
+        profilerBeginPass("scene");
+
         // Clear the screen
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -136,39 +175,17 @@ int main() {
         // Set our "myTextureSampler" sampler to use Texture Unit 0
         glUniform1i(TextureID, 0);
 
-        // 1rst attribute buffer : vertices
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-        glVertexAttribPointer(
-                0,                  // attribute
-                3,                  // size
-                GL_FLOAT,           // type
-                GL_FALSE,           // normalized?
-                0,                  // stride
-                (void *) nullptr            // array buffer offset
-        );
-
-        // 2nd attribute UVs: not present in our case
-        // 3rd attribute buffer : normals
-        glEnableVertexAttribArray(2);
-        glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-        glVertexAttribPointer(
-                2,                                // attribute
-                3,                                // size
-                GL_FLOAT,                         // type
-                GL_FALSE,                         // normalized?
-                0,                                // stride
-                (void *) nullptr                          // array buffer offset
-        );
+        // Positions and normals, both from the one interleaved buffer
+        meshBind(mesh);
 
         // Index buffer
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementbuffer);
 
         // Draw the triangles !
         glDrawElements(
                 GL_TRIANGLES,      // mode
-                indices.size(),    // count
-                GL_UNSIGNED_SHORT,   // type
+                mesh.indexCount,   // count
+                mesh.indexType,    // type
                 (void *) nullptr           // element array buffer offset
         );
 
@@ -176,13 +193,34 @@ int main() {
         glDisableVertexAttribArray(1);
         glDisableVertexAttribArray(2);
 
-        // Swap buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        profilerEndPass();
+
+        // Frame time graph, G toggles it
+        profilerBeginPass("graph");
+        profilerDrawGraph();
+        profilerEndPass();
+
+        if (offscreen) {
+            running = offscreenEndFrame();
+        } else {
+            // Swap buffers
+            profilerBeforeSwap();
+            glfwSwapBuffers(window);
+            profilerAfterSwap();
+            glfwPollEvents();
+
+            bool graphKey = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+            if (graphKey && !graphKeyDown)
+                profilerToggleGraph();
+            graphKeyDown = graphKey;
+
+            // Check if the ESC key was pressed or the window was closed
+            running = glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && glfwWindowShouldClose(window) == 0;
+        }
 
-    } // Check if the ESC key was pressed or the window was closed
-    while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
-           glfwWindowShouldClose(window) == 0);
+        // The large mip levels come in once the first frames are out
+        textureStreamUpdate();
+    } while (running);
 
     glfw_exit();
 
@@ -214,6 +252,9 @@ int glfw_init(){
     }
     glfwMakeContextCurrent(window);
 
+    // Wait for vblank, missed swaps are then frames that took more than one refresh
+    glfwSwapInterval(1);
+
     // Ensure we can capture the escape key being pressed below
     glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
     // Hide the mouse and enable unlimited mouvement
@@ -230,7 +271,8 @@ int gl_init(){
     // Initialize GLEW
     glewExperimental = GL_TRUE; // Needed for core profile
 
-    if (glewInit() != GLEW_OK) {
+    // glewInit() looks for a window system, an offscreen context has none
+    if ((offscreenActive() ? glewContextInit() : glewInit()) != GLEW_OK) {
         fprintf(stderr, "Failed to initialize GLEW\n");
         getchar();
         glfwTerminate();
@@ -253,13 +295,18 @@ int gl_init(){
 
 void glfw_exit(){
     // Cleanup VBO and shader
-    glDeleteBuffers(1, &vertexbuffer);
-    glDeleteBuffers(1, &normalbuffer);
-    glDeleteBuffers(1, &elementbuffer);
+    meshRelease(mesh);
     glDeleteProgram(programID);
     glDeleteTextures(1, &Texture);
+    textureStreamShutdown();
     glDeleteVertexArrays(1, &VertexArrayID);
 
+    profilerShutdown();
+
+    // Prints the frame times, needs the context still alive
+    offscreenShutdown();
+    bundleClose();
+
     // Close OpenGL window and terminate GLFW
     glfwTerminate();
 }
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef BUNDLE_HPP
+#define BUNDLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// One file holding every asset a demo reads at startup. It is written by the
+// packbundle tool (asset_bundle/) and mmapped whole at runtime, so a cold
+// start costs one open() and then page faults. Lookups hand out pointers
+// into the mapping, nothing is copied.
+//
+//	packbundle assets.bundle skull.obj StandardShading.vertexshader uvmap.DDS
+//
+//	bundleOpen("assets.bundle");   // optional, loaders fall back to loose files
+//	BundleView view;
+//	if (bundleFind("uvmap.DDS", view))
+//		... view.data, view.size ...
+//	bundleClose();
+//
+// Entries are named by the path the loaders are given. Every entry starts on
+// a page boundary. Meshes are stored preprocessed, the other files as they are.
+
+const char BundleMagic[8] = {'A', 'R', 'B', 'U', 'N', 'D', 'L', 'E'};
+const uint32_t BundleVersion = 1;
+const uint32_t BundleAlignment = 4096;
+
+enum BundleKind : uint32_t {
+	BUNDLE_RAW = 0,
+	BUNDLE_MESH = 1 // BundleMesh header, then float positions[3n], uvs[2n] if BUNDLE_MESH_UVS, normals[3n]
+};
+
+const uint32_t BUNDLE_MESH_UVS = 1;
+
+struct BundleHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t entryCount; // BundleEntry records follow the header
+};
+
+struct BundleEntry {
+	char name[48];
+	uint32_t kind;
+	uint32_t reserved;
+	uint64_t offset; // From the start of the file
+	uint64_t size;
+};
+
+// A triangle soup, three vertices per face, straight from the OBJ faces
+struct BundleMesh {
+	uint32_t vertexCount;
+	uint32_t flags;
+};
+
+struct BundleView {
+	const void *data;
+	size_t size;
+	uint32_t kind;
+};
+
+// Maps the bundle, false (quietly) if there is none or it is damaged
+bool bundleOpen(const char *path);
+void bundleClose();
+bool bundleActive();
+
+// Zero copy view of an entry, valid until bundleClose()
+bool bundleFind(const char *name, BundleView &view);
+
+// Mesh entries split into their arrays, uvs is nullptr when the mesh has none
+bool bundleFindMesh(const char *name, uint32_t &vertexCount, const float *&positions, const float *&uvs,
+                    const float *&normals);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Indexed meshes, the output of indexVBO(), kept in a binary file next to the
+// OBJ they come from (skull.obj -> skull.mesh).
+//
+// On the GPU the attributes are interleaved in one buffer, quantized unless
+// --vertex-format float is given: positions as half floats or normalized
+// 16 bit integers over the mesh bounds, normals as GL_INT_2_10_10_10_REV and
+// UVs as half floats. The vertex shader scales positions back with the
+// PositionScale and PositionOffset uniforms.
+//
+// The file holds the vertices already packed that way, then the indices, each
+// 64 byte aligned. Loading maps it and hands both to glBufferData() as they
+// are, nothing is parsed or converted. The header records the vertex format
+// and the position scale, and a hash of the OBJ contents: editing the OBJ or
+// asking for another format makes the next run rebuild the cache.
+//
+//	MeshVertexFormat format = meshVertexFormatRequested(argc, argv);
+//	MeshBuffers mesh;
+//	if (!meshCacheLoad("skull.obj", false, format, mesh)) {
+//		... loadOBJ(), indexVBO() ...
+//		MeshData data = {...};
+//		meshCacheStore("skull.obj", data, format, mesh);
+//	}
+//	meshSetDequantization(mesh, programID);
+//	...
+//	meshBind(mesh);
+//	glDrawElements(GL_TRIANGLES, mesh.indexCount, mesh.indexType, nullptr);
+
+// Arrays as indexVBO() leaves them
+struct MeshData {
+	const float *positions; // 3 per vertex
+	const float *uvs;       // 2 per vertex, or nullptr
+	const float *normals;   // 3 per vertex
+	size_t vertexCount;
+	const void *indices;
+	size_t indexCount;
+	unsigned int indexSize; // 2 or 4 bytes
+};
+
+// How positions are stored on the GPU, normals and UVs are packed the same way in all but FLOAT
+enum MeshVertexFormat {
+	MESH_VERTEX_FLOAT,   // 32 bit floats throughout, 24 bytes a vertex, 32 with UVs
+	MESH_VERTEX_HALF,    // Half floats, 12 bytes a vertex, 16 with UVs
+	MESH_VERTEX_SNORM16  // Normalized 16 bit integers, same sizes as HALF
+};
+
+// GL buffers of a mesh, every attribute interleaved in vertexbuffer
+struct MeshBuffers {
+	GLuint vertexbuffer, elementbuffer;
+	GLsizei indexCount;
+	GLenum indexType; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	MeshVertexFormat format;
+	GLsizei stride;
+	bool hasUVs;
+	float positionScale[3], positionOffset[3]; // model space position = stored * scale + offset
+};
+
+// Parses --vertex-format float|half|snorm16, SNORM16 when not given
+MeshVertexFormat meshVertexFormatRequested(int argc, char **argv);
+
+// Creates the buffers from the cache of objPath. Fails when there is no cache,
+// the OBJ changed since it was written, it was packed in another format, or
+// UVs are wanted and it has none.
+bool meshCacheLoad(const char *objPath, bool withUVs, MeshVertexFormat format, MeshBuffers &buffers);
+
+// Packs arrays in memory into format, creates the buffers from them and
+// writes the cache of objPath. Both paths print how much smaller the vertices
+// came out. The buffers are created even when the cache can't be written.
+bool meshCacheStore(const char *objPath, const MeshData &data, MeshVertexFormat format, MeshBuffers &buffers);
+
+// Sets the PositionScale and PositionOffset uniforms of a program drawing the mesh
+void meshSetDequantization(const MeshBuffers &buffers, GLuint programID);
+
+// Points attributes 0 (position), 1 (UV, when there are UVs) and 2 (normal) at the vertex buffer
+void meshBind(const MeshBuffers &buffers);
+
+// Deletes the buffers
+void meshRelease(MeshBuffers &buffers);
+
+#endif
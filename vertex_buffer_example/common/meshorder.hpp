@@ -0,0 +1,36 @@
+#ifndef MESHORDER_HPP
+#define MESHORDER_HPP
+
+// Reordering of indexed meshes for the GPU, run once on the output of
+// indexVBO() before it goes to the mesh cache:
+//
+// 1. Triangles are reordered for the post-transform vertex cache (Forsyth's
+//    scoring: vertices recently used, or with few triangles left, pull their
+//    triangles forward).
+// 2. The result is cut into clusters wherever starting afresh costs little
+//    cache efficiency, and the clusters are sorted outward facing first so
+//    early-z rejects more of what is drawn after them.
+// 3. Vertices are renumbered in the order the triangles first use them, so
+//    vertex fetch walks the buffers front to back.
+//
+//	indexVBO(vertices, normals, indices, indexed_vertices, indexed_normals);
+//	optimizeMeshOrder("skull.obj", indices, indexed_vertices, nullptr, indexed_normals);
+
+// Post-transform cache efficiency of an index buffer, simulated as a 16 entry FIFO
+struct VertexCacheStats {
+	float acmr; // vertices transformed per triangle, 0.5 at best, 3 at worst
+	float atvr; // vertices transformed per vertex, 1 at best
+};
+
+VertexCacheStats analyzeVertexCache(const VertexIndices & indices, size_t vertexCount);
+
+// All three passes, prints ACMR and ATVR before and after under name
+void optimizeMeshOrder(
+	const char * name,
+	VertexIndices & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> * uvs,
+	std::vector<glm::vec3> & normals
+);
+
+#endif
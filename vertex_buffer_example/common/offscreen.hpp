@@ -0,0 +1,41 @@
+#ifndef OFFSCREEN_HPP
+#define OFFSCREEN_HPP
+
+// Headless rendering, for measuring frame times on machines without a display
+// or a GPU. A surfaceless EGL context is created instead of a window (Mesa's
+// llvmpipe/softpipe rasterizers work fine) and every frame goes to an FBO.
+// The FBO is read back through a ring of PBOs, so the readback of a frame
+// overlaps with the rendering of the next ones.
+//
+//	program --offscreen 300 [--dump last.ppm]
+//
+//	if (offscreenRequested(argc, argv))
+//		offscreenInit(1024, 768, true);
+//	...
+//	do {
+//		offscreenBeginFrame();
+//		... draw ...
+//	} while (offscreenEndFrame());
+//	offscreenShutdown();
+
+// Parses --offscreen <frames> and --dump <file.ppm>, true when offscreen was asked for
+bool offscreenRequested(int argc, char **argv);
+bool offscreenActive();
+
+// Makes a surfaceless 3.3 context current. GL entry points are usable after
+// this, GLEW users still need glewContextInit() (glewInit() wants a window)
+bool offscreenInit(int width, int height, bool coreProfile);
+
+// Binds the FBO, created on first use, and starts the frame timers
+void offscreenBeginFrame();
+
+// Queues the readback of the frame, false once every requested frame is rendered
+bool offscreenEndFrame();
+
+// Time of the current frame at a fixed 60 Hz, so animations are the same on every run
+double offscreenTime();
+
+// Waits for the last readbacks, prints the CPU and GPU frame times and writes the dump
+void offscreenShutdown();
+
+#endif
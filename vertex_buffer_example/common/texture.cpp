@@ -1,14 +1,137 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <GL/glew.h>
 
 #include <GLFW/glfw3.h>
 
+#include "texture.hpp"
+#include "bcencoder.hpp"
+#include "bundle.hpp"
+
+
+#define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
+#define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
+#define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+
+// DDS_PIXELFORMAT.dwFlags
+#define DDPF_FOURCC 0x4
+
+namespace {
+
+	// Compressed copies of the BMP files, rebuilt when the BMP changes
+	const char *TextureCacheDirectory = "texturecache";
+
+	std::string textureCachePath(const char *imagepath, const struct stat &info) {
+		// FNV-1a over the path, the size and the modification time
+		unsigned long long hash = 14695981039346656037ULL;
+		auto mix = [&hash](const void *data, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				hash ^= ((const unsigned char *) data)[i];
+				hash *= 1099511628211ULL;
+			}
+		};
+		mix(imagepath, strlen(imagepath));
+		long long size = info.st_size, modified = info.st_mtime;
+		mix(&size, sizeof(size));
+		mix(&modified, sizeof(modified));
+
+		char name[64];
+		snprintf(name, sizeof(name), "%s/%016llx.dds", TextureCacheDirectory, hash);
+		return name;
+	}
+
+	// 2x2 box filter, odd sizes repeat the last row or column
+	void halveImage(const std::vector<unsigned char> &rgba, unsigned int width, unsigned int height,
+	                std::vector<unsigned char> &out, unsigned int &outWidth, unsigned int &outHeight) {
+		outWidth = width > 1 ? width / 2 : 1;
+		outHeight = height > 1 ? height / 2 : 1;
+		out.resize(size_t(outWidth) * outHeight * 4);
+		for (unsigned int y = 0; y < outHeight; y++) {
+			unsigned int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+			for (unsigned int x = 0; x < outWidth; x++) {
+				unsigned int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+				for (int c = 0; c < 4; c++) {
+					unsigned int sum = rgba[4 * (size_t(y0) * width + x0) + c] + rgba[4 * (size_t(y0) * width + x1) + c] +
+					                   rgba[4 * (size_t(y1) * width + x0) + c] + rgba[4 * (size_t(y1) * width + x1) + c];
+					out[4 * (size_t(y) * outWidth + x) + c] = (unsigned char) ((sum + 2) / 4);
+				}
+			}
+		}
+	}
+
+	// Encodes the whole mip chain and writes it as a DDS file loadDDS() understands.
+	// Rows stay bottom up like in the BMP, so the texture comes out the same way glTexImage2D had it.
+	bool writeCompressedCache(const char *cachePath, std::vector<unsigned char> rgba, unsigned int width,
+	                          unsigned int height, bool alpha) {
+		std::vector<unsigned char> blocks, level;
+		unsigned int levelWidth = width, levelHeight = height, mipMapCount = 0;
+		while (true) {
+			size_t offset = blocks.size();
+			blocks.resize(offset + bcEncodedSize(levelWidth, levelHeight, alpha));
+			bcEncode(rgba.data(), levelWidth, levelHeight, alpha, blocks.data() + offset);
+			mipMapCount++;
+
+			if (levelWidth == 1 && levelHeight == 1)
+				break;
+			halveImage(rgba, levelWidth, levelHeight, level, levelWidth, levelHeight);
+			rgba.swap(level);
+		}
+
+		unsigned int header[31] = {};
+		header[0] = 124;
+		header[1] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // caps, size, pixel format, mips, linear size
+		header[2] = height;
+		header[3] = width;
+		header[4] = (unsigned int) bcEncodedSize(width, height, alpha);
+		header[6] = mipMapCount;
+		header[18] = 32;                                  // DDS_PIXELFORMAT.dwSize
+		header[19] = DDPF_FOURCC;
+		header[20] = alpha ? FOURCC_DXT5 : FOURCC_DXT1;
+		header[26] = 0x1000 | 0x400000 | 0x8;             // texture, mipmap, complex
+
+		mkdir(TextureCacheDirectory, 0755);
+		FILE *file = fopen(cachePath, "wb");
+		if (file == nullptr) {
+			printf("Could not write the texture cache in %s\n", TextureCacheDirectory);
+			return false;
+		}
+		bool written = fwrite("DDS ", 1, 4, file) == 4 && fwrite(header, sizeof(header), 1, file) == 1 &&
+		               fwrite(blocks.data(), 1, blocks.size(), file) == blocks.size();
+		fclose(file);
+		if (!written)
+			remove(cachePath);
+		return written;
+	}
+}
 
 GLuint loadBMP_custom(const char * imagepath){
 
+	struct stat info;
+	if (stat(imagepath, &info) != 0){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return 0;
+	}
+
+	// Encoded on an earlier run
+	std::string cachePath = textureCachePath(imagepath, info);
+	bool compress = GLEW_EXT_texture_compression_s3tc;
+	if (compress && access(cachePath.c_str(), R_OK) == 0){
+		GLuint textureID = loadDDS(cachePath.c_str());
+		if (textureID != 0)
+			return textureID;
+	}
+
 	printf("Reading image %s\n", imagepath);
 
 	// Data read from the header of the BMP file
@@ -16,14 +139,12 @@ GLuint loadBMP_custom(const char * imagepath){
 	unsigned int dataPos;
 	unsigned int imageSize;
 	unsigned int width, height;
-	// Actual RGB data
-	unsigned char * data;
+	unsigned int bitsPerPixel;
 
 	// Open the file
 	FILE * file = fopen(imagepath,"rb");
 	if (!file){
 		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
-		getchar();
 		return 0;
 	}
 
@@ -41,28 +162,62 @@ GLuint loadBMP_custom(const char * imagepath){
 		fclose(file);
 		return 0;
 	}
-	// Make sure this is a 24bpp file
-	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
-	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
+	// Make sure this is an uncompressed 24 or 32bpp file
+	bitsPerPixel = *(unsigned short*)&(header[0x1C]);
+	if ( *(int*)&(header[0x1E])!=0  )                      {printf("Not a correct BMP file\n");    fclose(file); return 0;}
+	if ( bitsPerPixel!=24 && bitsPerPixel!=32 )            {printf("Not a correct BMP file\n");    fclose(file); return 0;}
 
 	// Read the information about the image
 	dataPos    = *(int*)&(header[0x0A]);
-	imageSize  = *(int*)&(header[0x22]);
 	width      = *(int*)&(header[0x12]);
 	height     = *(int*)&(header[0x16]);
-
-	// Some BMP files are misformatted, guess missing information
-	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
 	if (dataPos==0)      dataPos=54; // The BMP header is done that way
 
-	// Create a buffer
-	data = new unsigned char [imageSize];
+	// Rows are padded to 4 bytes
+	unsigned int rowSize = (width * bitsPerPixel / 8 + 3) & ~3u;
+	imageSize = rowSize * height;
 
 	// Read the actual data from the file into the buffer
-	fread(data,1,imageSize,file);
+	std::vector<unsigned char> data(imageSize);
+	fseek(file, dataPos, SEEK_SET);
+	bool complete = fread(data.data(), 1, imageSize, file) == imageSize;
 
 	// Everything is in memory now, the file can be closed.
 	fclose (file);
+	if (!complete || width == 0 || height == 0){
+		printf("Not a correct BMP file\n");
+		return 0;
+	}
+
+	// BGR(A) to RGBA, the encoder wants one tight layout
+	std::vector<unsigned char> rgba(size_t(width) * height * 4);
+	bool alpha = false;
+	for (unsigned int y = 0; y < height; y++){
+		const unsigned char *row = data.data() + size_t(y) * rowSize;
+		for (unsigned int x = 0; x < width; x++){
+			const unsigned char *pixel = row + x * (bitsPerPixel / 8);
+			unsigned char *out = &rgba[4 * (size_t(y) * width + x)];
+			out[0] = pixel[2];
+			out[1] = pixel[1];
+			out[2] = pixel[0];
+			out[3] = bitsPerPixel == 32 ? pixel[3] : 255;
+			alpha |= out[3] != 255;
+		}
+	}
+
+	// BC1 for opaque images, BC3 once any pixel is translucent
+	if (compress){
+		auto start = std::chrono::steady_clock::now();
+		if (writeCompressedCache(cachePath.c_str(), rgba, width, height, alpha)){
+			double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			printf("Compressed %s to %s as %s in %.1f ms\n", imagepath, cachePath.c_str(), alpha ? "BC3" : "BC1", elapsed);
+			GLuint textureID = loadDDS(cachePath.c_str());
+			if (textureID != 0)
+				return textureID;
+		}
+	}
+
+	// Without S3TC, or without a writable cache, the image goes up uncompressed as before
 
 	// Create one OpenGL texture
 	GLuint textureID;
@@ -72,10 +227,8 @@ GLuint loadBMP_custom(const char * imagepath){
 	glBindTexture(GL_TEXTURE_2D, textureID);
 
 	// Give the image to OpenGL
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
-
-	// OpenGL has now copied the data. Free our own version
-	delete [] data;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, alpha ? GL_RGBA : GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
 
 	// Poor filtering, or ...
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -120,99 +273,307 @@ GLuint loadBMP_custom(const char * imagepath){
 
 
 
-#define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
-#define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
-#define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+
+namespace {
+
+	// Levels up to this size are uploaded by the loader, the larger ones are streamed in later
+	const unsigned int ResidentLevelSize = 128;
+
+	struct MipLevel {
+		unsigned int width, height;
+		unsigned int size;
+		const unsigned char *data; // Points into the mapping
+	};
+
+	// A texture file mapped read only. The kernel pages it in as the levels are uploaded.
+	struct MappedTexture {
+		GLuint textureID = 0;
+		const unsigned char *bytes = nullptr; // The whole file
+		size_t size = 0;
+		void *mapping = nullptr;              // Our own mapping, nullptr when the file is in the asset bundle
+		size_t mappingSize = 0;
+		bool compressed = true;
+		GLenum internalFormat = 0, format = 0, type = 0;
+		std::vector<MipLevel> levels;
+		int residentLevel = 0; // Finest level on the GPU, levels below it are still waiting
+	};
+
+	std::vector<MappedTexture> streaming;
+
+	bool mapFile(const char *path, MappedTexture &texture) {
+		// The bundle is mapped already
+		BundleView view;
+		if (bundleFind(path, view) && view.kind == BUNDLE_RAW) {
+			texture.bytes = (const unsigned char *) view.data;
+			texture.size = view.size;
+			return true;
+		}
+
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", path);
+			return false;
+		}
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			close(fd);
+			return false;
+		}
+		void *mapping = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); // The mapping keeps the file alive
+		if (mapping == MAP_FAILED)
+			return false;
+
+		texture.mapping = mapping;
+		texture.mappingSize = (size_t) info.st_size;
+		texture.bytes = (const unsigned char *) mapping;
+		texture.size = texture.mappingSize;
+		return true;
+	}
+
+	void unmapFile(MappedTexture &texture) {
+		if (texture.mapping != nullptr)
+			munmap(texture.mapping, texture.mappingSize);
+		texture.mapping = nullptr;
+		texture.bytes = nullptr;
+	}
+
+	unsigned int readUint(const unsigned char *bytes) {
+		unsigned int value;
+		memcpy(&value, bytes, sizeof(value));
+		return value;
+	}
+
+	void uploadLevel(const MappedTexture &texture, int level) {
+		const MipLevel &mip = texture.levels[level];
+		if (texture.compressed)
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, mip.width, mip.height, 0, mip.size,
+			                       mip.data);
+		else
+			glTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, mip.width, mip.height, 0, texture.format,
+			             texture.type, mip.data);
+	}
+
+	// Uploads the small levels now and keeps the mapping around for the rest
+	GLuint createStreamedTexture(MappedTexture &texture) {
+		glGenTextures(1, &texture.textureID);
+		glBindTexture(GL_TEXTURE_2D, texture.textureID);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, texture.compressed ? 1 : 4);
+
+		int levelCount = (int) texture.levels.size();
+		texture.residentLevel = levelCount - 1;
+		while (texture.residentLevel > 0 && texture.levels[texture.residentLevel - 1].width <= ResidentLevelSize &&
+		       texture.levels[texture.residentLevel - 1].height <= ResidentLevelSize)
+			texture.residentLevel--;
+
+		for (int level = levelCount - 1; level >= texture.residentLevel; level--)
+			uploadLevel(texture, level);
+
+		// Sampling stays within the uploaded levels, the texture is complete from the first frame
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.residentLevel);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		                levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		GLuint textureID = texture.textureID;
+		if (texture.residentLevel == 0) {
+			unmapFile(texture);
+		} else {
+			// The big levels come next, start reading them ahead
+			const MipLevel &first = texture.levels[0];
+			madvise((void *) texture.bytes, texture.size, MADV_WILLNEED);
+			printf("%dx%d texture streaming, %ux%u for now\n", first.width, first.height,
+			       texture.levels[texture.residentLevel].width, texture.levels[texture.residentLevel].height);
+			streaming.push_back(texture);
+		}
+		return textureID;
+	}
+}
 
 GLuint loadDDS(const char * imagepath){
+	MappedTexture texture;
+	if (!mapFile(imagepath, texture))
+		return 0;
 
-	unsigned char header[124];
+	const unsigned char *bytes = texture.bytes;
+	const unsigned char *header = bytes + 4;
+	const size_t headerSize = 4 + 124;
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
+	// Magic, then a DDS_HEADER and its DDS_PIXELFORMAT, both carry their own size
+	if (texture.size < headerSize || strncmp((const char *) bytes, "DDS ", 4) != 0 ||
+	    readUint(header) != 124 || readUint(header + 72) != 32) {
+		printf("%s is not a DDS file\n", imagepath);
+		unmapFile(texture);
 		return 0;
 	}
-   
-	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
+
+	unsigned int height      = readUint(header + 8);
+	unsigned int width       = readUint(header + 12);
+	unsigned int mipMapCount = readUint(header + 24);
+	unsigned int pixelFlags  = readUint(header + 76);
+	unsigned int fourCC      = readUint(header + 80);
+
+	unsigned int blockSize = 16;
+	switch (pixelFlags & DDPF_FOURCC ? fourCC : 0) {
+	case FOURCC_DXT1:
+		texture.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		blockSize = 8;
+		break;
+	case FOURCC_DXT3:
+		texture.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+		break;
+	case FOURCC_DXT5:
+		texture.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		break;
+	default:
+		printf("%s : only DXT1, DXT3 and DXT5 are supported\n", imagepath);
+		unmapFile(texture);
+		return 0;
 	}
-	
-	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
-
-	unsigned int height      = *(unsigned int*)&(header[8 ]);
-	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
-	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
-	unsigned int fourCC      = *(unsigned int*)&(header[80]);
-
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
-	switch(fourCC) 
-	{ 
-	case FOURCC_DXT1: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
-		break; 
-	case FOURCC_DXT3: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
-		break; 
-	case FOURCC_DXT5: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
-		break; 
-	default: 
-		free(buffer); 
-		return 0; 
+
+	if (width == 0 || height == 0) {
+		printf("%s has no pixels\n", imagepath);
+		unmapFile(texture);
+		return 0;
+	}
+	if (mipMapCount == 0)
+		mipMapCount = 1;
+
+	// Every level has to be inside the file, the old loader trusted linearSize * 2 instead
+	size_t offset = headerSize;
+	for (unsigned int level = 0; level < mipMapCount; ++level) {
+		unsigned int size = ((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+		if (offset + size > texture.size) {
+			printf("%s is truncated at mip level %u\n", imagepath, level);
+			break;
+		}
+		texture.levels.push_back({width, height, size, bytes + offset});
+		offset += size;
+
+		if (width == 1 && height == 1)
+			break;
+		width  = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	if (texture.levels.empty()) {
+		unmapFile(texture);
+		return 0;
 	}
 
-	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
+	return createStreamedTexture(texture);
+}
 
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
-	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
-	unsigned int offset = 0;
+GLuint loadKTX(const char * imagepath){
+	MappedTexture texture;
+	if (!mapFile(imagepath, texture))
+		return 0;
 
-	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
-	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
-	 
-		offset += size; 
-		width  /= 2; 
-		height /= 2; 
+	static const unsigned char identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+	const unsigned char *bytes = texture.bytes;
+	const size_t headerSize = 64;
 
-		// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
-		if(width < 1) width = 1;
-		if(height < 1) height = 1;
+	// Only little endian files, which is what every tool writes on x86 and ARM
+	if (texture.size < headerSize || memcmp(bytes, identifier, 12) != 0 || readUint(bytes + 12) != 0x04030201) {
+		printf("%s is not a little endian KTX file\n", imagepath);
+		unmapFile(texture);
+		return 0;
+	}
 
-	} 
+	unsigned int glType           = readUint(bytes + 16);
+	unsigned int glFormat         = readUint(bytes + 24);
+	unsigned int glInternalFormat = readUint(bytes + 28);
+	unsigned int width            = readUint(bytes + 36);
+	unsigned int height           = readUint(bytes + 40);
+	unsigned int depth            = readUint(bytes + 44);
+	unsigned int arrayElements    = readUint(bytes + 48);
+	unsigned int faces            = readUint(bytes + 52);
+	unsigned int mipMapCount      = readUint(bytes + 56);
+	unsigned int keyValueBytes    = readUint(bytes + 60);
+
+	if (width == 0 || height == 0 || depth > 1 || arrayElements > 0 || faces != 1) {
+		printf("%s : only plain 2D KTX textures are supported\n", imagepath);
+		unmapFile(texture);
+		return 0;
+	}
 
-	free(buffer); 
+	// glType 0 means a compressed format
+	texture.compressed = glType == 0;
+	texture.internalFormat = glInternalFormat;
+	texture.format = glFormat;
+	texture.type = glType;
+	if (mipMapCount == 0)
+		mipMapCount = 1;
+
+	// Each level is its byte count followed by the data, padded to 4 bytes
+	size_t offset = headerSize + keyValueBytes;
+	for (unsigned int level = 0; level < mipMapCount; ++level) {
+		if (offset + 4 > texture.size)
+			break;
+		unsigned int size = readUint(bytes + offset);
+		offset += 4;
+		if (offset + size > texture.size) {
+			printf("%s is truncated at mip level %u\n", imagepath, level);
+			break;
+		}
+		texture.levels.push_back({width, height, size, bytes + offset});
+		offset += (size + 3) & ~3u;
+
+		width  = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	if (texture.levels.empty()) {
+		unmapFile(texture);
+		return 0;
+	}
 
-	return textureID;
+	return createStreamedTexture(texture);
+}
 
+bool textureStreamUpdate(size_t budgetBytes){
+	if (streaming.empty())
+		return false;
+
+	GLint previousTexture = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previousTexture);
+
+	// Coarse to fine, at least one level per call even if it is bigger than the budget
+	size_t uploaded = 0;
+	for (auto it = streaming.begin(); it != streaming.end() && (uploaded == 0 || uploaded < budgetBytes);) {
+		MappedTexture &texture = *it;
+		glBindTexture(GL_TEXTURE_2D, texture.textureID);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, texture.compressed ? 1 : 4);
+		while (texture.residentLevel > 0 && (uploaded == 0 || uploaded < budgetBytes)) {
+			texture.residentLevel--;
+			uploadLevel(texture, texture.residentLevel);
+			uploaded += texture.levels[texture.residentLevel].size;
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.residentLevel);
+
+		if (texture.residentLevel == 0) {
+			unmapFile(texture);
+			it = streaming.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D, (GLuint) previousTexture);
+	return !streaming.empty();
+}
 
-}
\ No newline at end of file
+void textureStreamCancel(GLuint textureID){
+	for (auto it = streaming.begin(); it != streaming.end(); ++it) {
+		if (it->textureID == textureID) {
+			unmapFile(*it);
+			streaming.erase(it);
+			return;
+		}
+	}
+}
+
+void textureStreamShutdown(){
+	for (MappedTexture &texture : streaming)
+		unmapFile(texture);
+	streaming.clear();
+}
@@ -1,49 +1,162 @@
 #include <vector>
-#include <map>
+#include <cmath>
+#include <cstdint>
 
 #include <glm.hpp>
 
 #include "vboindexer.hpp"
+#include "meshnormals.hpp"
 
 #include <cstring> // for memcmp
 
+namespace {
 
-// Returns true iif v1 can be considered equal to v2
-bool is_near(float v1, float v2){
-	return fabs( v1-v2 ) < 0.01f;
-}
+	// Returns true iif v1 can be considered equal to v2
+	const float Tolerance = 0.01f;
+	bool is_near(float v1, float v2){
+		return fabs( v1-v2 ) < Tolerance;
+	}
 
-// Searches through all already-exported vertices
-// for a similar one.
-// Similar = same position + same UVs + same normal
-bool getSimilarVertexIndex( 
-	glm::vec3 & in_vertex, 
-	glm::vec2 & in_uv, 
-	glm::vec3 & in_normal, 
-	std::vector<glm::vec3> & out_vertices,
-	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals,
-	unsigned short & result
-){
-	// Lame linear search
-	for ( unsigned int i=0; i<out_vertices.size(); i++ ){
-		if (
-			is_near( in_vertex.x , out_vertices[i].x ) &&
-			is_near( in_vertex.y , out_vertices[i].y ) &&
-			is_near( in_vertex.z , out_vertices[i].z ) &&
-			is_near( in_uv.x     , out_uvs     [i].x ) &&
-			is_near( in_uv.y     , out_uvs     [i].y ) &&
-			is_near( in_normal.x , out_normals [i].x ) &&
-			is_near( in_normal.y , out_normals [i].y ) &&
-			is_near( in_normal.z , out_normals [i].z )
-		){
-			result = i;
-			return true;
+	// Tolerant lookups hash the position into cells this wide, a neighbourhood crosses
+	// a cell border on a quarter of the axes on average
+	const double CellSize = 8.0 * Tolerance;
+
+	uint64_t mix(uint64_t hash, uint32_t word){
+		hash = (hash ^ word) * 1099511628211ULL;
+		return hash;
+	}
+
+	// Final avalanche so the low bits, the ones the table uses, depend on every input bit
+	uint64_t finish(uint64_t hash){
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	uint64_t hashBytes(const void *data, size_t size){
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i + 4 <= size; i += 4){
+			uint32_t word;
+			memcpy(&word, (const char *) data + i, sizeof(word));
+			hash = mix(hash, word);
+		}
+		return finish(hash);
+	}
+
+	uint64_t hashCell(const int64_t cell[3]){
+		uint64_t hash = 14695981039346656037ULL;
+		for (int axis = 0; axis < 3; axis++)
+			hash = mix(mix(hash, (uint32_t) cell[axis]), (uint32_t) (cell[axis] >> 32));
+		return finish(hash);
+	}
+
+	const unsigned int Empty = 0xffffffffu;
+
+	// Open addressing, linear probing. Several vertices may share a key (a cell, or
+	// a hash collision), they sit along the probe sequence in the order they were
+	// added, so the first match is the lowest index. Sized up front for every input
+	// vertex, it never grows.
+	class VertexTable{
+	public:
+		explicit VertexTable(size_t maxEntries){
+			size_t capacity = 16;
+			while (capacity < 2 * maxEntries)
+				capacity *= 2;
+			keys.resize(capacity);
+			values.assign(capacity, Empty);
+			mask = capacity - 1;
+		}
+
+		void insert(uint64_t key, unsigned int value){
+			size_t slot = key & mask;
+			while (values[slot] != Empty)
+				slot = (slot + 1) & mask;
+			keys[slot] = key;
+			values[slot] = value;
+		}
+
+		// First value stored under key that match() accepts
+		template<typename Match>
+		bool find(uint64_t key, Match match, unsigned int & result) const{
+			for (size_t slot = key & mask; values[slot] != Empty; slot = (slot + 1) & mask){
+				if (keys[slot] == key && match(values[slot])){
+					result = values[slot];
+					return true;
+				}
+			}
+			return false;
+		}
+
+	private:
+		std::vector<uint64_t> keys;
+		std::vector<unsigned int> values;
+		size_t mask;
+	};
+
+	void positionCell(const glm::vec3 & position, int64_t cell[3]){
+		for (int axis = 0; axis < 3; axis++)
+			cell[axis] = (int64_t) std::floor(position[axis] / CellSize);
+	}
+
+	// Lowest index among the vertices that are near in_vertex, in_uv and in_normal on every axis
+	// (the vertex the lame linear search of the original tutorial stopped at)
+	bool getSimilarVertexIndex(
+		const glm::vec3 & in_vertex,
+		const glm::vec2 & in_uv,
+		const glm::vec3 & in_normal,
+		const std::vector<glm::vec3> & out_vertices,
+		const std::vector<glm::vec2> & out_uvs,
+		const std::vector<glm::vec3> & out_normals,
+		const VertexTable & table,
+		unsigned int & result
+	){
+		auto similar = [&](unsigned int i){
+			return is_near( in_vertex.x , out_vertices[i].x ) &&
+			       is_near( in_vertex.y , out_vertices[i].y ) &&
+			       is_near( in_vertex.z , out_vertices[i].z ) &&
+			       is_near( in_uv.x     , out_uvs     [i].x ) &&
+			       is_near( in_uv.y     , out_uvs     [i].y ) &&
+			       is_near( in_normal.x , out_normals [i].x ) &&
+			       is_near( in_normal.y , out_normals [i].y ) &&
+			       is_near( in_normal.z , out_normals [i].z );
+		};
+
+		// Cells the +-Tolerance box touches, slightly widened against rounding
+		int64_t low[3], high[3], cell[3];
+		for (int axis = 0; axis < 3; axis++){
+			low[axis] = (int64_t) std::floor((in_vertex[axis] - 1.001 * Tolerance) / CellSize);
+			high[axis] = (int64_t) std::floor((in_vertex[axis] + 1.001 * Tolerance) / CellSize);
 		}
+
+		bool found = false;
+		for (cell[0] = low[0]; cell[0] <= high[0]; cell[0]++)
+		for (cell[1] = low[1]; cell[1] <= high[1]; cell[1]++)
+		for (cell[2] = low[2]; cell[2] <= high[2]; cell[2]++){
+			unsigned int index;
+			if (table.find(hashCell(cell), [&](unsigned int i){ return (!found || i < result) && similar(i); }, index)){
+				result = index;
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	// 16 bit indices unless the mesh has too many vertices for them
+	void storeIndices(std::vector<unsigned int> & indices, size_t vertexCount, VertexIndices & out_indices){
+		out_indices.narrow.clear();
+		out_indices.wide.clear();
+		if (vertexCount <= 65536)
+			out_indices.narrow.assign(indices.begin(), indices.end());
+		else
+			out_indices.wide.swap(indices);
 	}
-	// No other vertex could be used instead.
-	// Looks like we'll have to add it to the VBO.
-	return false;
+
+	struct PackedVertex{
+		glm::vec3 position;
+		glm::vec2 uv;
+		glm::vec3 normal;
+	};
 }
 
 void indexVBO_slow(
@@ -51,50 +164,36 @@ void indexVBO_slow(
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	VertexIndices & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
+	VertexTable table(in_vertices.size());
+	std::vector<unsigned int> indices;
+	indices.reserve(in_vertices.size());
+
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
+		unsigned int index;
+		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, table, index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
+			indices.push_back( index );
 		}else{ // If not, it needs to be added in the output data.
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
-		}
-	}
-}
+			indices     .push_back( (unsigned int)out_vertices.size() - 1 );
 
-struct PackedVertex{
-	glm::vec3 position;
-	glm::vec2 uv;
-	glm::vec3 normal;
-	bool operator<(const PackedVertex that) const{
-		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex))>0;
-	};
-};
-
-bool getSimilarVertexIndex_fast( 
-	PackedVertex & packed, 
-	std::map<PackedVertex,unsigned short> & VertexToOutIndex,
-	unsigned short & result
-){
-	std::map<PackedVertex,unsigned short>::iterator it = VertexToOutIndex.find(packed);
-	if ( it == VertexToOutIndex.end() ){
-		return false;
-	}else{
-		result = it->second;
-		return true;
+			int64_t cell[3];
+			positionCell(in_vertices[i], cell);
+			table.insert(hashCell(cell), indices.back());
+		}
 	}
+	storeIndices(indices, out_vertices.size(), out_indices);
 }
 
 void indexVBO(
@@ -102,76 +201,92 @@ void indexVBO(
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	VertexIndices & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
-	std::map<PackedVertex,unsigned short> VertexToOutIndex;
+	VertexTable table(in_vertices.size());
+	std::vector<PackedVertex> packedVertices;
+	std::vector<unsigned int> indices;
+	indices.reserve(in_vertices.size());
 
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
-		
+		uint64_t key = hashBytes(&packed, sizeof(packed));
 
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex_fast( packed, VertexToOutIndex, index);
+		// Try to find the same vertex in out_XXXX, bit for bit
+		unsigned int index;
+		bool found = table.find(key, [&](unsigned int j){
+			return memcmp(&packedVertices[j], &packed, sizeof(PackedVertex)) == 0;
+		}, index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
+			indices.push_back( index );
 		}else{ // If not, it needs to be added in the output data.
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			unsigned short newindex = (unsigned short)out_vertices.size() - 1;
-			out_indices .push_back( newindex );
-			VertexToOutIndex[ packed ] = newindex;
+			packedVertices.push_back( packed );
+			indices     .push_back( (unsigned int)out_vertices.size() - 1 );
+			table.insert(key, indices.back());
 		}
 	}
+	storeIndices(indices, out_vertices.size(), out_indices);
 }
 
-
-
-
-
-
-
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
-	std::vector<glm::vec3> & in_tangents,
-	std::vector<glm::vec3> & in_bitangents,
 
-	std::vector<unsigned short> & out_indices,
+	VertexIndices & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
 	std::vector<glm::vec3> & out_tangents,
 	std::vector<glm::vec3> & out_bitangents
 ){
+	VertexTable table(in_vertices.size());
+	std::vector<unsigned int> indices;
+	indices.reserve(in_vertices.size());
+
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
+		unsigned int index;
+		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, table, index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-
-			// Average the tangents and the bitangents
-			out_tangents[index] += in_tangents[i];
-			out_bitangents[index] += in_bitangents[i];
+			indices.push_back( index );
 		}else{ // If not, it needs to be added in the output data.
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			out_tangents .push_back( in_tangents[i]);
-			out_bitangents .push_back( in_bitangents[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
+			indices     .push_back( (unsigned int)out_vertices.size() - 1 );
+
+			int64_t cell[3];
+			positionCell(in_vertices[i], cell);
+			table.insert(hashCell(cell), indices.back());
 		}
 	}
+
+	// Tangents of the welded mesh, every triangle around a vertex contributes to it
+	size_t vertexCount = out_vertices.size();
+	std::vector<float> tangents(4 * vertexCount);
+	if (vertexCount > 0)
+		meshTangents(&out_vertices[0].x, &out_uvs[0].x, &out_normals[0].x, vertexCount, indices.data(), indices.size(),
+		             tangents.data());
+
+	out_tangents.resize(vertexCount);
+	out_bitangents.resize(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++){
+		out_tangents[i] = glm::vec3(tangents[4 * i], tangents[4 * i + 1], tangents[4 * i + 2]);
+		out_bitangents[i] = tangents[4 * i + 3] * glm::cross(out_normals[i], out_tangents[i]);
+	}
+
+	storeIndices(indices, vertexCount, out_indices);
 }
@@ -1,26 +1,38 @@
 #ifndef VBOINDEXER_HPP
 #define VBOINDEXER_HPP
 
+// Index buffer of an indexed mesh: 16 bit while the mesh has at most 65536
+// vertices, 32 bit past that. Only one of the two vectors is filled.
+struct VertexIndices {
+	std::vector<unsigned short> narrow;
+	std::vector<unsigned int> wide;
+
+	size_t size() const { return wide.empty() ? narrow.size() : wide.size(); }
+	const void * data() const { return wide.empty() ? (const void *) narrow.data() : (const void *) wide.data(); }
+	unsigned int elementSize() const { return wide.empty() ? 2 : 4; } // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+};
+
+// Vertices that are bit for bit the same share an index
 void indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	VertexIndices & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 );
 
-
+// Vertices closer than 0.01 on every attribute share an index. Tangents and
+// bitangents are then computed on the welded mesh by meshTangents(), MikkTSpace
+// style, the bitangent being cross(normal, tangent) with the UV handedness
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
-	std::vector<glm::vec3> & in_tangents,
-	std::vector<glm::vec3> & in_bitangents,
 
-	std::vector<unsigned short> & out_indices,
+	VertexIndices & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
@@ -28,4 +40,16 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & out_bitangents
 );
 
-#endif
\ No newline at end of file
+// Vertices closer than 0.01 on every attribute share an index
+void indexVBO_slow(
+		std::vector<glm::vec3> & in_vertices,
+		std::vector<glm::vec2> & in_uvs,
+		std::vector<glm::vec3> & in_normals,
+
+		VertexIndices & out_indices,
+		std::vector<glm::vec3> & out_vertices,
+		std::vector<glm::vec2> & out_uvs,
+		std::vector<glm::vec3> & out_normals
+);
+
+#endif
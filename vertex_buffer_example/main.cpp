@@ -17,25 +17,30 @@ using namespace glm;
 #include "common/controls.hpp"
 #include "common/objloader.hpp"
 #include "common/vboindexer.hpp"
+#include "common/meshorder.hpp"
 #include "common/shader.hpp"
 #include "common/texture.hpp"
+#include "common/offscreen.hpp"
+#include "common/bundle.hpp"
+#include "common/meshcache.hpp"
 
 int glfw_init();
 int gl_init();
 void glfw_exit();
 
 // IDs need to free up resources
-GLuint vertexbuffer;
-GLuint uvbuffer;
-GLuint normalbuffer;
-GLuint elementbuffer;
+MeshBuffers mesh;
 GLuint programID;
 GLuint Texture;
 GLuint VertexArrayID;
 
-int main() {
+int main(int argc, char **argv) {
+    // Shaders, textures and meshes come from the bundle when there is one, see common/bundle.hpp
+    bundleOpen("assets.bundle");
 
-    if (glfw_init()==-1)
+    // --offscreen FRAMES renders into an FBO without a window, see common/offscreen.hpp
+    bool offscreen = offscreenRequested(argc, argv);
+    if (offscreen ? !offscreenInit(1024, 768, true) : glfw_init()==-1)
         return -1;
 
     if (gl_init()==-1)
@@ -58,38 +63,33 @@ int main() {
     // Get a handle for our "myTextureSampler" uniform
     auto TextureID = (GLuint) glGetUniformLocation(programID, "myTextureSampler");
 
-    std::vector<unsigned short> indices;
-    std::vector<glm::vec3> indexed_vertices;
-    std::vector<glm::vec2> indexed_uvs;
-    std::vector<glm::vec3> indexed_normals;
-    std::vector<glm::vec3> vertices;
-    std::vector<glm::vec2> uvs;
-    std::vector<glm::vec3> normals;
-
-    // Read our .obj file
-    if (!loadOBJ("suzanne.obj", vertices, uvs, normals))
-        return -2;
-
-    indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
-
-    // Load it into a VBO
-
-    glGenBuffers(1, &vertexbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
-
-    glGenBuffers(1, &uvbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2), &indexed_uvs[0], GL_STATIC_DRAW);
-
-    glGenBuffers(1, &normalbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
-
-    // Generate a buffer for the indices as well
-    glGenBuffers(1, &elementbuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+    // The indexed mesh is read back from the cache next to the OBJ after the first run, see common/meshcache.hpp
+    // --vertex-format picks how the vertices are packed on the GPU
+    MeshVertexFormat vertexFormat = meshVertexFormatRequested(argc, argv);
+    if (!meshCacheLoad("suzanne.obj", true, vertexFormat, mesh)) {
+        VertexIndices indices;
+        std::vector<glm::vec3> indexed_vertices;
+        std::vector<glm::vec2> indexed_uvs;
+        std::vector<glm::vec3> indexed_normals;
+        std::vector<glm::vec3> vertices;
+        std::vector<glm::vec2> uvs;
+        std::vector<glm::vec3> normals;
+
+        // Read our .obj file
+        if (!loadOBJ("suzanne.obj", vertices, uvs, normals))
+            return -2;
+
+        indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
+
+        // Triangle and vertex order for the vertex cache, early-z and vertex fetch
+        optimizeMeshOrder("suzanne.obj", indices, indexed_vertices, &indexed_uvs, indexed_normals);
+
+        // Keep it for the next run and load it into VBOs
+        MeshData data = {&indexed_vertices[0].x, &indexed_uvs[0].x, &indexed_normals[0].x, indexed_vertices.size(),
+                         indices.data(), indices.size(), indices.elementSize()};
+        meshCacheStore("suzanne.obj", data, vertexFormat, mesh);
+    }
+    meshSetDequantization(mesh, programID);
 
     // Get a handle for our "LightPosition" uniform
     glUseProgram(programID);
@@ -99,12 +99,15 @@ int main() {
     double lastTime = glfwGetTime();
     int nbFrames = 0;
 
+    bool running;
     do {
+        if (offscreen)
+            offscreenBeginFrame();
 
         // Measure speed
         double currentTime = glfwGetTime();
         nbFrames++;
-        if (currentTime - lastTime >= 1.0) { // If last prinf() was more than 1sec ago
+        if (!offscreen && currentTime - lastTime >= 1.0) { // If last prinf() was more than 1sec ago
             // printf and reset
             printf("%f ms/frame\n", 1000.0 / double(nbFrames));
             nbFrames = 0;
@@ -139,50 +142,17 @@ int main() {
         // Set our "myTextureSampler" sampler to use Texture Unit 0
         glUniform1i(TextureID, 0);
 
-        // 1rst attribute buffer : vertices
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-        glVertexAttribPointer(
-                0,                  // attribute
-                3,                  // size
-                GL_FLOAT,           // type
-                GL_FALSE,           // normalized?
-                0,                  // stride
-                (void *) nullptr            // array buffer offset
-        );
-
-        // 2nd attribute buffer : UVs
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-        glVertexAttribPointer(
-                1,                                // attribute
-                2,                                // size
-                GL_FLOAT,                         // type
-                GL_FALSE,                         // normalized?
-                0,                                // stride
-                (void *) nullptr                          // array buffer offset
-        );
-
-        // 3rd attribute buffer : normals
-        glEnableVertexAttribArray(2);
-        glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-        glVertexAttribPointer(
-                2,                                // attribute
-                3,                                // size
-                GL_FLOAT,                         // type
-                GL_FALSE,                         // normalized?
-                0,                                // stride
-                (void *) nullptr                          // array buffer offset
-        );
+        // Positions, UVs and normals, all from the one interleaved buffer
+        meshBind(mesh);
 
         // Index buffer
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementbuffer);
 
         // Draw the triangles !
         glDrawElements(
                 GL_TRIANGLES,      // mode
-                indices.size(),    // count
-                GL_UNSIGNED_SHORT,   // type
+                mesh.indexCount,   // count
+                mesh.indexType,    // type
                 (void *) nullptr           // element array buffer offset
         );
 
@@ -190,13 +160,20 @@ int main() {
         glDisableVertexAttribArray(1);
         glDisableVertexAttribArray(2);
 
-        // Swap buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (offscreen) {
+            running = offscreenEndFrame();
+        } else {
+            // Swap buffers
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+
+            // Check if the ESC key was pressed or the window was closed
+            running = glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && glfwWindowShouldClose(window) == 0;
+        }
 
-    } // Check if the ESC key was pressed or the window was closed
-    while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
-           glfwWindowShouldClose(window) == 0);
+        // The large mip levels come in once the first frames are out
+        textureStreamUpdate();
+    } while (running);
 
     glfw_exit();
 
@@ -244,7 +221,8 @@ int gl_init(){
     // Initialize GLEW
     glewExperimental = GL_TRUE; // Needed for core profile
 
-    if (glewInit() != GLEW_OK) {
+    // glewInit() looks for a window system, an offscreen context has none
+    if ((offscreenActive() ? glewContextInit() : glewInit()) != GLEW_OK) {
         fprintf(stderr, "Failed to initialize GLEW\n");
         getchar();
         glfwTerminate();
@@ -267,14 +245,16 @@ int gl_init(){
 
 void glfw_exit(){
     // Cleanup VBO and shader
-    glDeleteBuffers(1, &vertexbuffer);
-    glDeleteBuffers(1, &uvbuffer);
-    glDeleteBuffers(1, &normalbuffer);
-    glDeleteBuffers(1, &elementbuffer);
+    meshRelease(mesh);
     glDeleteProgram(programID);
     glDeleteTextures(1, &Texture);
+    textureStreamShutdown();
     glDeleteVertexArrays(1, &VertexArrayID);
 
+    // Prints the frame times, needs the context still alive
+    offscreenShutdown();
+    bundleClose();
+
     // Close OpenGL window and terminate GLFW
     glfwTerminate();
 }
\ No newline at end of file